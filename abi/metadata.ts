@@ -22,6 +22,7 @@ import {
 } from "../basic/relativepointer.js";
 import { BoxPair } from "../runtime/heapobject.js";
 import { getApi } from "../lib/api.js";
+import { counters, registerCacheSize } from "../lib/stats.js";
 
 export type OpaqueValue = NativePointer;
 
@@ -32,6 +33,29 @@ export interface TypeLayout {
     extraInhabitantCount: number;
 }
 
+/**
+ * How values of a type are copied and destroyed, decided once per type from
+ * its value witness flags: POD types don't need their witnesses called.
+ */
+export interface ValueCopyPlan {
+    readonly size: number;
+    readonly stride: number;
+    readonly isPOD: boolean;
+    initializeWithCopy(dest: NativePointer, src: NativePointer): void;
+    destroy(object: NativePointer): void;
+    initializeArrayWithCopy(
+        dest: NativePointer,
+        src: NativePointer,
+        count: number
+    ): void;
+    destroyArray(begin: NativePointer, count: number): void;
+}
+
+/* Shared by all wrappers of the same metadata, which may be many */
+const copyPlans = new Map<string, ValueCopyPlan>();
+
+registerCacheSize("valueCopyPlans", () => copyPlans.size);
+
 export class TargetValueBuffer {
     constructor(readonly privateData: NativePointer) {}
 }
@@ -42,6 +66,8 @@ export abstract class TargetMetadata {
     static readonly OFFSETOF_KIND = 0x0;
 
     #kind: MetadataKind;
+    #valueWitnesses: TargetValueWitnessTable;
+    #copyPlan: ValueCopyPlan;
 
     constructor(public readonly handle: NativePointer) {
         this.#kind = this.handle.add(TargetMetadata.OFFSETOF_KIND).readU32();
@@ -56,6 +82,10 @@ export abstract class TargetMetadata {
     }
 
     getValueWitnesses(): TargetValueWitnessTable {
+        if (this.#valueWitnesses !== undefined) {
+            return this.#valueWitnesses;
+        }
+
         const kind = this.getKind();
 
         if (kind !== MetadataKind.Enum && kind !== MetadataKind.Struct) {
@@ -63,7 +93,25 @@ export abstract class TargetMetadata {
         }
 
         const handle = this.handle.sub(Process.pointerSize).readPointer();
-        return new TargetValueWitnessTable(handle);
+        this.#valueWitnesses = new TargetValueWitnessTable(handle);
+        return this.#valueWitnesses;
+    }
+
+    getCopyPlan(): ValueCopyPlan {
+        if (this.#copyPlan !== undefined) {
+            return this.#copyPlan;
+        }
+
+        const key = this.handle.toString();
+        let plan = copyPlans.get(key);
+
+        if (plan === undefined) {
+            plan = makeCopyPlan(this.getValueWitnesses(), this.handle);
+            copyPlans.set(key, plan);
+        }
+
+        this.#copyPlan = plan;
+        return plan;
     }
 
     getTypeLayout(): TypeLayout {
@@ -80,21 +128,38 @@ export abstract class TargetMetadata {
         dest: NativePointer,
         src: NativePointer
     ): NativePointer {
-        return this.getValueWitnesses().initializeWithCopy(
-            dest,
-            src,
-            this.handle
-        );
+        this.getCopyPlan().initializeWithCopy(dest, src);
+        return dest;
+    }
+
+    vw_destroy(object: NativePointer): void {
+        this.getCopyPlan().destroy(object);
+    }
+
+    /* Values are laid out contiguously, each taking up the type's stride */
+    vw_initializeArrayWithCopy(
+        dest: NativePointer,
+        src: NativePointer,
+        count: number
+    ): NativePointer {
+        this.getCopyPlan().initializeArrayWithCopy(dest, src, count);
+        return dest;
+    }
+
+    vw_destroyArray(begin: NativePointer, count: number): void {
+        this.getCopyPlan().destroyArray(begin, count);
     }
 
     vw_getEnumTag(object: NativePointer): number {
-        return this.getValueWitnesses().asEVWT().getEnumTag(object);
+        return this.getValueWitnesses()
+            .asEVWT()
+            .getEnumTag(object, this.handle);
     }
 
     vw_destructiveInjectEnumTag(object: NativePointer, tag: number): void {
         return this.getValueWitnesses()
             .asEVWT()
-            .destructiveInjectEnumTag(object, tag);
+            .destructiveInjectEnumTag(object, tag, this.handle);
     }
 
     abstract getDescription(): TargetTypeContextDescriptor;
@@ -116,6 +181,26 @@ export abstract class TargetMetadata {
         return this.getDescription().getFullTypeName();
     }
 
+    /**
+     * The generic argument vector of an instantiation of a generic type,
+     * which the mangled names of the type's field records refer to through
+     * generic parameters, or NULL for non-generic types.
+     */
+    getGenericArguments(): NativePointer {
+        if (!this.getDescription().isGeneric()) {
+            return NULL;
+        }
+
+        return this.handle.add(
+            this.getGenericArgumentOffset() * Process.pointerSize
+        );
+    }
+
+    /* In words, right after the kind and description of value metadata */
+    protected getGenericArgumentOffset(): number {
+        return 2;
+    }
+
     static from(handle: NativePointer): TargetMetadata {
         const tmp = new TargetValueMetadata(handle);
 
@@ -160,9 +245,13 @@ export class TargetValueMetadata extends TargetMetadata {
 }
 
 export class TargetClassMetadata extends TargetMetadata {
+    static readonly OFFSETOF_SUPERCLASS = Process.pointerSize;
+    static readonly OFFSETOF_DATA = Process.pointerSize * 4;
+    static readonly OFFSETOF_INSTANCE_SIZE = Process.pointerSize * 6;
     static readonly OFFSTETOF_DESCRIPTION = Process.pointerSize * 8;
 
     #description: NativePointer;
+    #instanceSize: number;
 
     get description(): NativePointer {
         if (this.#description === undefined) {
@@ -174,15 +263,130 @@ export class TargetClassMetadata extends TargetMetadata {
         return this.#description;
     }
 
+    /**
+     * Tells Swift classes apart from pure ObjC ones, which share the layout
+     * up to the rodata pointer. Its low bits are the "is Swift" flag: bit 1
+     * with the stable ABI, bit 0 before it.
+     */
+    isTypeMetadata(): boolean {
+        const data = this.handle
+            .add(TargetClassMetadata.OFFSETOF_DATA)
+            .readPointer();
+        return !data.and(3).isNull();
+    }
+
+    /** Including the object header, so never more than the block it's in */
+    get instanceSize(): number {
+        if (this.#instanceSize === undefined) {
+            this.#instanceSize = this.handle
+                .add(TargetClassMetadata.OFFSETOF_INSTANCE_SIZE)
+                .readU32();
+        }
+
+        return this.#instanceSize;
+    }
+
     getDescription(): TargetClassDescriptor {
         return new TargetClassDescriptor(this.description);
     }
+
+    /**
+     * TODO:
+     * - Handle resilient superclasses, whose metadata bounds are only known
+     *   at runtime
+     */
+    protected getGenericArgumentOffset(): number {
+        const descriptor = this.getDescription();
+
+        if (descriptor.hasResilientSuperClass()) {
+            throw new Error(
+                "Classes with resilient superclasses aren't supported yet"
+            );
+        }
+
+        return (
+            descriptor.metadataPositiveSizeInWords -
+            descriptor.numImmediateMembers
+        );
+    }
+
+    /**
+     * Offsets of the stored properties declared by this class, in the same
+     * order as its field descriptor's records.
+     */
+    getFieldOffsets(): number[] {
+        const descriptor = this.getDescription();
+
+        /**
+         * TODO:
+         * - Handle resilient superclasses, whose field offset vector offset
+         *   is relative to the metadata bounds computed at runtime
+         */
+        if (descriptor.hasResilientSuperClass()) {
+            throw new Error(
+                "Classes with resilient superclasses aren't supported yet"
+            );
+        }
+
+        const vector = this.handle.add(
+            descriptor.fieldOffsetVectorOffset * Process.pointerSize
+        );
+        const result: number[] = [];
+
+        for (let i = 0; i !== descriptor.numFields; i++) {
+            result.push(
+                vector.add(i * Process.pointerSize).readU64().toNumber()
+            );
+        }
+
+        return result;
+    }
+
+    /**
+     * @returns null for root classes, which includes those inheriting from
+     * an ObjC class as its metadata isn't a Swift one
+     */
+    getSuperclass(): TargetClassMetadata {
+        const superclass = this.handle
+            .add(TargetClassMetadata.OFFSETOF_SUPERCLASS)
+            .readPointer();
+
+        if (superclass.isNull()) {
+            return null;
+        }
+
+        const metadata = new TargetClassMetadata(superclass);
+        return metadata.isTypeMetadata() ? metadata : null;
+    }
 }
 
 export class TargetStructMetadata extends TargetValueMetadata {
     getDescription(): TargetStructDescriptor {
         return new TargetStructDescriptor(this.description);
     }
+
+    /**
+     * Offsets of the stored properties, in the same order as the field
+     * descriptor's records. Unlike those of classes, they're 32-bit.
+     */
+    getFieldOffsets(): number[] {
+        const descriptor = this.getDescription();
+        const result: number[] = [];
+
+        if (!descriptor.hasFieldOffsetVector()) {
+            return result;
+        }
+
+        const vector = this.handle.add(
+            descriptor.fieldOffsetVectorOffset * Process.pointerSize
+        );
+
+        for (let i = 0; i !== descriptor.numFields; i++) {
+            result.push(vector.add(i * 4).readU32());
+        }
+
+        return result;
+    }
 }
 
 export class TargetEnumMetadata extends TargetValueMetadata {
@@ -191,42 +395,158 @@ export class TargetEnumMetadata extends TargetValueMetadata {
     }
 }
 
+function makeCopyPlan(
+    valueWitnesses: TargetValueWitnessTable,
+    self: NativePointer
+): ValueCopyPlan {
+    const { size, stride } = valueWitnesses;
+
+    if (!valueWitnesses.flags.isPOD) {
+        return {
+            size,
+            stride,
+            isPOD: false,
+            initializeWithCopy(dest, src) {
+                counters.values.witnessCopies++;
+                valueWitnesses.initializeWithCopy(dest, src, self);
+            },
+            destroy(object) {
+                valueWitnesses.destroy(object, self);
+            },
+            /*
+             * The array witnesses are long gone from the VWT, these runtime
+             * functions are what the compiler calls instead
+             */
+            initializeArrayWithCopy(dest, src, count) {
+                counters.values.witnessCopies++;
+                getApi().swift_arrayInitWithCopy(dest, src, count, self);
+            },
+            destroyArray(begin, count) {
+                getApi().swift_arrayDestroy(begin, count, self);
+            },
+        };
+    }
+
+    /* A few word-sized accesses are cheaper than a call into Memory.copy() */
+    const words = size % 8 === 0 && size <= 32 ? size / 8 : -1;
+    const initializeWithCopy =
+        words !== -1
+            ? (dest: NativePointer, src: NativePointer) => {
+                  counters.values.podCopies++;
+                  for (let offset = 0; offset !== size; offset += 8) {
+                      dest.add(offset).writeU64(src.add(offset).readU64());
+                  }
+              }
+            : (dest: NativePointer, src: NativePointer) => {
+                  counters.values.podCopies++;
+                  Memory.copy(dest, src, size);
+              };
+
+    return {
+        size,
+        stride,
+        isPOD: true,
+        initializeWithCopy,
+        destroy() {
+            /* Nothing to release */
+        },
+        initializeArrayWithCopy(dest, src, count) {
+            counters.values.podCopies++;
+            Memory.copy(dest, src, count * stride);
+        },
+        destroyArray() {
+            /* Ditto */
+        },
+    };
+}
+
 class TargetValueWitnessTable {
+    static readonly OFFSETOF_DESTROY = 0x8;
     static readonly OFFSETOF_INTIALIZE_WITH_COPY = 0x10;
+    static readonly OFFSETOF_ASSIGN_WITH_COPY = 0x18;
     static readonly OFFSETOF_SIZE = 0x40;
     static readonly OFFSETOF_STRIDE = 0x48;
     static readonly OFFSETOF_FLAGS = 0x50;
     static readonly OFFSETOF_EXTRA_INHABITANT_COUNT = 0x54;
 
-    readonly initializeWithCopy: (
-        dest: NativePointer,
-        src: NativePointer,
-        self: NativePointer
-    ) => NativePointer;
     readonly size: number;
     readonly stride: number;
     readonly flags: TargetValueWitnessFlags;
     readonly extraInhabitantCount: number;
 
-    constructor(protected handle: NativePointer) {
-        const ptrInitializeWithCopy = this.handle
-            .add(TargetValueWitnessTable.OFFSETOF_INTIALIZE_WITH_COPY)
-            .readPointer();
-        const initializeWithCopy = new NativeFunction(
-            ptrInitializeWithCopy,
-            "pointer",
-            ["pointer", "pointer", "pointer"]
-        );
-        this.initializeWithCopy = (dest, src, self) => {
-            return initializeWithCopy(dest, src, self) as NativePointer;
-        };
+    #initializeWithCopy: NativeFunction<
+        NativePointer,
+        [NativePointerValue, NativePointerValue, NativePointerValue]
+    >;
+    #assignWithCopy: NativeFunction<
+        NativePointer,
+        [NativePointerValue, NativePointerValue, NativePointerValue]
+    >;
+    #destroy: NativeFunction<void, [NativePointerValue, NativePointerValue]>;
+    #enumValueWitnesses: EnumValueWitnessTable;
 
+    constructor(protected handle: NativePointer) {
         this.size = this.getSize();
         this.stride = this.getStride();
         this.flags = this.getFlags();
         this.extraInhabitantCount = this.getExtraInhabitantCount();
     }
 
+    /*
+     * Witnesses are left to first use, as POD types never need them, see
+     * ValueCopyPlan, and only writes to existing values need assignWithCopy.
+     */
+    initializeWithCopy(
+        dest: NativePointer,
+        src: NativePointer,
+        self: NativePointer
+    ): NativePointer {
+        if (this.#initializeWithCopy === undefined) {
+            this.#initializeWithCopy = new NativeFunction(
+                this.readWitness(
+                    TargetValueWitnessTable.OFFSETOF_INTIALIZE_WITH_COPY
+                ),
+                "pointer",
+                ["pointer", "pointer", "pointer"]
+            );
+        }
+
+        return this.#initializeWithCopy(dest, src, self);
+    }
+
+    assignWithCopy(
+        dest: NativePointer,
+        src: NativePointer,
+        self: NativePointer
+    ): NativePointer {
+        if (this.#assignWithCopy === undefined) {
+            this.#assignWithCopy = new NativeFunction(
+                this.readWitness(TargetValueWitnessTable.OFFSETOF_ASSIGN_WITH_COPY),
+                "pointer",
+                ["pointer", "pointer", "pointer"]
+            );
+        }
+
+        return this.#assignWithCopy(dest, src, self);
+    }
+
+    destroy(object: NativePointer, self: NativePointer): void {
+        if (this.#destroy === undefined) {
+            this.#destroy = new NativeFunction(
+                this.readWitness(TargetValueWitnessTable.OFFSETOF_DESTROY),
+                "void",
+                ["pointer", "pointer"]
+            );
+        }
+
+        this.#destroy(object, self);
+    }
+
+    private readWitness(offset: number): NativePointer {
+        counters.nativeFunctions.valueWitnesses++;
+        return this.handle.add(offset).readPointer();
+    }
+
     isValueInline(): boolean {
         return this.flags.isInlineStorage;
     }
@@ -263,7 +583,11 @@ class TargetValueWitnessTable {
     }
 
     asEVWT(): EnumValueWitnessTable {
-        return new EnumValueWitnessTable(this.handle);
+        if (this.#enumValueWitnesses === undefined) {
+            this.#enumValueWitnesses = new EnumValueWitnessTable(this.handle);
+        }
+
+        return this.#enumValueWitnesses;
     }
 }
 
@@ -272,10 +596,11 @@ export class EnumValueWitnessTable extends TargetValueWitnessTable {
     static readonly OFFSETOF_GET_ENUM_TAG = 0x58;
     static readonly OFFSETOF_DESTRUCTIVE_INJECT_ENUM_TAG = 0x68;
 
-    readonly getEnumTag: (object: NativePointer) => number;
+    readonly getEnumTag: (object: NativePointer, self: NativePointer) => number;
     readonly destructiveInjectEnumTag: (
         object: NativePointer,
-        tag: number
+        tag: number,
+        self: NativePointer
     ) => void;
 
     constructor(handle: NativePointer) {
@@ -288,8 +613,9 @@ export class EnumValueWitnessTable extends TargetValueWitnessTable {
             "pointer",
             "pointer",
         ]);
-        this.getEnumTag = (object) => {
-            return getEnumTag(object, this.handle) as number;
+        counters.nativeFunctions.valueWitnesses++;
+        this.getEnumTag = (object, self) => {
+            return getEnumTag(object, self) as number;
         };
 
         pointer = this.handle
@@ -300,8 +626,9 @@ export class EnumValueWitnessTable extends TargetValueWitnessTable {
             "uint32",
             "pointer",
         ]);
-        this.destructiveInjectEnumTag = (object, tag) => {
-            return destructiveInjectEnumTag(object, tag, this.handle);
+        counters.nativeFunctions.valueWitnesses++;
+        this.destructiveInjectEnumTag = (object, tag, self) => {
+            return destructiveInjectEnumTag(object, tag, self);
         };
     }
 }
@@ -442,9 +769,49 @@ export class TargetTypeContextDescriptor extends TargetContextDescriptor {
 class TargetValueTypeDescriptor extends TargetTypeContextDescriptor {}
 
 export class TargetClassDescriptor extends TargetTypeContextDescriptor {
+    static readonly OFFSETOF_SUPERCLASS_TYPE = 0x14;
+    static readonly OFFSETOF_METADATA_POSITIVE_SIZE_IN_WORDS = 0x1c;
+    static readonly OFFSETOF_NUM_IMMEDIATE_MEMBERS = 0x20;
+    static readonly OFFSETOF_NUM_FIELDS = 0x24;
+    static readonly OFFSETOF_FIELD_OFFSET_VECTOR_OFFSET = 0x28;
     static readonly OFFSETOF_TARGET_VTABLE_DESCRIPTOR_HEADER = 0x2c;
     static readonly OFFSETOF_METHOD_DESCRIPTORS = 0x34;
 
+    /** Mangled name of the superclass, null for root classes */
+    get superclassType(): RelativeDirectPointer {
+        return RelativeDirectPointer.From(
+            this.handle.add(TargetClassDescriptor.OFFSETOF_SUPERCLASS_TYPE)
+        );
+    }
+
+    /** Only meaningful without a resilient superclass */
+    get metadataPositiveSizeInWords(): number {
+        return this.handle
+            .add(TargetClassDescriptor.OFFSETOF_METADATA_POSITIVE_SIZE_IN_WORDS)
+            .readU32();
+    }
+
+    /** Generic arguments, field offsets and vtable entries of this class */
+    get numImmediateMembers(): number {
+        return this.handle
+            .add(TargetClassDescriptor.OFFSETOF_NUM_IMMEDIATE_MEMBERS)
+            .readU32();
+    }
+
+    /** Stored properties declared by this class, i.e. not its superclasses */
+    get numFields(): number {
+        return this.handle
+            .add(TargetClassDescriptor.OFFSETOF_NUM_FIELDS)
+            .readU32();
+    }
+
+    /** In words from the metadata's address point */
+    get fieldOffsetVectorOffset(): number {
+        return this.handle
+            .add(TargetClassDescriptor.OFFSETOF_FIELD_OFFSET_VECTOR_OFFSET)
+            .readU32();
+    }
+
     hasVTable(): boolean {
         return this.getTypeContextDescriptorFlags().class_hasVTable();
     }
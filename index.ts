@@ -9,7 +9,7 @@
  *  - inout params
  */
 
-import { getApi, Api, getPrivateAPI } from "./lib/api.js";
+import { getApi, Api, isSwiftRuntimeAvailable } from "./lib/api.js";
 import {
     Class,
     Struct,
@@ -20,6 +20,7 @@ import {
     ObjectInstance,
     StructValue,
     Type,
+    ValueArray,
 } from "./lib/types.js";
 import {
     makeSwiftNativeFunction,
@@ -27,59 +28,112 @@ import {
 } from "./lib/callingconvention.js";
 import { Registry, SwiftModule } from "./lib/registry.js";
 import { SwiftInterceptor } from "./lib/interceptor.js";
-import { getSymbolicator } from "./lib/symbols.js";
+import { loadSwiftIndex, untypedMetadataFor } from "./lib/macho.js";
+import { SwiftIndex } from "./lib/swiftindex.js";
+import { getStats } from "./lib/stats.js";
+import { profiler } from "./lib/profiler.js";
+import { allocationProfiler } from "./lib/allocprofiler.js";
+import { taskTracer } from "./lib/tasktracer.js";
+import { sampler } from "./lib/sampler.js";
+import { ValueMap, ValueSet } from "./lib/valueidentity.js";
+import {
+    exportRegistry,
+    RegistryExportOptions,
+    RegistryExportResult,
+} from "./lib/registryexport.js";
+import {
+    choose,
+    ChooseCallbacks,
+    ChooseOperation,
+    ChooseOptions,
+} from "./lib/heap.js";
 
 type ConvenientSwiftType = Type | Protocol | ProtocolComposition | NativeFunctionReturnType | NativeFunctionArgumentType;
 
+/**
+ * Nothing is resolved, loaded or scanned until first needed, as importing the
+ * bridge shouldn't cost scripts that end up not using it anything. See the
+ * `initialization` entry of Swift.stats() for what each step cost.
+ */
 class Runtime {
     #api: Api = null;
     #initializatioError: Error = null;
 
-    constructor() {
-        try {
-            this.tryInitialize();
-        } catch (e) {
-            /* empty */
-        }
+    get available(): boolean {
+        return isSwiftRuntimeAvailable();
     }
 
-    get available(): boolean {
+    get api(): Api {
         try {
-            return this.tryInitialize();
+            this.tryInitialize();
         } catch (e) {
-            return false;
+            /* empty */
         }
-    }
 
-    get api(): Api {
         return this.#api;
     }
 
     get modules(): Record<string, SwiftModule> {
-        return Registry.shared().modules;
+        return this.getRegistry().modules;
     }
 
     get classes(): Record<string, Class> {
-        return Registry.shared().classes;
+        return this.getRegistry().classes;
     }
 
     get structs(): Record<string, Struct> {
-        return Registry.shared().structs;
+        return this.getRegistry().structs;
     }
 
     get enums(): Record<string, Enum> {
-        return Registry.shared().enums;
+        return this.getRegistry().enums;
     }
 
     get protocols(): Record<string, Protocol> {
-        return Registry.shared().protocols;
+        return this.getRegistry().protocols;
     }
 
     readonly Object = ObjectInstance;
     readonly Struct = StructValue;
     readonly Enum = EnumValue;
+    readonly ValueArray = ValueArray;
+    readonly ValueMap = ValueMap;
+    readonly ValueSet = ValueSet;
     readonly ProtocolComposition = ProtocolComposition;
     readonly Interceptor = SwiftInterceptor;
+    readonly profiler = profiler;
+    readonly allocationProfiler = allocationProfiler;
+    readonly taskTracer = taskTracer;
+    readonly sampler = sampler;
+
+    stats() {
+        return getStats();
+    }
+
+    loadIndex(index: SwiftIndex | string): void {
+        loadSwiftIndex(typeof index === "string" ? JSON.parse(index) : index);
+    }
+
+    exportRegistry(
+        options?: RegistryExportOptions
+    ): Promise<RegistryExportResult> {
+        this.tryInitialize();
+        return exportRegistry(options);
+    }
+
+    metadataFor(typeName: string): NativePointer {
+        this.tryInitialize();
+        return untypedMetadataFor(typeName).handle;
+    }
+
+    choose(
+        klass: Class,
+        callbacks: ChooseCallbacks,
+        options?: ChooseOptions
+    ): ChooseOperation {
+        this.tryInitialize();
+        return choose(klass, callbacks, options);
+    }
 
     NativeFunction(
         address: NativePointer,
@@ -98,6 +152,8 @@ class Runtime {
             return type;
         }
 
+        this.tryInitialize();
+
         const nativeRetType = getNativeType(retType);
         const nativeArgType = argTypes.map((ty) => getNativeType(ty));
 
@@ -110,6 +166,11 @@ class Runtime {
         );
     }
 
+    private getRegistry(): Registry {
+        this.tryInitialize();
+        return Registry.shared();
+    }
+
     private tryInitialize(): boolean {
         if (this.#api !== null) {
             return true;
@@ -120,10 +181,11 @@ class Runtime {
         }
 
         try {
+            /*
+             * The private API and the symbolicator are left to the first
+             * section or symbol look-up, as not every API needs them
+             */
             this.#api = getApi();
-            /* Call these for their side effects, i.e. throwing on failure */
-            getPrivateAPI()
-            getSymbolicator();
         } catch (e) {
             this.#initializatioError = e as Error;
             throw e;
@@ -0,0 +1,451 @@
+/**
+ * Opt-in allocation profiler, see Swift.allocationProfiler, for finding out
+ * which classes churn the heap. swift_allocObject() and swift_deallocObject(),
+ * and optionally swift_retain() and swift_release(), are hooked by a CModule
+ * that aggregates counts and bytes per metadata in a lock-free table, so that
+ * JS stays out of the allocation path: it only reads the table on report().
+ *
+ * The table is open-addressed with a bounded number of probes, types that
+ * don't fit being counted as dropped rather than stalling the allocator.
+ * Objects allocated before start() are counted when freed, so `live` is only
+ * meaningful for types first allocated while recording.
+ *
+ * TODO:
+ *  - Aggregate by generic class pattern rather than by instantiation
+ */
+
+import { getSwiftCoreModuleName } from "./api.js";
+import { describeHeapMetadata, getIsaMask } from "./heap.js";
+
+export interface AllocationProfilerOptions {
+    /** Whether to also count retains and releases, which is costly */
+    retainRelease?: boolean;
+    /** Capture the backtrace of one in every N allocations, 0 to never */
+    backtraceSampling?: number;
+}
+
+export interface AllocationSummary {
+    type: string;
+    metadata: NativePointer;
+    allocations: number;
+    deallocations: number;
+    live: number;
+    allocatedBytes: number;
+    liveBytes: number;
+    retains: number;
+    releases: number;
+    backtraces: NativePointer[][];
+}
+
+export interface AllocationReport {
+    types: AllocationSummary[];
+    /* Allocations of types that didn't fit in the table */
+    dropped: number;
+}
+
+interface AllocationProfilerBackend {
+    module: CModule;
+    profile: NativePointer;
+    reset: NativeFunction<void, []>;
+}
+
+const TABLE_SIZE = 8192;
+const MAX_FRAMES = 16;
+const MAX_SAMPLES = 1024;
+
+/* Keep in sync with the structs below */
+const OFFSETOF_PROFILE_ENABLED = 0x0;
+const OFFSETOF_PROFILE_BACKTRACE_SAMPLING = 0x4;
+const OFFSETOF_PROFILE_ISA_MASK = 0x8;
+const OFFSETOF_PROFILE_DROPPED = 0x10;
+const OFFSETOF_PROFILE_ENTRIES = 0x28;
+const SIZEOF_ENTRY = 7 * 8;
+const SIZEOF_SAMPLE = (2 + MAX_FRAMES) * 8;
+const OFFSETOF_PROFILE_SAMPLES = OFFSETOF_PROFILE_ENTRIES + TABLE_SIZE * SIZEOF_ENTRY;
+
+const ALLOC_PROFILER_CODE = `
+#include <glib.h>
+#include <gum/guminterceptor.h>
+#include <string.h>
+
+#define ALLOC_TABLE_SIZE ${TABLE_SIZE}
+#define ALLOC_MAX_PROBES 64
+#define ALLOC_MAX_FRAMES ${MAX_FRAMES}
+#define ALLOC_MAX_SAMPLES ${MAX_SAMPLES}
+
+typedef struct _AllocEntry AllocEntry;
+typedef struct _AllocSample AllocSample;
+typedef struct _AllocProfile AllocProfile;
+
+struct _AllocEntry
+{
+  gpointer volatile metadata;
+  volatile gssize allocations;
+  volatile gssize deallocations;
+  volatile gssize allocated_bytes;
+  volatile gssize deallocated_bytes;
+  volatile gssize retains;
+  volatile gssize releases;
+};
+
+struct _AllocSample
+{
+  volatile gsize metadata;
+  gsize num_frames;
+  gsize frames[ALLOC_MAX_FRAMES];
+};
+
+struct _AllocProfile
+{
+  volatile gint enabled;
+  guint backtrace_sampling;
+  gsize isa_mask;
+  volatile gssize dropped;
+  volatile gssize num_allocations;
+  volatile gssize next_sample;
+  AllocEntry entries[ALLOC_TABLE_SIZE];
+  AllocSample samples[ALLOC_MAX_SAMPLES];
+};
+
+AllocProfile * profile;
+
+static AllocEntry * lookup_entry (gsize metadata);
+static gsize metadata_of (gpointer object);
+static void record_sample (gsize metadata, GumCpuContext * cpu);
+
+void
+init (void)
+{
+  profile = g_new0 (AllocProfile, 1);
+}
+
+void
+finalize (void)
+{
+  g_free (profile);
+}
+
+void
+alloc_profile_reset (void)
+{
+  memset (profile->entries, 0, sizeof (profile->entries));
+  memset (profile->samples, 0, sizeof (profile->samples));
+  profile->dropped = 0;
+  profile->num_allocations = 0;
+  profile->next_sample = 0;
+}
+
+void
+on_alloc (GumInvocationContext * ic)
+{
+  gsize metadata, size;
+  AllocEntry * entry;
+
+  if (!g_atomic_int_get (&profile->enabled))
+    return;
+
+  metadata = GPOINTER_TO_SIZE (gum_invocation_context_get_nth_argument (ic, 0));
+  size = GPOINTER_TO_SIZE (gum_invocation_context_get_nth_argument (ic, 1));
+
+  entry = lookup_entry (metadata);
+  if (entry == NULL)
+    return;
+
+  g_atomic_pointer_add (&entry->allocations, 1);
+  g_atomic_pointer_add (&entry->allocated_bytes, size);
+
+  if (profile->backtrace_sampling != 0 &&
+      g_atomic_pointer_add (&profile->num_allocations, 1) %
+      profile->backtrace_sampling == 0)
+  {
+    record_sample (metadata, ic->cpu_context);
+  }
+}
+
+void
+on_dealloc (GumInvocationContext * ic)
+{
+  gpointer object;
+  gsize size;
+  AllocEntry * entry;
+
+  if (!g_atomic_int_get (&profile->enabled))
+    return;
+
+  object = gum_invocation_context_get_nth_argument (ic, 0);
+  size = GPOINTER_TO_SIZE (gum_invocation_context_get_nth_argument (ic, 1));
+
+  entry = lookup_entry (metadata_of (object));
+  if (entry == NULL)
+    return;
+
+  g_atomic_pointer_add (&entry->deallocations, 1);
+  g_atomic_pointer_add (&entry->deallocated_bytes, size);
+}
+
+void
+on_retain (GumInvocationContext * ic)
+{
+  gpointer object = gum_invocation_context_get_nth_argument (ic, 0);
+  AllocEntry * entry;
+
+  if (object == NULL || !g_atomic_int_get (&profile->enabled))
+    return;
+
+  entry = lookup_entry (metadata_of (object));
+  if (entry != NULL)
+    g_atomic_pointer_add (&entry->retains, 1);
+}
+
+void
+on_release (GumInvocationContext * ic)
+{
+  gpointer object = gum_invocation_context_get_nth_argument (ic, 0);
+  AllocEntry * entry;
+
+  if (object == NULL || !g_atomic_int_get (&profile->enabled))
+    return;
+
+  entry = lookup_entry (metadata_of (object));
+  if (entry != NULL)
+    g_atomic_pointer_add (&entry->releases, 1);
+}
+
+static AllocEntry *
+lookup_entry (gsize metadata)
+{
+  gsize hash = ((metadata >> 3) * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)) >>
+      (64 - 13);
+  guint i;
+
+  for (i = 0; i != ALLOC_MAX_PROBES; i++)
+  {
+    AllocEntry * entry = &profile->entries[(hash + i) & (ALLOC_TABLE_SIZE - 1)];
+    gpointer key = g_atomic_pointer_get (&entry->metadata);
+
+    if (key == NULL)
+    {
+      /* Claimed, or another thread claimed it for the same type or another */
+      if (g_atomic_pointer_compare_and_exchange (&entry->metadata, NULL,
+          GSIZE_TO_POINTER (metadata)))
+        return entry;
+
+      key = g_atomic_pointer_get (&entry->metadata);
+    }
+
+    if (key == GSIZE_TO_POINTER (metadata))
+      return entry;
+  }
+
+  g_atomic_pointer_add (&profile->dropped, 1);
+
+  return NULL;
+}
+
+static gsize
+metadata_of (gpointer object)
+{
+  return *(gsize *) object & profile->isa_mask;
+}
+
+static void
+record_sample (gsize metadata,
+               GumCpuContext * cpu)
+{
+  AllocSample * sample;
+  gsize * fp;
+  gsize n = 0;
+
+  sample = &profile->samples[
+      g_atomic_pointer_add (&profile->next_sample, 1) % ALLOC_MAX_SAMPLES];
+
+  /* Walked by frame pointers, which Apple platforms guarantee */
+  sample->frames[n++] = cpu->lr;
+
+  for (fp = GSIZE_TO_POINTER (cpu->fp);
+      n != ALLOC_MAX_FRAMES && fp != NULL && (GPOINTER_TO_SIZE (fp) & 0xf) == 0;
+      fp = (gsize *) fp[0])
+  {
+    if (fp[1] == 0)
+      break;
+
+    sample->frames[n++] = fp[1];
+
+    if ((gsize *) fp[0] <= fp)
+      break;
+  }
+
+  sample->num_frames = n;
+  sample->metadata = metadata;
+}
+`;
+
+class AllocationProfiler {
+    #backend: AllocationProfilerBackend = null;
+    #listeners: InvocationListener[] = [];
+    #typeNames = new Map<string, string>();
+
+    get running(): boolean {
+        return this.#listeners.length !== 0;
+    }
+
+    start(options: AllocationProfilerOptions = {}) {
+        if (this.running) {
+            this.stop();
+        }
+
+        const backend = this.getBackend();
+        const { profile, module } = backend;
+        const sampling = options.backtraceSampling ?? 0;
+
+        if (sampling < 0) {
+            throw new Error("Invalid backtrace sampling");
+        }
+
+        profile.add(OFFSETOF_PROFILE_BACKTRACE_SAMPLING).writeU32(sampling);
+        profile.add(OFFSETOF_PROFILE_ISA_MASK).writePointer(getIsaMask());
+
+        const hooks: [string, NativePointer][] = [
+            ["swift_allocObject", module.on_alloc],
+            ["swift_deallocObject", module.on_dealloc],
+        ];
+
+        if (options.retainRelease) {
+            hooks.push(["swift_retain", module.on_retain]);
+            hooks.push(["swift_release", module.on_release]);
+        }
+
+        for (const [name, onEnter] of hooks) {
+            const target = Module.getExportByName(getSwiftCoreModuleName(), name);
+            this.#listeners.push(
+                Interceptor.attach(target, { onEnter } as NativeInvocationListenerCallbacks)
+            );
+        }
+
+        profile.add(OFFSETOF_PROFILE_ENABLED).writeS32(1);
+    }
+
+    stop() {
+        if (this.#backend === null) {
+            return;
+        }
+
+        this.#backend.profile.add(OFFSETOF_PROFILE_ENABLED).writeS32(0);
+
+        for (const listener of this.#listeners) {
+            listener.detach();
+        }
+        this.#listeners = [];
+        Interceptor.flush();
+    }
+
+    /**
+     * Racy while running: allocations counted as it clears the table may
+     * be lost.
+     */
+    reset() {
+        if (this.#backend !== null) {
+            this.#backend.reset();
+        }
+    }
+
+    report(): AllocationReport {
+        if (this.#backend === null) {
+            return { types: [], dropped: 0 };
+        }
+
+        const { profile } = this.#backend;
+        const byMetadata = new Map<string, AllocationSummary>();
+
+        for (let i = 0; i !== TABLE_SIZE; i++) {
+            const entry = profile.add(OFFSETOF_PROFILE_ENTRIES + i * SIZEOF_ENTRY);
+            const metadata = entry.readPointer();
+
+            if (metadata.isNull()) {
+                continue;
+            }
+
+            const read = (field: number) =>
+                entry.add(field * 8).readS64().toNumber();
+            const allocations = read(1);
+            const deallocations = read(2);
+            const allocatedBytes = read(3);
+
+            byMetadata.set(metadata.toString(), {
+                type: this.getTypeName(metadata),
+                metadata,
+                allocations,
+                deallocations,
+                live: allocations - deallocations,
+                allocatedBytes,
+                liveBytes: allocatedBytes - read(4),
+                retains: read(5),
+                releases: read(6),
+                backtraces: [],
+            });
+        }
+
+        for (let i = 0; i !== MAX_SAMPLES; i++) {
+            const sample = profile.add(OFFSETOF_PROFILE_SAMPLES + i * SIZEOF_SAMPLE);
+            const summary = byMetadata.get(sample.readPointer().toString());
+
+            if (summary === undefined) {
+                continue;
+            }
+
+            const numFrames = Math.min(
+                sample.add(8).readU64().toNumber(),
+                MAX_FRAMES
+            );
+            const frames: NativePointer[] = [];
+            for (let j = 0; j !== numFrames; j++) {
+                frames.push(sample.add(16 + j * 8).readPointer().strip());
+            }
+            summary.backtraces.push(frames);
+        }
+
+        return {
+            types: Array.from(byMetadata.values()).sort(
+                (a, b) => b.allocatedBytes - a.allocatedBytes
+            ),
+            dropped: profile
+                .add(OFFSETOF_PROFILE_DROPPED)
+                .readS64()
+                .toNumber(),
+        };
+    }
+
+    private getBackend(): AllocationProfilerBackend {
+        if (this.#backend !== null) {
+            return this.#backend;
+        }
+
+        if (Process.arch !== "arm64") {
+            throw new Error("The allocation profiler is only supported on arm64");
+        }
+
+        const cm = new CModule(ALLOC_PROFILER_CODE);
+
+        this.#backend = {
+            module: cm,
+            profile: cm.profile.readPointer(),
+            reset: new NativeFunction(cm.alloc_profile_reset, "void", []),
+        };
+        return this.#backend;
+    }
+
+    /* Named once per metadata, as the same few types dominate every report */
+    private getTypeName(metadata: NativePointer): string {
+        const key = metadata.toString();
+
+        let name = this.#typeNames.get(key);
+        if (name === undefined) {
+            name = describeHeapMetadata(metadata);
+            this.#typeNames.set(key, name);
+        }
+
+        return name;
+    }
+}
+
+export const allocationProfiler = new AllocationProfiler();
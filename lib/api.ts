@@ -1,3 +1,6 @@
+import { getSectionDiscoveryBackend } from "./sections.js";
+import { traceLazyStep } from "./stats.js";
+
 export interface Api {
     // eslint-disable-next-line @typescript-eslint/ban-types
     [func: string]: Function;
@@ -9,44 +12,85 @@ let cachedApi: Api = null;
 let cachedPrivateAPI: Api = null;
 
 export function getApi(): Api {
-    if (Process.arch !== "arm64" || Process.platform  !== "darwin") {
-        throw new Error("Only arm64(e) Darwin is currently supported");
+    if (getSectionDiscoveryBackend() === null) {
+        throw new Error("Only arm64(e) Darwin and arm64/x86_64 Linux are currently supported");
     }
 
     if (cachedApi !== null) {
         return cachedApi;
     }
 
-    cachedApi = makeAPI([
-        {
-            module: "libswiftCore.dylib",
-            functions: {
-                swift_demangle: [
-                    "pointer",
-                    ["pointer", "size_t", "pointer", "pointer", "int32"],
-                ],
+    cachedApi = traceLazyStep("api", () => {
+        const swiftCore = getSwiftCoreModuleName();
+
+        const api = makeAPI([
+            {
+                module: swiftCore,
+                functions: {
+                    swift_demangle: [
+                        "pointer",
+                        ["pointer", "size_t", "pointer", "pointer", "int32"],
+                    ],
+                    swift_retain: ["pointer", ["pointer"]],
+                    swift_release: ["void", ["pointer"]],
+                    swift_arrayInitWithCopy: [
+                        "void",
+                        ["pointer", "pointer", "size_t", "pointer"],
+                    ],
+                    swift_arrayDestroy: [
+                        "void",
+                        ["pointer", "size_t", "pointer"],
+                    ],
+                    swift_getTypeByMangledNameInContext: [
+                        "pointer",
+                        ["pointer", "size_t", "pointer", "pointer"],
+                    ],
+                },
             },
-        },
-    ]);
-
-    const swiftAPI = makeAPI([
-        {
-            module: "libswiftCore.dylib",
-            functions: {
-                swift_allocBox: [["pointer", "pointer"], ["pointer"]],
+        ]);
+
+        const swiftAPI = makeAPI([
+            {
+                module: swiftCore,
+                functions: {
+                    swift_allocBox: [["pointer", "pointer"], ["pointer"]],
+                },
             },
-        },
-    ]);
-    cachedApi = Object.assign(cachedApi, swiftAPI);
+        ]);
+
+        return Object.assign(api, swiftAPI);
+    });
 
     return cachedApi;
 }
 
+/**
+ * Cheap enough to be called eagerly: doesn't resolve nor initialize anything.
+ */
+export function isSwiftRuntimeAvailable(): boolean {
+    return (
+        getSectionDiscoveryBackend() !== null &&
+        Process.findModuleByName(getSwiftCoreModuleName()) !== null
+    );
+}
+
+/** Only meaningful on supported platforms, see getSectionDiscoveryBackend() */
+export function getSwiftCoreModuleName(): string {
+    return getSectionDiscoveryBackend()?.swiftCoreModuleName ?? null;
+}
+
+/** Darwin-only: there's no CoreSymbolication elsewhere */
 export function getPrivateAPI(): Api {
     if (cachedPrivateAPI !== null) {
         return cachedPrivateAPI;
     }
 
+    cachedPrivateAPI = traceLazyStep("privateApi", makePrivateAPI);
+
+    return cachedPrivateAPI;
+}
+
+function makePrivateAPI(): Api {
     Process.getModuleByName("CoreFoundation").ensureInitialized();
 
     if (Process.findModuleByName("CoreSymbolication") === null) {
@@ -57,16 +101,7 @@ export function getPrivateAPI(): Api {
         }
     }
 
-    cachedPrivateAPI = makeAPI([
-        {
-            module: "libmacho.dylib",
-            functions: {
-                getsectiondata: [
-                    "pointer",
-                    ["pointer", "pointer", "pointer", "pointer"],
-                ],
-            },
-        },
+    return makeAPI([
         {
             module: "CoreSymbolication",
             functions: {
@@ -106,8 +141,6 @@ export function getPrivateAPI(): Api {
             }
         }
     ]);
-
-    return cachedPrivateAPI;
 }
 
 type ApiSpec = ApiSpecEntry[];
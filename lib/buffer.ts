@@ -1,3 +1,5 @@
+import { allocValueMemory } from "./stats.js";
+
 export type PointerSized = UInt64 | NativePointer | number;
 export type RawFields = PointerSized[];
 
@@ -7,7 +9,7 @@ export function makeBufferFromValue(fields: RawFields): NativePointer {
     }
 
     const size = Process.pointerSize * fields.length;
-    const buffer = Memory.alloc(size);
+    const buffer = allocValueMemory(size);
 
     for (
         let i = 0, offset = 0;
@@ -30,12 +30,14 @@ import {
     makeValueFromBuffer,
     moveValueToBuffer,
 } from "./buffer.js";
+import { allocValueMemory, counters, registerCacheSize } from "./stats.js";
+import { profiler } from "./profiler.js";
 
 export type NativeSwiftType = TargetMetadata | ProtocolComposition | NativeFunctionReturnType | NativeFunctionArgumentType;
 export const MAX_LOADABLE_SIZE = Process.pointerSize * 4;
 export const INDRIECT_RETURN_REGISTER = "x8";
 
-class TrampolinePool {
+export class TrampolinePool {
     private static pages: NativePointer[];
     private static currentSlot: NativePointer;
 
@@ -46,6 +48,7 @@ class TrampolinePool {
     private static _initialize() {
         TrampolinePool.pages = [Memory.alloc(Process.pageSize)];
         TrampolinePool.currentSlot = TrampolinePool.currentPage;
+        counters.trampolines.pages++;
     }
 
     public static allocateTrampoline(size: number): NativePointer {
@@ -59,15 +62,44 @@ class TrampolinePool {
         if (TrampolinePool.currentSlot.add(size).compare(currentPageEnd) > 0) {
             currentPage = Memory.alloc(Process.pageSize);
             TrampolinePool.pages.push(currentPage);
+            TrampolinePool.currentSlot = currentPage;
+            counters.trampolines.pages++;
         }
 
         const currentSlot = TrampolinePool.currentSlot;
         TrampolinePool.currentSlot = TrampolinePool.currentSlot.add(size);
+        counters.trampolines.count++;
+        counters.trampolines.bytes += size;
 
         return currentSlot;
     }
 }
 
+/*
+ * Existential containers minus their value, i.e. with the type metadata and
+ * witness tables filled in, per composition and then per type metadata.
+ * Conformances are static, so these are resolved once rather than per call.
+ */
+const existentialTemplates = new Map<string, Map<string, NativePointer>>();
+
+registerCacheSize("existentialTemplates", () => {
+    let size = 0;
+    for (const templates of existentialTemplates.values()) {
+        size += templates.size;
+    }
+    return size;
+});
+
+/**
+ * Where to load the swiftself register from on each call, for callers that
+ * only know its value at call time, see SwiftInterceptor.replace().
+ */
+export interface SwiftContextSlot {
+    slot: NativePointer;
+}
+
+export type SwiftContext = NativePointer | SwiftContextSlot;
+
 export interface SwiftNativeFunction {
     address: NativePointer;
     (...args: any[]): any;
@@ -82,9 +114,13 @@ export function makeSwiftNativeFunction(
     address: NativePointer,
     retType: NativeSwiftType,
     argTypes: NativeSwiftType[],
-    context?: NativePointer,
+    context?: SwiftContext,
     throws?: boolean
 ): SwiftNativeFunction {
+    if (Process.arch !== "arm64") {
+        throw new Error("Swift native functions are only supported on arm64");
+    }
+
     const loweredArgType = argTypes.map((ty) => lowerSemantically(ty));
     const loweredRetType = lowerSemantically(retType) as NativeFunctionReturnType;
 
@@ -95,70 +131,11 @@ export function makeSwiftNativeFunction(
         context
     ).wrapper;
 
-    const wrapper = function (...args: RuntimeInstance[]) {
-        const actualArgs: any[] = [];
-
-        for (const [i, arg] of args.entries()) {
-            const argType = argTypes[i];
-
-            /* NativeType: e.g. 'uint64', 'pointer', 'bool' */
-            if (typeof argType === "string" || Array.isArray(argType)) {
-                actualArgs.push(arg);
-                continue;
-            }
-
-            if (argType instanceof TargetMetadata) {
-                actualArgs.push(lowerPhysically(arg));
-                continue;
-            }
-
-            const composition = argType;
-            const typeMetadata = arg.$metadata;
-            let container:
-                | TargetOpaqueExistentialContainer
-                | ClassExistentialContainer;
-
-            if (!composition.isClassOnly) {
-                container = TargetOpaqueExistentialContainer.alloc(
-                    composition.numProtocols
-                );
-                container.type = typeMetadata;
-
-                if (typeMetadata.isClassObject()) {
-                    container.buffer.privateData.writePointer(arg.handle);
-                } else {
-                    const box = typeMetadata.allocateBoxForExistentialIn(
-                        container.buffer
-                    );
-                    typeMetadata.vw_initializeWithCopy(box, arg.handle);
-                }
-            } else {
-                container = ClassExistentialContainer.alloc(
-                    composition.numProtocols
-                );
-                container.value = arg.handle;
-            }
-
-            const base = container.getWitnessTables();
-            for (const [i, proto] of composition.protocols.entries()) {
-                const typeName = typeMetadata.getFullTypeName();
-                const conformance =
-                    getProtocolConformancesFor(typeName)[proto.name];
-                if (conformance === undefined) {
-                    throw new Error(
-                        `Type ${typeName} does not conform to protocol ${proto.name}`
-                    );
-                }
-                const vwt = conformance.witnessTable;
-
-                base.add(i * Process.pointerSize).writePointer(vwt);
-            }
-
-            actualArgs.push(lowerPhysically(container));
-        }
-
-        const retval = swiftcallWrapper(...actualArgs);
+    const argTemplates = argTypes.map((ty) =>
+        ty instanceof ProtocolComposition ? getExistentialTemplates(ty) : null
+    );
 
+    const liftReturnValue = function (retval: any) {
         if (typeof retType === "string" || Array.isArray(retType)) {
             return retval;
         }
@@ -184,9 +161,163 @@ export function makeSwiftNativeFunction(
         return ValueInstance.fromExistentialContainer(buf, retType);
     };
 
+    const wrapper = function (...args: RuntimeInstance[]) {
+        const profile = profiler.enabled
+            ? profiler.getProfile("function", address)
+            : null;
+        const start = profile !== null ? profiler.now() : 0;
+        const actualArgs: any[] = [];
+
+        for (const [i, arg] of args.entries()) {
+            const argType = argTypes[i];
+
+            /* NativeType: e.g. 'uint64', 'pointer', 'bool' */
+            if (typeof argType === "string" || Array.isArray(argType)) {
+                actualArgs.push(arg);
+                continue;
+            }
+
+            if (argType instanceof TargetMetadata) {
+                const loweringStart = profiler.mark();
+                actualArgs.push(lowerPhysically(arg));
+                profiler.recordOperation("lowerPhysically", loweringStart);
+                continue;
+            }
+
+            const boxingStart = profiler.mark();
+            const container = boxExistential(arg, argType, argTemplates[i]);
+            actualArgs.push(lowerPhysically(container));
+            profiler.recordOperation("existentialBoxing", boxingStart);
+        }
+
+        if (profile === null) {
+            return liftReturnValue(swiftcallWrapper(...actualArgs));
+        }
+
+        const calleeStart = profiler.now();
+        const retval = swiftcallWrapper(...actualArgs);
+        const calleeEnd = profiler.now();
+        const result = liftReturnValue(retval);
+        const end = profiler.now();
+
+        profile.latency.record(end - start);
+        profile.bridgeNs += calleeStart - start + (end - calleeEnd);
+        profile.nativeNs += calleeEnd - calleeStart;
+
+        return result;
+    };
+
     return Object.assign(wrapper, { address });
 }
 
+/**
+ * Copies the value into a new existential container, except for class
+ * instances which are referenced as-is, i.e. without being retained.
+ */
+export function boxExistential(
+    value: RuntimeInstance,
+    composition: ProtocolComposition,
+    templates = getExistentialTemplates(composition)
+): TargetOpaqueExistentialContainer | ClassExistentialContainer {
+    const typeMetadata = value.$metadata;
+    const template = getExistentialTemplate(
+        templates,
+        typeMetadata,
+        composition
+    );
+
+    if (composition.isClassOnly) {
+        const container = ClassExistentialContainer.alloc(
+            composition.numProtocols
+        );
+        Memory.copy(container.handle, template, container.sizeof);
+        container.value = value.handle;
+        return container;
+    }
+
+    const container = TargetOpaqueExistentialContainer.alloc(
+        composition.numProtocols
+    );
+    Memory.copy(container.handle, template, container.sizeof);
+
+    if (typeMetadata.isClassObject()) {
+        container.buffer.privateData.writePointer(value.handle);
+    } else {
+        const box = typeMetadata.allocateBoxForExistentialIn(container.buffer);
+        typeMetadata.vw_initializeWithCopy(box, value.handle);
+    }
+
+    return container;
+}
+
+function getExistentialTemplates(
+    composition: ProtocolComposition
+): Map<string, NativePointer> {
+    const key = composition.protocols
+        .map((proto) => proto.descriptor.handle.toString())
+        .join("&");
+
+    let templates = existentialTemplates.get(key);
+    if (templates === undefined) {
+        templates = new Map<string, NativePointer>();
+        existentialTemplates.set(key, templates);
+    }
+
+    return templates;
+}
+
+function getExistentialTemplate(
+    templates: Map<string, NativePointer>,
+    typeMetadata: TargetMetadata,
+    composition: ProtocolComposition
+): NativePointer {
+    const key = typeMetadata.handle.toString();
+
+    let template = templates.get(key);
+    if (template !== undefined) {
+        counters.existentials.cache.hits++;
+        return template;
+    }
+
+    counters.existentials.cache.misses++;
+
+    const typeName = typeMetadata.getFullTypeName();
+    const conformances = getProtocolConformancesFor(typeName);
+
+    /* Resolved before allocating, so that failed lookups don't leak */
+    const witnessTables = composition.protocols.map((proto) => {
+        const conformance = conformances[proto.name];
+        if (conformance === undefined) {
+            throw new Error(
+                `Type ${typeName} does not conform to protocol ${proto.name}`
+            );
+        }
+
+        return conformance.witnessTable;
+    });
+
+    template = allocValueMemory(composition.sizeofExistentialContainer);
+    let base: NativePointer;
+
+    if (!composition.isClassOnly) {
+        template
+            .add(TargetOpaqueExistentialContainer.OFFSETOF.type)
+            .writePointer(typeMetadata.handle);
+        base = template.add(
+            TargetOpaqueExistentialContainer.OFFSETOF.wintessTable
+        );
+    } else {
+        base = template.add(ClassExistentialContainer.OFFSETOF.witnessTables);
+    }
+
+    for (const [i, witnessTable] of witnessTables.entries()) {
+        base.add(i * Process.pointerSize).writePointer(witnessTable);
+    }
+
+    templates.set(key, template);
+    return template;
+}
+
 function lowerSemantically(type: NativeSwiftType): NativeFunctionReturnType | NativeFunctionArgumentType {
     if (typeof type === "string" || Array.isArray(type)) {
         return type;
@@ -216,9 +347,9 @@ function lowerSemantically(type: NativeSwiftType): NativeFunctionReturnType | Na
     return Array(sizeInQWords).fill("uint64");
 }
 
-type PointerSized = UInt64 | NativePointer;
+export type PointerSized = UInt64 | NativePointer;
 
-function lowerPhysically(
+export function lowerPhysically(
     value:
         | RuntimeInstance
         | TargetOpaqueExistentialContainer
@@ -248,6 +379,39 @@ function lowerPhysically(
     );
 }
 
+/*
+ * Registers of a call as spilled by native code on entry to a Swift function,
+ * i.e. by the SwiftInterceptor.replace() thunk and the hook gate, for JS to
+ * read arguments from. x0-x3 double as the direct return value registers.
+ */
+export class SwiftCallFrame {
+    static readonly OFFSETOF_X0 = 0x0;
+    static readonly OFFSETOF_X8 = 0x40;
+    static readonly OFFSETOF_X20 = 0x48;
+    static readonly OFFSETOF_STACK_ARGS = 0x50;
+    static readonly OFFSETOF_RETURN_ADDRESS = 0x58;
+    static readonly SIZE = 0x60;
+    static readonly NUM_ARGUMENT_REGISTERS = 8;
+}
+
+/**
+ * Reads the i-th pointer-sized argument, be it passed in a register or on the
+ * stack.
+ */
+export function readSwiftCallFrameArgument(
+    frame: NativePointer,
+    i: number
+): NativePointer {
+    if (i < SwiftCallFrame.NUM_ARGUMENT_REGISTERS) {
+        return frame.add(i * Process.pointerSize).readPointer();
+    }
+
+    const stackArgs = frame.add(SwiftCallFrame.OFFSETOF_STACK_ARGS).readPointer();
+    const offset =
+        (i - SwiftCallFrame.NUM_ARGUMENT_REGISTERS) * Process.pointerSize;
+    return stackArgs.add(offset).readPointer();
+}
+
 export function shouldPassIndirectly(typeMetadata: TargetMetadata): boolean {
     const vwt = typeMetadata.getValueWitnesses();
     return !vwt.flags.isBitwiseTakable;
@@ -297,15 +461,19 @@ export class SwiftcallNativeFunction {
         target: NativePointer,
         resultType: NativeFunctionReturnType,
         argTypes: NativeFunctionArgumentType[],
-        context?: NativePointer,
+        context?: SwiftContext,
         errorResult?: NativePointer
     ) {
+        if (Process.arch !== "arm64") {
+            throw new Error("Swift native functions are only supported on arm64");
+        }
+
         this.#argumentBuffers = new StrongQueue<NativePointer>();
 
         argTypes = argTypes
             .map((argType) => {
                 if (Array.isArray(argType) && argType.length > 4) {
-                    const buf = Memory.alloc(
+                    const buf = allocValueMemory(
                         Process.pointerSize * argType.length
                     );
                     this.#argumentBuffers.enqueue(buf);
@@ -321,7 +489,7 @@ export class SwiftcallNativeFunction {
 
         if (Array.isArray(resultType)) {
             this.#returnBufferSize = Process.pointerSize * resultType.length;
-            this.#returnBuffer = Memory.alloc(this.#returnBufferSize);
+            this.#returnBuffer = allocValueMemory(this.#returnBufferSize);
 
             if (resultType.length > 4) {
                 indirectResult = this.#returnBuffer;
@@ -330,10 +498,11 @@ export class SwiftcallNativeFunction {
             this.#returnBufferSize = 0;
         } else {
             this.#returnBufferSize = Process.pointerSize;
-            this.#returnBuffer = Memory.alloc(this.#returnBufferSize);
+            this.#returnBuffer = allocValueMemory(this.#returnBufferSize);
         }
 
         this.#extraBuffer = Memory.alloc(Process.pointerSize * 2);
+        counters.nativeFunctions.swiftcall++;
 
         const maxPatchSize = 0x4c;
         const trampoline = TrampolinePool.allocateTrampoline(maxPatchSize);
@@ -345,8 +514,11 @@ export class SwiftcallNativeFunction {
             writer.putLdrRegAddress("x15", this.#extraBuffer);
             writer.putStpRegRegRegOffset("x29", "x30", "x15", 0, "post-adjust");
 
-            if (context !== undefined) {
+            if (context instanceof NativePointer) {
                 writer.putLdrRegAddress("x20", context);
+            } else if (context !== undefined) {
+                writer.putLdrRegAddress("x20", context.slot);
+                writer.putLdrRegRegOffset("x20", "x20", 0);
             }
 
             /* TODO: test this */
@@ -0,0 +1,629 @@
+/**
+ * Enumeration of the live instances of a class, see Swift.choose(). The heap
+ * is walked natively on a thread of its own, as a JS-side scan doesn't scale
+ * to the heaps of real-world apps, and matches are handed to JS in batches.
+ *
+ * Darwin-only: relies on the malloc zone introspection API.
+ *
+ * TODO:
+ *  - Support generic classes, whose metadata needs instantiating per set of
+ *    arguments
+ */
+
+import {
+    TargetClassDescriptor,
+    TargetClassMetadata,
+} from "../abi/metadata.js";
+import {
+    getEnumeratedMetadataKind,
+    MetadataKind,
+} from "../abi/metadatavalues.js";
+import { Registry } from "./registry.js";
+import { findLoneContextReference } from "./symbols.js";
+import { Class, ObjectInstance } from "./types.js";
+
+export interface ChooseCallbacks {
+    /**
+     * @returns "stop" to end the scan early
+     */
+    onMatch(instances: ObjectInstance[]): void | "stop";
+    onError?(error: Error): void;
+    onComplete?(): void;
+}
+
+export interface ChooseOptions {
+    /** Whether to also match instances of subclasses, true by default */
+    subclasses?: boolean;
+    /** Maximum number of instances per onMatch() call, 256 by default */
+    batchSize?: number;
+}
+
+export interface ChooseOperation {
+    /** Stops the scan as soon as the current batch has been handled */
+    cancel(): void;
+}
+
+interface ChooseScanState {
+    callbacks: ChooseCallbacks;
+    handle: NativePointer;
+    done: boolean;
+}
+
+interface ChooseBackend {
+    module: CModule;
+    callbacks: NativeCallback<any, any>[];
+    start: NativeFunction<
+        NativePointer,
+        [number, NativePointerValue, number, NativePointerValue, number]
+    >;
+    cancel: NativeFunction<void, [NativePointerValue]>;
+}
+
+const DEFAULT_BATCH_SIZE = 256;
+
+/* Sizeof the { metadata, instance_size } pairs handed to the scanner */
+const TARGET_ENTRY_SIZE = 2 * Process.pointerSize;
+
+/* objc4's, for classes inheriting from NSObject which use non-pointer ISAs */
+const ISA_MASK_ARM64 = ptr("0x0000000ffffffff8");
+const ISA_MASK_ARM64E = ptr("0x007ffffffffffff8");
+
+const CHOOSE_CODE = `
+#include <glib.h>
+
+#define KERN_SUCCESS 0
+#define MALLOC_PTR_IN_USE_RANGE_TYPE 1
+
+typedef int kern_return_t;
+typedef guint task_t;
+typedef gsize vm_address_t;
+typedef gsize vm_size_t;
+
+typedef struct _vm_range_t vm_range_t;
+typedef struct _malloc_zone_t malloc_zone_t;
+typedef struct _malloc_introspection_t malloc_introspection_t;
+
+typedef kern_return_t (* memory_reader_t) (task_t remote_task,
+    vm_address_t remote_address, vm_size_t size, void ** local_memory);
+typedef void (* vm_range_recorder_t) (task_t task, void * context,
+    unsigned type, vm_range_t * ranges, unsigned count);
+
+struct _vm_range_t
+{
+  vm_address_t address;
+  vm_size_t size;
+};
+
+struct _malloc_zone_t
+{
+  void * reserved1;
+  void * reserved2;
+  void * size;
+  void * malloc;
+  void * calloc;
+  void * valloc;
+  void * free;
+  void * realloc;
+  void * destroy;
+  const char * zone_name;
+  void * batch_malloc;
+  void * batch_free;
+  malloc_introspection_t * introspect;
+};
+
+struct _malloc_introspection_t
+{
+  kern_return_t (* enumerator) (task_t task, void * context,
+      unsigned type_mask, vm_address_t zone_address, memory_reader_t reader,
+      vm_range_recorder_t recorder);
+};
+
+typedef struct _ChooseTarget ChooseTarget;
+typedef struct _ChooseScan ChooseScan;
+
+struct _ChooseTarget
+{
+  gsize metadata;
+  gsize instance_size;
+};
+
+struct _ChooseScan
+{
+  guint id;
+  volatile gint cancelled;
+  ChooseTarget * targets;
+  guint num_targets;
+  gsize isa_mask;
+  guint batch_size;
+  GArray * matches;
+};
+
+extern task_t mach_task_self_;
+extern kern_return_t malloc_get_all_zones (task_t task,
+    memory_reader_t reader, vm_address_t ** addresses, unsigned * count);
+
+extern gboolean on_batch (guint id, gpointer * instances, guint count);
+extern void on_complete (guint id);
+
+static gpointer choose_thread (gpointer data);
+static gboolean flush_matches (ChooseScan * scan);
+static void collect_matches (task_t task, void * context, unsigned type,
+    vm_range_t * ranges, unsigned count);
+static const ChooseTarget * find_target (ChooseScan * scan, gsize isa);
+static kern_return_t read_local_memory (task_t remote_task,
+    vm_address_t remote_address, vm_size_t size, void ** local_memory);
+
+ChooseScan *
+choose_start (guint id,
+              const ChooseTarget * targets,
+              guint num_targets,
+              gsize isa_mask,
+              guint batch_size)
+{
+  ChooseScan * scan;
+  guint i;
+
+  scan = g_new0 (ChooseScan, 1);
+  scan->id = id;
+  scan->targets = g_new (ChooseTarget, num_targets);
+  for (i = 0; i != num_targets; i++)
+    scan->targets[i] = targets[i];
+  scan->num_targets = num_targets;
+  scan->isa_mask = isa_mask;
+  scan->batch_size = batch_size;
+  scan->matches = g_array_new (FALSE, FALSE, sizeof (gpointer));
+
+  g_thread_unref (g_thread_new ("swift-choose", choose_thread, scan));
+
+  return scan;
+}
+
+void
+choose_cancel (ChooseScan * scan)
+{
+  g_atomic_int_set (&scan->cancelled, TRUE);
+}
+
+static gpointer
+choose_thread (gpointer data)
+{
+  ChooseScan * scan = data;
+  vm_address_t * zones;
+  unsigned num_zones, i;
+  gboolean stopped = FALSE;
+
+  if (malloc_get_all_zones (mach_task_self_, read_local_memory, &zones,
+      &num_zones) != KERN_SUCCESS)
+    num_zones = 0;
+
+  for (i = 0; i != num_zones && !stopped; i++)
+  {
+    malloc_zone_t * zone = (malloc_zone_t *) zones[i];
+
+    if (zone == NULL || zone->introspect == NULL ||
+        zone->introspect->enumerator == NULL)
+      continue;
+
+    /*
+     * Matches are only handed over once the zone has been walked, as JS
+     * allocating from it mid-enumeration would make the walk unreliable.
+     */
+    zone->introspect->enumerator (mach_task_self_, scan,
+        MALLOC_PTR_IN_USE_RANGE_TYPE, zones[i], read_local_memory,
+        collect_matches);
+
+    stopped = flush_matches (scan);
+  }
+
+  on_complete (scan->id);
+
+  g_array_free (scan->matches, TRUE);
+  g_free (scan->targets);
+  g_free (scan);
+
+  return NULL;
+}
+
+static gboolean
+flush_matches (ChooseScan * scan)
+{
+  GArray * matches = scan->matches;
+  guint offset;
+  gboolean stopped = FALSE;
+
+  for (offset = 0; offset < matches->len && !stopped;
+      offset += scan->batch_size)
+  {
+    guint count = MIN (scan->batch_size, matches->len - offset);
+
+    stopped = g_atomic_int_get (&scan->cancelled) ||
+        on_batch (scan->id, &g_array_index (matches, gpointer, offset), count);
+  }
+
+  g_array_set_size (matches, 0);
+
+  return stopped || g_atomic_int_get (&scan->cancelled);
+}
+
+static void
+collect_matches (task_t task,
+                 void * context,
+                 unsigned type,
+                 vm_range_t * ranges,
+                 unsigned count)
+{
+  ChooseScan * scan = context;
+  unsigned i;
+
+  if (g_atomic_int_get (&scan->cancelled))
+    return;
+
+  for (i = 0; i != count; i++)
+  {
+    const vm_range_t * range = &ranges[i];
+    gsize isa;
+    const ChooseTarget * target;
+
+    /* Metadata pointer and refcounts at the very least */
+    if (range->size < 2 * sizeof (gpointer))
+      continue;
+
+    isa = *(gsize *) range->address;
+
+    target = find_target (scan, isa);
+    if (target == NULL)
+      target = find_target (scan, isa & scan->isa_mask);
+    if (target == NULL || range->size < target->instance_size)
+      continue;
+
+    g_array_append_val (scan->matches, range->address);
+  }
+}
+
+static const ChooseTarget *
+find_target (ChooseScan * scan,
+             gsize isa)
+{
+  guint lo = 0, hi = scan->num_targets;
+
+  while (lo != hi)
+  {
+    guint mid = lo + (hi - lo) / 2;
+    const ChooseTarget * target = &scan->targets[mid];
+
+    if (target->metadata == isa)
+      return target;
+
+    if (target->metadata < isa)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return NULL;
+}
+
+static kern_return_t
+read_local_memory (task_t remote_task,
+                   vm_address_t remote_address,
+                   vm_size_t size,
+                   void ** local_memory)
+{
+  *local_memory = (void *) remote_address;
+  return KERN_SUCCESS;
+}
+`;
+
+const scans = new Map<number, ChooseScanState>();
+let nextScanId = 1;
+let cachedBackend: ChooseBackend = null;
+
+/**
+ * Instances may be freed by other threads at any point, including between
+ * being matched and being handed to onMatch(), so they should be used with
+ * the same care as those from ObjC.choose().
+ */
+export function choose(
+    klass: Class,
+    callbacks: ChooseCallbacks,
+    options: ChooseOptions = {}
+): ChooseOperation {
+    if (Process.platform !== "darwin") {
+        throw new Error("Swift.choose() is currently only supported on Darwin");
+    }
+
+    const backend = getChooseBackend();
+    const targets = getChooseTargets(klass, options.subclasses ?? true);
+    const batchSize = options.batchSize ?? DEFAULT_BATCH_SIZE;
+
+    if (batchSize < 1) {
+        throw new Error("Batch size must be at least 1");
+    }
+
+    const buffer = Memory.alloc(targets.length * TARGET_ENTRY_SIZE);
+    targets.forEach((metadata, i) => {
+        buffer
+            .add(i * TARGET_ENTRY_SIZE)
+            .writePointer(metadata.handle)
+            .add(Process.pointerSize)
+            .writeU32(metadata.instanceSize);
+    });
+
+    const id = nextScanId++;
+    const state: ChooseScanState = { callbacks, handle: null, done: false };
+    scans.set(id, state);
+
+    state.handle = backend.start(
+        id,
+        buffer,
+        targets.length,
+        getIsaMask(),
+        batchSize
+    );
+
+    return {
+        cancel() {
+            /* The scan's native state is gone once it's done */
+            if (!state.done) {
+                backend.cancel(state.handle);
+            }
+        },
+    };
+}
+
+/**
+ * Metadata of the class and, if asked for, of its subclasses known to the
+ * registry, sorted by address for the scanner to binary-search.
+ *
+ * Candidates are first matched by walking up their descriptors' superclass
+ * names, so that only the metadata accessors of actual subclasses are
+ * called, which may otherwise initialize most classes of the process. Only
+ * those whose ancestry can't be told from descriptors are checked through
+ * their metadata.
+ */
+function getChooseTargets(
+    klass: Class,
+    subclasses: boolean
+): TargetClassMetadata[] {
+    const root = klass.$metadata;
+    const targets = [root];
+
+    if (subclasses) {
+        const ancestry = new Map<string, DescriptorAncestry>();
+        const rootDescriptor = klass.descriptor.handle;
+
+        for (const module of Object.values(Registry.shared().modules)) {
+            for (const candidate of Object.values(module.classes)) {
+                if (candidate === klass || candidate.descriptor.isGeneric()) {
+                    continue;
+                }
+
+                const relation = getDescriptorAncestry(
+                    candidate.descriptor,
+                    rootDescriptor,
+                    ancestry
+                );
+                if (relation === DescriptorAncestry.Unrelated) {
+                    continue;
+                }
+
+                let metadata: TargetClassMetadata;
+                try {
+                    metadata = candidate.$metadata;
+                } catch (e) {
+                    continue;
+                }
+
+                if (
+                    relation === DescriptorAncestry.Subclass ||
+                    isSubclassOf(metadata, root)
+                ) {
+                    targets.push(metadata);
+                }
+            }
+        }
+    }
+
+    return targets.sort((a, b) => a.handle.compare(b.handle));
+}
+
+const enum DescriptorAncestry {
+    Subclass,
+    Unrelated,
+    /* E.g. generic ancestors, only known through metadata */
+    Unknown,
+}
+
+/**
+ * Memoized per descriptor, as siblings share most of their ancestry.
+ */
+function getDescriptorAncestry(
+    descriptor: TargetClassDescriptor,
+    root: NativePointer,
+    memo: Map<string, DescriptorAncestry>
+): DescriptorAncestry {
+    const visited: string[] = [];
+    let result: DescriptorAncestry;
+
+    for (let current = descriptor; ; ) {
+        const key = current.handle.toString();
+        const known = memo.get(key);
+        if (known !== undefined) {
+            result = known;
+            break;
+        }
+        visited.push(key);
+
+        const superclassType = current.superclassType;
+        if (superclassType === null) {
+            result = DescriptorAncestry.Unrelated;
+            break;
+        }
+
+        const name = superclassType.get();
+        const superclass = findLoneContextReference(name);
+        if (superclass === null) {
+            /* Objective-C classes can't derive from Swift ones */
+            result =
+                name.readUtf8String(2) === "So"
+                    ? DescriptorAncestry.Unrelated
+                    : DescriptorAncestry.Unknown;
+            break;
+        }
+
+        if (superclass.equals(root)) {
+            result = DescriptorAncestry.Subclass;
+            break;
+        }
+
+        current = new TargetClassDescriptor(superclass);
+    }
+
+    for (const key of visited) {
+        memo.set(key, result);
+    }
+
+    return result;
+}
+
+function isSubclassOf(
+    metadata: TargetClassMetadata,
+    root: TargetClassMetadata
+): boolean {
+    for (
+        let superclass = metadata.getSuperclass();
+        superclass !== null;
+        superclass = superclass.getSuperclass()
+    ) {
+        if (superclass.handle.equals(root.handle)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+function getChooseBackend(): ChooseBackend {
+    if (cachedBackend !== null) {
+        return cachedBackend;
+    }
+
+    /*
+     * Never disposed of, nor are the callbacks: a scanning thread may still be
+     * returning through them after reporting completion.
+     */
+    const onBatch = new NativeCallback(
+        (id: number, instances: NativePointer, count: number): number => {
+            const state = scans.get(id);
+            if (state === undefined || state.done) {
+                return 1;
+            }
+
+            const batch: ObjectInstance[] = [];
+            for (let i = 0; i !== count; i++) {
+                const handle = instances
+                    .add(i * Process.pointerSize)
+                    .readPointer();
+                batch.push(new ObjectInstance(handle));
+            }
+
+            try {
+                return state.callbacks.onMatch(batch) === "stop" ? 1 : 0;
+            } catch (e) {
+                reportError(state, e as Error);
+                return 1;
+            }
+        },
+        "int",
+        ["uint", "pointer", "uint"]
+    );
+    const onComplete = new NativeCallback(
+        (id: number): void => {
+            const state = scans.get(id);
+            scans.delete(id);
+            state.done = true;
+
+            try {
+                state.callbacks.onComplete?.();
+            } catch (e) {
+                reportError(state, e as Error);
+            }
+        },
+        "void",
+        ["uint"]
+    );
+
+    const cm = new CModule(CHOOSE_CODE, {
+        mach_task_self_: Module.getExportByName(
+            "libsystem_kernel.dylib",
+            "mach_task_self_"
+        ),
+        malloc_get_all_zones: Module.getExportByName(
+            "libsystem_malloc.dylib",
+            "malloc_get_all_zones"
+        ),
+        on_batch: onBatch,
+        on_complete: onComplete,
+    });
+
+    cachedBackend = {
+        module: cm,
+        callbacks: [onBatch, onComplete],
+        start: new NativeFunction(cm.choose_start, "pointer", [
+            "uint",
+            "pointer",
+            "uint",
+            "pointer",
+            "uint",
+        ]),
+        cancel: new NativeFunction(cm.choose_cancel, "void", ["pointer"]),
+    };
+    return cachedBackend;
+}
+
+function reportError(state: ChooseScanState, error: Error) {
+    if (state.callbacks.onError !== undefined) {
+        state.callbacks.onError(error);
+    } else {
+        Script.nextTick(() => {
+            throw error;
+        });
+    }
+}
+
+/**
+ * Mask for getting class metadata out of an object's first word, be it a
+ * plain or a non-pointer ISA.
+ */
+export function getIsaMask(): NativePointer {
+    return isArm64e() ? ISA_MASK_ARM64E : ISA_MASK_ARM64;
+}
+
+function isArm64e(): boolean {
+    const p = ptr(1);
+    return !p.sign().equals(p);
+}
+
+/**
+ * Names the type of heap objects for diagnostics, without throwing for those
+ * that aren't instances of Swift classes.
+ */
+export function describeHeapMetadata(metadata: NativePointer): string {
+    const kind = getEnumeratedMetadataKind(metadata.readU32());
+
+    if (kind !== MetadataKind.Class) {
+        /* Boxes, e.g. for captured variables and indirect enum payloads */
+        return `<heap object of kind 0x${kind.toString(16)}>`;
+    }
+
+    const klass = new TargetClassMetadata(metadata);
+    if (!klass.isTypeMetadata()) {
+        return `<non-Swift class ${metadata}>`;
+    }
+
+    try {
+        return klass.getFullTypeName();
+    } catch (e) {
+        return `<class ${metadata}>`;
+    }
+}
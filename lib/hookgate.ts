@@ -0,0 +1,403 @@
+/**
+ * Native gating of SwiftInterceptor.attach() hooks, for functions too hot to
+ * enter JS on every call. Whether a call is handed to JS is decided by a
+ * CModule listener before any JS runs or any argument is decoded, so that
+ * skipped calls only cost an atomic increment or two.
+ *
+ * The gate spills the call's registers into a SwiftCallFrame, the same
+ * layout the replacement thunks use, and calls into JS with it.
+ */
+
+import { SwiftHookPredicate } from "./hookpredicates.js";
+
+export interface SwiftHookGateOptions {
+    /** Only enter JS for one in every `sampling` calls */
+    sampling?: number;
+    /**
+     * Token bucket: at most `perSecond` calls, in bursts of up to `burst`.
+     * Without `perSecond`, the bucket is never refilled, letting `burst` calls
+     * through in total.
+     */
+    rateLimit?: {
+        perSecond?: number;
+        burst?: number;
+    };
+    /** Maximum number of calls entering JS per thread */
+    threadBudget?: number;
+    /** Conditions on the arguments, all of which must hold to enter JS */
+    where?: SwiftHookPredicate[];
+}
+
+export interface SwiftHookGateStats {
+    calls: number;
+    entered: number;
+    skipped: {
+        predicates: number;
+        sampling: number;
+        rateLimit: number;
+        threadBudget: number;
+    };
+}
+
+type FrameCallback = NativeCallback<"void", ["pointer"]>;
+
+export interface SwiftHookGate {
+    handle: NativePointer;
+    stats(): SwiftHookGateStats;
+    resetThreadBudgets(): void;
+    detach(): void;
+}
+
+interface SwiftHookGateBackend {
+    module: CModule;
+    create: NativeFunction<
+        NativePointer,
+        [
+            number,
+            number,
+            number,
+            number,
+            NativePointerValue,
+            NativePointerValue,
+            NativePointerValue
+        ]
+    >;
+    resetThreadBudgets: NativeFunction<void, [NativePointerValue]>;
+    callbacks: NativeInvocationListenerCallbacks;
+}
+
+const GATE_CODE = `
+#include <glib.h>
+#include <gum/guminterceptor.h>
+#include <gum/gumprocess.h>
+
+#define SWIFT_NUM_ARGUMENT_REGISTERS 8
+#define SWIFT_NUM_DIRECT_RESULT_REGISTERS 4
+
+typedef struct _SwiftCallFrame SwiftCallFrame;
+typedef struct _SwiftHookGate SwiftHookGate;
+typedef struct _SwiftHookInvocation SwiftHookInvocation;
+
+typedef void (* SwiftFrameFunc) (SwiftCallFrame * frame);
+typedef gboolean (* SwiftFilterFunc) (const SwiftCallFrame * frame);
+
+/* Keep in sync with SwiftCallFrame in callingconvention.ts */
+struct _SwiftCallFrame
+{
+  guint64 x[SWIFT_NUM_ARGUMENT_REGISTERS];
+  guint64 x8;
+  guint64 x20;
+  gpointer stack_args;
+  gpointer return_address;
+};
+
+/* Counters first, as they're read from JS */
+struct _SwiftHookGate
+{
+  volatile gssize calls;
+  volatile gssize entered;
+  volatile gssize skipped_by_sampling;
+  volatile gssize skipped_by_rate_limit;
+  volatile gssize skipped_by_thread_budget;
+  volatile gssize skipped_by_predicates;
+  volatile gssize matched;
+
+  SwiftFilterFunc filter;
+  gssize sampling;
+  gdouble rate;
+  /* Zero if not rate limited, rate being zero for a bucket never refilled */
+  gdouble burst;
+  guint thread_budget;
+
+  SwiftFrameFunc on_enter;
+  SwiftFrameFunc on_leave;
+
+  GMutex lock;
+  gdouble tokens;
+  gint64 last_refill;
+  GHashTable * thread_calls;
+};
+
+struct _SwiftHookInvocation
+{
+  SwiftCallFrame frame;
+  gboolean entered;
+};
+
+static gboolean gate_admit (SwiftHookGate * gate);
+
+SwiftHookGate *
+gate_new (SwiftFilterFunc filter,
+          guint sampling,
+          gdouble rate,
+          gdouble burst,
+          guint thread_budget,
+          SwiftFrameFunc on_enter,
+          SwiftFrameFunc on_leave)
+{
+  SwiftHookGate * gate;
+
+  gate = g_new0 (SwiftHookGate, 1);
+  gate->filter = filter;
+  gate->sampling = sampling;
+  gate->rate = rate;
+  gate->burst = burst;
+  gate->thread_budget = thread_budget;
+  gate->on_enter = on_enter;
+  gate->on_leave = on_leave;
+
+  g_mutex_init (&gate->lock);
+  gate->tokens = burst;
+  gate->last_refill = g_get_monotonic_time ();
+  gate->thread_calls = g_hash_table_new (NULL, NULL);
+
+  return gate;
+}
+
+void
+gate_reset_thread_budgets (SwiftHookGate * gate)
+{
+  g_mutex_lock (&gate->lock);
+  g_hash_table_remove_all (gate->thread_calls);
+  g_mutex_unlock (&gate->lock);
+}
+
+void
+gate_on_enter (GumInvocationContext * ic)
+{
+  SwiftHookGate * gate = GUM_IC_GET_FUNC_DATA (ic, SwiftHookGate *);
+  SwiftHookInvocation * invocation =
+      GUM_IC_GET_INVOCATION_DATA (ic, SwiftHookInvocation);
+  GumCpuContext * cpu = ic->cpu_context;
+  gssize n;
+  guint i;
+
+  invocation->entered = FALSE;
+
+  g_atomic_pointer_add (&gate->calls, 1);
+
+  /* Spilled first, as that's what predicates are evaluated against */
+  for (i = 0; i != SWIFT_NUM_ARGUMENT_REGISTERS; i++)
+    invocation->frame.x[i] = cpu->x[i];
+  invocation->frame.x8 = cpu->x[8];
+  invocation->frame.x20 = cpu->x[20];
+  invocation->frame.stack_args = GSIZE_TO_POINTER (cpu->sp);
+  invocation->frame.return_address = GSIZE_TO_POINTER (cpu->lr);
+
+  if (gate->filter != NULL && !gate->filter (&invocation->frame))
+  {
+    g_atomic_pointer_add (&gate->skipped_by_predicates, 1);
+    return;
+  }
+
+  /* Sampling one in every N matching calls, rather than of all calls */
+  n = g_atomic_pointer_add (&gate->matched, 1);
+  if (gate->sampling > 1 && n % gate->sampling != 0)
+  {
+    g_atomic_pointer_add (&gate->skipped_by_sampling, 1);
+    return;
+  }
+
+  if (!gate_admit (gate))
+    return;
+
+  invocation->entered = TRUE;
+
+  g_atomic_pointer_add (&gate->entered, 1);
+
+  if (gate->on_enter != NULL)
+    gate->on_enter (&invocation->frame);
+}
+
+void
+gate_on_leave (GumInvocationContext * ic)
+{
+  SwiftHookGate * gate = GUM_IC_GET_FUNC_DATA (ic, SwiftHookGate *);
+  SwiftHookInvocation * invocation =
+      GUM_IC_GET_INVOCATION_DATA (ic, SwiftHookInvocation);
+  GumCpuContext * cpu = ic->cpu_context;
+  guint i;
+
+  if (!invocation->entered || gate->on_leave == NULL)
+    return;
+
+  for (i = 0; i != SWIFT_NUM_DIRECT_RESULT_REGISTERS; i++)
+    invocation->frame.x[i] = cpu->x[i];
+
+  gate->on_leave (&invocation->frame);
+}
+
+static gboolean
+gate_admit (SwiftHookGate * gate)
+{
+  gboolean admitted = TRUE;
+
+  if (gate->burst == 0 && gate->thread_budget == 0)
+    return TRUE;
+
+  g_mutex_lock (&gate->lock);
+
+  if (gate->burst != 0)
+  {
+    gint64 now = g_get_monotonic_time ();
+
+    gate->tokens = MIN (gate->burst, gate->tokens +
+        (gdouble) (now - gate->last_refill) * gate->rate / G_USEC_PER_SEC);
+    gate->last_refill = now;
+
+    if (gate->tokens < 1)
+    {
+      g_atomic_pointer_add (&gate->skipped_by_rate_limit, 1);
+      admitted = FALSE;
+      goto beach;
+    }
+  }
+
+  if (gate->thread_budget != 0)
+  {
+    gpointer thread_id = GSIZE_TO_POINTER (gum_process_get_current_thread_id ());
+    guint used = GPOINTER_TO_UINT (
+        g_hash_table_lookup (gate->thread_calls, thread_id));
+
+    if (used == gate->thread_budget)
+    {
+      g_atomic_pointer_add (&gate->skipped_by_thread_budget, 1);
+      admitted = FALSE;
+      goto beach;
+    }
+
+    g_hash_table_insert (gate->thread_calls, thread_id,
+        GUINT_TO_POINTER (used + 1));
+  }
+
+  if (gate->burst != 0)
+    gate->tokens -= 1;
+
+beach:
+  g_mutex_unlock (&gate->lock);
+
+  return admitted;
+}
+`;
+
+let cachedBackend: SwiftHookGateBackend = null;
+
+/*
+ * Gates are never freed, nor are their callbacks, as a thread may still be
+ * running through them after the listener is detached.
+ */
+const gates: object[] = [];
+
+export function isGated(options: SwiftHookGateOptions): boolean {
+    return (
+        options.sampling !== undefined ||
+        options.rateLimit !== undefined ||
+        options.threadBudget !== undefined ||
+        options.where !== undefined
+    );
+}
+
+/**
+ * Attaches a gate to `target`, the gate being the listener's data.
+ *
+ * @param filter compiled from the options' predicates, see hookpredicates.ts
+ * @param onEnter called with the SwiftCallFrame of admitted calls
+ * @param onLeave called with the same frame, x0-x3 holding the return value
+ */
+export function attachSwiftHookGate(
+    target: NativePointer,
+    options: SwiftHookGateOptions,
+    filter: NativePointer,
+    onEnter: FrameCallback,
+    onLeave: FrameCallback
+): SwiftHookGate {
+    const backend = getSwiftHookGateBackend();
+    const sampling = options.sampling ?? 1;
+    const { rateLimit } = options;
+    const rate = rateLimit?.perSecond ?? 0;
+    const burst =
+        rateLimit !== undefined ? rateLimit.burst ?? Math.max(rate, 1) : 0;
+    const threadBudget = options.threadBudget ?? 0;
+
+    if (
+        sampling < 1 ||
+        rate < 0 ||
+        (rateLimit !== undefined && burst < 1) ||
+        threadBudget < 0
+    ) {
+        throw new Error("Invalid hook gate options");
+    }
+
+    const handle = backend.create(
+        filter ?? NULL,
+        sampling,
+        rate,
+        burst,
+        threadBudget,
+        onEnter ?? NULL,
+        onLeave ?? NULL
+    );
+
+    const listener = Interceptor.attach(target, backend.callbacks, handle);
+    gates.push({ handle, onEnter, onLeave });
+
+    return {
+        handle,
+        stats() {
+            const read = (i: number) =>
+                handle.add(i * Process.pointerSize).readS64().toNumber();
+
+            return {
+                calls: read(0),
+                entered: read(1),
+                skipped: {
+                    predicates: read(5),
+                    sampling: read(2),
+                    rateLimit: read(3),
+                    threadBudget: read(4),
+                },
+            };
+        },
+        resetThreadBudgets() {
+            backend.resetThreadBudgets(handle);
+        },
+        detach() {
+            listener.detach();
+        },
+    };
+}
+
+function getSwiftHookGateBackend(): SwiftHookGateBackend {
+    if (cachedBackend !== null) {
+        return cachedBackend;
+    }
+
+    if (Process.arch !== "arm64") {
+        throw new Error("Gated Swift hooks are only supported on arm64");
+    }
+
+    const cm = new CModule(GATE_CODE);
+
+    cachedBackend = {
+        module: cm,
+        create: new NativeFunction(cm.gate_new, "pointer", [
+            "pointer",
+            "uint",
+            "double",
+            "double",
+            "uint",
+            "pointer",
+            "pointer",
+        ]),
+        resetThreadBudgets: new NativeFunction(
+            cm.gate_reset_thread_budgets,
+            "void",
+            ["pointer"]
+        ),
+        callbacks: {
+            onEnter: cm.gate_on_enter,
+            onLeave: cm.gate_on_leave,
+        },
+    };
+    return cachedBackend;
+}
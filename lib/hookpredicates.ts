@@ -0,0 +1,326 @@
+/**
+ * Conditions on the arguments of gated Swift hooks, see hookgate.ts. They're
+ * compiled into a C filter against the layouts of the argument types, so
+ * that calls not matching them are rejected without entering JS.
+ *
+ * TODO:
+ *  - Support predicates on arguments split between registers and the stack
+ *  - Combine predicates with `or`
+ */
+
+import {
+    EnumValueWitnessTable,
+    TargetEnumMetadata,
+} from "../abi/metadata.js";
+import { MetadataKind } from "../abi/metadatavalues.js";
+import { sizeInQWordsRounded } from "./buffer.js";
+import {
+    MAX_LOADABLE_SIZE,
+    shouldPassIndirectly,
+    SwiftCallFrame,
+} from "./callingconvention.js";
+import { getIsaMask } from "./heap.js";
+import { findProtocolDescriptor, untypedMetadataFor } from "./macho.js";
+import { registerCacheSize } from "./stats.js";
+import { Class, EnumCaseTable, ProtocolComposition } from "./types.js";
+
+/* An argument's position, or the swiftself register, i.e. self for methods */
+export type SwiftHookArgument = number | "self";
+
+export type SwiftIntegerComparison = "==" | "!=" | "<" | "<=" | ">" | ">=";
+
+export type SwiftHookPredicate =
+    | { arg: SwiftHookArgument; case: string }
+    | {
+          arg: SwiftHookArgument;
+          compare: SwiftIntegerComparison;
+          value: number | Int64 | UInt64;
+      }
+    | { arg: SwiftHookArgument; equals: NativePointerValue }
+    | { arg: SwiftHookArgument; subclassOf: Class };
+
+interface ArgumentLayout {
+    typeName: string;
+    /* Index of the first pointer-sized slot, as laid out by liftArguments() */
+    slot: number;
+    numSlots: number;
+}
+
+/* C types of the integers that can be compared, as read from a slot */
+const INTEGER_TYPES: Record<string, string> = {
+    "Swift.Int": "gint64",
+    "Swift.Int64": "gint64",
+    "Swift.Int32": "gint32",
+    "Swift.Int16": "gint16",
+    "Swift.Int8": "gint8",
+    "Swift.UInt": "guint64",
+    "Swift.UInt64": "guint64",
+    "Swift.UInt32": "guint32",
+    "Swift.UInt16": "guint16",
+    "Swift.UInt8": "guint8",
+    "Swift.Bool": "guint8",
+};
+
+const COMPARISONS = new Set(["==", "!=", "<", "<=", ">", ">="]);
+
+const FILTER_PROLOGUE = `
+#include <glib.h>
+
+#define SWIFT_NUM_ARGUMENT_REGISTERS ${SwiftCallFrame.NUM_ARGUMENT_REGISTERS}
+
+typedef struct _SwiftCallFrame SwiftCallFrame;
+
+typedef guint (* SwiftGetEnumTagFunc) (gconstpointer value,
+    gconstpointer self);
+
+/* Keep in sync with SwiftCallFrame in callingconvention.ts */
+struct _SwiftCallFrame
+{
+  guint64 x[SWIFT_NUM_ARGUMENT_REGISTERS];
+  guint64 x8;
+  guint64 x20;
+  gpointer stack_args;
+  gpointer return_address;
+};
+
+static gboolean
+is_kind_of (gsize object,
+            gsize isa_mask,
+            gsize metadata)
+{
+  gsize klass;
+
+  if (object == 0)
+    return FALSE;
+
+  for (klass = *(gsize *) object & isa_mask; klass != 0;
+      klass = *(gsize *) (klass + sizeof (gpointer)))
+  {
+    if (klass == metadata)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+`;
+
+/* Per generated source, as hooks sharing predicates are common */
+const filters = new Map<string, CModule>();
+
+registerCacheSize("hookPredicates", () => filters.size);
+
+/**
+ * @returns a `gboolean (const SwiftCallFrame *)` function pointer
+ */
+export function compileHookPredicates(
+    argTypeNames: string[],
+    predicates: SwiftHookPredicate[]
+): NativePointer {
+    /* Only what precedes the last argument referred to affects its slots */
+    const last = Math.max(
+        -1,
+        ...predicates.map((p) => (typeof p.arg === "number" ? p.arg : -1))
+    );
+    const layouts = layOutArguments(argTypeNames.slice(0, last + 1));
+    const conditions = predicates.map((predicate) =>
+        compilePredicate(predicate, layouts)
+    );
+    const source =
+        FILTER_PROLOGUE +
+        `
+gboolean
+swift_hook_filter (const SwiftCallFrame * frame)
+{
+  const guint64 * stack = frame->stack_args;
+
+  return ${conditions.length === 0 ? "TRUE" : conditions.join(" &&\n      ")};
+}
+`;
+
+    let module = filters.get(source);
+    if (module === undefined) {
+        module = new CModule(source);
+        filters.set(source, module);
+    }
+
+    return module.swift_hook_filter;
+}
+
+function compilePredicate(
+    predicate: SwiftHookPredicate,
+    layouts: ArgumentLayout[]
+): string {
+    const layout = getArgumentLayout(predicate.arg, layouts);
+
+    if ("case" in predicate) {
+        return compileCaseEquals(layout, predicate.case);
+    } else if ("compare" in predicate) {
+        return compileIntegerComparison(
+            layout,
+            predicate.compare,
+            predicate.value
+        );
+    } else if ("equals" in predicate) {
+        const value = predicate.equals;
+        const pointer = value instanceof NativePointer ? value : value.handle;
+        return `${readSlot(layout, 0)} == ${literal(pointer)}`;
+    } else if ("subclassOf" in predicate) {
+        return compileIsKindOf(layout, predicate.subclassOf);
+    }
+
+    throw new Error(`Invalid predicate: ${JSON.stringify(predicate)}`);
+}
+
+function compileCaseEquals(layout: ArgumentLayout, caseName: string): string {
+    const metadata = getArgumentMetadata(layout);
+    if (metadata.getKind() !== MetadataKind.Enum) {
+        throw new Error(`Can't match cases of ${layout.typeName}`);
+    }
+
+    const table = EnumCaseTable.of(metadata as TargetEnumMetadata);
+    const tag = table.cases.findIndex((c) => c.name === caseName);
+    if (tag === -1) {
+        throw new Error(`${layout.typeName} has no case named ${caseName}`);
+    }
+
+    const getEnumTag = metadata
+        .getValueWitnesses()
+        .handle.add(EnumValueWitnessTable.OFFSETOF_GET_ENUM_TAG)
+        .readPointer()
+        .strip();
+    const address =
+        metadata.getTypeLayout().stride > MAX_LOADABLE_SIZE ||
+        shouldPassIndirectly(metadata)
+            ? `(gconstpointer) ${readSlot(layout, 0)}`
+            : addressOfSlots(layout);
+
+    return (
+        `((SwiftGetEnumTagFunc) ${literal(getEnumTag)}) (${address}, ` +
+        `(gconstpointer) ${literal(metadata.handle)}) == ${tag}`
+    );
+}
+
+function compileIntegerComparison(
+    layout: ArgumentLayout,
+    comparison: SwiftIntegerComparison,
+    value: number | Int64 | UInt64
+): string {
+    const type = INTEGER_TYPES[layout.typeName];
+    if (type === undefined) {
+        throw new Error(`Can't compare ${layout.typeName} as an integer`);
+    }
+
+    if (!COMPARISONS.has(comparison)) {
+        throw new Error(`Invalid comparison: ${comparison}`);
+    }
+
+    const digits = value.toString();
+    if (!/^-?\d+$/.test(digits)) {
+        throw new Error(`Invalid integer: ${digits}`);
+    }
+
+    const constant = type.startsWith("gu")
+        ? `G_GUINT64_CONSTANT (${digits})`
+        : `G_GINT64_CONSTANT (${digits})`;
+
+    return `((${type}) ${readSlot(layout, 0)}) ${comparison} ${constant}`;
+}
+
+function compileIsKindOf(layout: ArgumentLayout, klass: Class): string {
+    if (layout.typeName !== undefined) {
+        const metadata = getArgumentMetadata(layout);
+        if (!metadata.isClassObject()) {
+            throw new Error(`${layout.typeName} isn't a class`);
+        }
+    }
+
+    return (
+        `is_kind_of (${readSlot(layout, 0)}, ${literal(getIsaMask())}, ` +
+        `${literal(klass.$metadata.handle)})`
+    );
+}
+
+/**
+ * Mirrors liftArguments(): values take as many slots as they have words, as do
+ * existentials unless they're passed by reference, and class instances one.
+ * Every type given is resolved, so callers pass only the arguments up to the
+ * last one they need.
+ */
+function layOutArguments(argTypeNames: string[]): ArgumentLayout[] {
+    const layouts: ArgumentLayout[] = [];
+    let slot = 0;
+
+    for (const typeName of argTypeNames) {
+        let numSlots: number;
+
+        if (typeName.indexOf("&") > -1 || findProtocolDescriptor(typeName)) {
+            const composition = ProtocolComposition.fromSignature(typeName);
+            const size = composition.sizeofExistentialContainer;
+            numSlots = size <= MAX_LOADABLE_SIZE ? sizeInQWordsRounded(size) : 1;
+        } else {
+            const metadata = untypedMetadataFor(typeName);
+            numSlots = metadata.isClassObject()
+                ? 1
+                : sizeInQWordsRounded(metadata.getTypeLayout().stride);
+        }
+
+        layouts.push({ typeName, slot, numSlots });
+        slot += numSlots;
+    }
+
+    return layouts;
+}
+
+function getArgumentLayout(
+    arg: SwiftHookArgument,
+    layouts: ArgumentLayout[]
+): ArgumentLayout {
+    if (arg === "self") {
+        return { typeName: undefined, slot: -1, numSlots: 1 };
+    }
+
+    const layout = layouts[arg];
+    if (layout === undefined) {
+        throw new Error(`No argument at position ${arg}`);
+    }
+
+    return layout;
+}
+
+function getArgumentMetadata(layout: ArgumentLayout) {
+    if (layout.typeName === undefined) {
+        throw new Error("The type of self is unknown");
+    }
+
+    return untypedMetadataFor(layout.typeName);
+}
+
+function readSlot(layout: ArgumentLayout, word: number): string {
+    if (layout.slot === -1) {
+        return "frame->x20";
+    }
+
+    const slot = layout.slot + word;
+
+    return slot < SwiftCallFrame.NUM_ARGUMENT_REGISTERS
+        ? `frame->x[${slot}]`
+        : `stack[${slot - SwiftCallFrame.NUM_ARGUMENT_REGISTERS}]`;
+}
+
+function addressOfSlots(layout: ArgumentLayout): string {
+    const first = layout.slot;
+    const last = layout.slot + layout.numSlots - 1;
+    const numRegisters = SwiftCallFrame.NUM_ARGUMENT_REGISTERS;
+
+    if (first < numRegisters && last >= numRegisters) {
+        throw new Error(
+            `${layout.typeName} is split between registers and the stack`
+        );
+    }
+
+    return `(gconstpointer) &${readSlot(layout, 0)}`;
+}
+
+function literal(pointer: NativePointer): string {
+    return `G_GUINT64_CONSTANT (${pointer.toString()})`;
+}
@@ -1,22 +1,43 @@
 /* eslint-disable @typescript-eslint/no-namespace */
 import {
     TargetEnumMetadata,
+    TargetMetadata,
     TargetStructMetadata,
     TargetValueMetadata,
 } from "../abi/metadata.js";
 import { MetadataKind } from "../abi/metadatavalues.js";
+import { getApi } from "./api.js";
 import { makeBufferFromValue, RawFields, sizeInQWordsRounded } from "./buffer.js";
 import {
+    boxExistential,
     INDRIECT_RETURN_REGISTER,
+    makeSwiftNativeFunction,
     MAX_LOADABLE_SIZE,
+    NativeSwiftType,
+    readSwiftCallFrameArgument,
     shouldPassIndirectly,
+    SwiftCallFrame,
+    SwiftNativeFunction,
+    TrampolinePool,
 } from "./callingconvention.js";
 import {
     findProtocolDescriptor,
     getDemangledSymbol,
     untypedMetadataFor,
 } from "./macho.js";
-import { parseSwiftMethodSignature } from "./symbols.js";
+import {
+    attachSwiftHookGate,
+    isGated,
+    SwiftHookGateOptions,
+    SwiftHookGateStats,
+} from "./hookgate.js";
+import { compileHookPredicates } from "./hookpredicates.js";
+import {
+    MethodSignatureParseResult,
+    parseSwiftMethodSignature,
+} from "./symbols.js";
+import { CallProfile, profiler } from "./profiler.js";
+import { registerCacheSize } from "./stats.js";
 import {
     EnumValue,
     ObjectInstance,
@@ -42,149 +63,121 @@ interface SwiftScriptInvocationListenerCallbacks {
     ) => void;
 }
 
+type SwiftInvocationListenerOptions = SwiftHookGateOptions;
+
+interface GatedSwiftInvocationListener extends InvocationListener {
+    stats(): SwiftHookGateStats;
+    resetThreadBudgets(): void;
+}
+
+/* What gated hooks' callbacks get as `this`, in lieu of an InvocationContext */
+interface GatedInvocationContext {
+    /* The value of the swiftself register, as with replace() */
+    context: NativePointer;
+    returnAddress: NativePointer;
+    threadId: ThreadId;
+    [key: string]: any;
+}
+
 export namespace SwiftInterceptor {
     export function attach(
         target: NativePointer,
-        callbacks: SwiftScriptInvocationListenerCallbacks
-    ): InvocationListener {
+        callbacks: SwiftScriptInvocationListenerCallbacks,
+        options: SwiftInvocationListenerOptions = {}
+    ): InvocationListener | GatedSwiftInvocationListener {
+        if (Process.arch !== "arm64") {
+            throw new Error("Swift hooks are only supported on arm64");
+        }
+
         const symbol = getDemangledSymbol(target);
         const parsed = parseSwiftMethodSignature(symbol);
         let indirectRetAddr: NativePointer;
 
+        if (isGated(options)) {
+            return attachGated(target, parsed, callbacks, options);
+        }
+
         const onEnter = function (
             this: InvocationContext,
             args: InvocationArguments
         ) {
             indirectRetAddr = (this.context as Arm64CpuContext)[INDRIECT_RETURN_REGISTER];
 
+            const profile = profiler.enabled
+                ? profiler.getProfile("hook", target, symbol)
+                : null;
+            const start = profile !== null ? profiler.now() : 0;
+            let scriptNs = 0;
+
             if (callbacks.onEnter !== undefined) {
-                const swiftyArgs: RuntimeInstance[] = [];
-                let argsIndex = 0;
-                let currentArg: RuntimeInstance;
-
-                for (const argTypeName of parsed.argTypeNames) {
-                    if (isProtocolTypeName(argTypeName)) {
-                        const composition =
-                            ProtocolComposition.fromSignature(argTypeName);
-                        const size = composition.sizeofExistentialContainer;
-                        let buf: NativePointer;
-
-                        if (size <= MAX_LOADABLE_SIZE) {
-                            const sizeQWords = sizeInQWordsRounded(size);
-                            const end = argsIndex + sizeQWords;
-                            const raw = sliceArgs(args, argsIndex, end);
-                            buf = makeBufferFromValue(raw);
-                            argsIndex += sizeQWords;
-                        } else {
-                            buf = args[argsIndex++];
-                        }
-
-                        currentArg = ValueInstance.fromExistentialContainer(
-                            buf,
-                            composition
-                        );
-                        swiftyArgs.push(currentArg);
-                        continue;
-                    }
+                const swiftyArgs = liftArguments(
+                    parsed.argTypeNames,
+                    (i) => args[i]
+                );
 
-                    const argType = untypedMetadataFor(argTypeName);
-                    if (argType.isClassObject()) {
-                        currentArg = new ObjectInstance(args[argsIndex++]);
-                    } else {
-                        const sizeQWords = sizeInQWordsRounded(
-                            argType.getTypeLayout().stride
-                        );
-                        const kind = argType.getKind();
-                        const end = argsIndex + sizeQWords;
-                        const raw = sliceArgs(args, argsIndex, end);
-
-                        if (kind === MetadataKind.Struct) {
-                            const metadata = argType as TargetStructMetadata;
-                            currentArg = new StructValue(metadata, { raw });
-                        } else if (kind === MetadataKind.Enum) {
-                            const metadata = argType as TargetEnumMetadata;
-                            currentArg = new EnumValue(metadata, { raw });
-                        } else {
-                            throw new Error("Unhandled metadata kind: " + kind);
-                        }
-
-                        argsIndex += sizeQWords;
-                    }
-                    swiftyArgs.push(currentArg);
+                const swiftyOnEnter = callbacks.onEnter.bind(this);
+
+                if (profile !== null) {
+                    const scriptStart = profiler.now();
+                    swiftyOnEnter(swiftyArgs);
+                    scriptNs = profiler.now() - scriptStart;
+                } else {
+                    swiftyOnEnter(swiftyArgs);
                 }
+            }
 
-                const swiftyOnEnter = callbacks.onEnter.bind(this);
-                swiftyOnEnter(swiftyArgs);
+            if (profile === null) {
+                return;
+            }
+
+            const end = profiler.now();
+
+            if (onLeave === undefined) {
+                profile.latency.record(end - start);
+                profile.bridgeNs += end - start - scriptNs;
+                profile.scriptNs += scriptNs;
+                return;
             }
+
+            this.swiftProfile = { profile, start, scriptNs, calleeStart: end };
         };
 
         let onLeave: InvocationOnLeaveCallback;
-        if (callbacks.onLeave !== undefined) {
+        /* Without an onLeave we'd be blind to the callee's share of the call */
+        if (callbacks.onLeave !== undefined || profiler.enabled) {
             onLeave = function (
                 this: InvocationContext,
                 retval: InvocationReturnValue
             ) {
                 type register = `x${number}` & keyof Arm64CpuContext
 
-                const retTypeName = parsed.retTypeName;
-                let swiftyRetval: RuntimeInstance;
-
-                if (isProtocolTypeName(retTypeName)) {
-                    const composition =
-                        ProtocolComposition.fromSignature(retTypeName);
-                    const size = composition.sizeofExistentialContainer;
-                    let buf: NativePointer;
-
-                    if (size <= MAX_LOADABLE_SIZE) {
-                        const sizeQWords = sizeInQWordsRounded(size);
-                        const raw: RawFields = [];
-                        for (let i = 0; i != sizeQWords; i++) {
-                            raw.push((this.context as Arm64CpuContext)[`x${i}` as register]);
-                        }
-                        buf = makeBufferFromValue(raw);
-                    } else {
-                        buf = indirectRetAddr;
-                    }
+                const state: HookProfileState = this.swiftProfile;
+                const calleeEnd = state !== undefined ? profiler.now() : 0;
 
-                    swiftyRetval = ValueInstance.fromExistentialContainer(
-                        buf,
-                        composition
-                    );
-                } else {
-                    const retType = untypedMetadataFor(parsed.retTypeName);
-                    if (retType.isClassObject()) {
-                        swiftyRetval = new ObjectInstance(retval);
-                    } else {
-                        const stride = retType.getTypeLayout().stride;
-
-                        if (
-                            stride <= MAX_LOADABLE_SIZE &&
-                            !shouldPassIndirectly(retType)
-                        ) {
-                            const sizeQWords = sizeInQWordsRounded(
-                                retType.getTypeLayout().stride
-                            );
-                            const raw: RawFields = [];
-
-                            for (let i = 0; i < sizeQWords; i++) {
-                                raw.push((this.context as Arm64CpuContext)[`x${i}` as register]);
-                            }
-
-                            swiftyRetval = ValueInstance.fromRaw(
-                                raw,
-                                retType as TargetValueMetadata
-                            );
-                        } else {
-                            swiftyRetval = ValueInstance.fromCopy(
-                                indirectRetAddr,
-                                retType as TargetValueMetadata
-                            );
-                        }
+                if (callbacks.onLeave === undefined) {
+                    if (state !== undefined) {
+                        recordHookProfile(state, calleeEnd, 0);
                     }
+                    return;
                 }
 
+                const cpuContext = this.context as Arm64CpuContext;
+                const swiftyRetval = liftReturnValue(
+                    parsed.retTypeName,
+                    (i) => cpuContext[`x${i}` as register],
+                    indirectRetAddr
+                );
+
                 const swiftyOnLeave = callbacks.onLeave.bind(this);
+
+                if (state === undefined) {
+                    swiftyOnLeave(swiftyRetval);
+                    return;
+                }
+
+                const scriptStart = profiler.now();
                 swiftyOnLeave(swiftyRetval);
+                recordHookProfile(state, calleeEnd, profiler.now() - scriptStart);
             };
         }
 
@@ -193,6 +186,557 @@ export namespace SwiftInterceptor {
             onLeave,
         });
     }
+
+    /**
+     * Replaces the function at `target` with a JavaScript implementation
+     * taking and returning Swift values, see docs/api.md.
+     *
+     * TODO:
+     *  - Support throwing functions
+     *  - Lift floating point arguments passed in v0-v7
+     */
+    export function replace(
+        target: NativePointer,
+        implementation: SwiftReplacementImplementation
+    ): SwiftReplacement {
+        if (Process.arch !== "arm64") {
+            throw new Error("Swift replacements are only supported on arm64");
+        }
+
+        const key = target.toString();
+        if (replacements.has(key)) {
+            throw new Error(`${target} is already replaced`);
+        }
+
+        const symbol = getDemangledSymbol(target);
+        const parsed = parseSwiftMethodSignature(symbol);
+        checkReplaceableTypes([parsed.retTypeName, ...parsed.argTypeNames]);
+        const retType = getReplacementType(parsed.retTypeName);
+        const argTypes = parsed.argTypeNames.map((name) =>
+            getReplacementType(name)
+        );
+
+        const state: ReplacementState = {
+            target,
+            callback: null,
+            thunk: null,
+            original: null,
+        };
+        let originalAddress: NativePointer = null;
+
+        /*
+         * The original loads swiftself from a slot written from JS, see
+         * makeSwiftNativeFunction(), and NativeFunction releases the JS lock
+         * before it gets there. Each thread thus gets its own slot, and with
+         * it its own function.
+         */
+        const threadOriginals = new Map<ThreadId, ThreadOriginal>();
+        const getThreadOriginal = function (): ThreadOriginal {
+            const threadId = Process.getCurrentThreadId();
+            let threadOriginal = threadOriginals.get(threadId);
+
+            if (threadOriginal === undefined) {
+                const slot = Memory.alloc(Process.pointerSize);
+                threadOriginal = {
+                    slot,
+                    call: makeSwiftNativeFunction(
+                        originalAddress,
+                        retType,
+                        argTypes,
+                        { slot }
+                    ),
+                };
+                threadOriginals.set(threadId, threadOriginal);
+            }
+
+            return threadOriginal;
+        };
+
+        state.callback = new NativeCallback(
+            (frame: NativePointer) => {
+                const args = liftArguments(parsed.argTypeNames, (i) =>
+                    readSwiftCallFrameArgument(frame, i)
+                );
+                const context = frame
+                    .add(SwiftCallFrame.OFFSETOF_X20)
+                    .readPointer();
+                const { slot } = getThreadOriginal();
+                /* Restored on the way out, as the implementation may recurse */
+                const previousContext = slot.readPointer();
+
+                slot.writePointer(context);
+
+                try {
+                    const retval = implementation.apply(
+                        { context, original: state.original },
+                        args
+                    );
+                    lowerReturnValue(retval, retType, frame);
+                } finally {
+                    slot.writePointer(previousContext);
+                }
+            },
+            "void",
+            ["pointer"]
+        );
+        state.thunk = makeReplacementThunk(state.callback);
+
+        originalAddress = Interceptor.replaceFast(target, state.thunk);
+        state.original = Object.assign(
+            function (...args: RuntimeInstance[]) {
+                return getThreadOriginal().call(...args);
+            },
+            { address: originalAddress }
+        );
+        replacements.set(key, state);
+
+        return {
+            original: state.original,
+            revert() {
+                if (replacements.get(key) !== state) {
+                    return;
+                }
+
+                Interceptor.revert(target);
+                Interceptor.flush();
+                replacements.delete(key);
+                revertedReplacements.push(state);
+            },
+        };
+    }
+}
+
+/**
+ * Hooks the function through a native gate, which decides which calls enter
+ * JS, see hookgate.ts, and its predicates compiled, see hookpredicates.ts. The
+ * callbacks get frames rather than InvocationContexts, and aren't accounted
+ * for by the profiler.
+ */
+function attachGated(
+    target: NativePointer,
+    parsed: MethodSignatureParseResult,
+    callbacks: SwiftScriptInvocationListenerCallbacks,
+    options: SwiftInvocationListenerOptions
+): GatedSwiftInvocationListener {
+    /* Keyed by frame, which is unique for as long as the call is ongoing */
+    const invocations = new Map<string, GatedInvocationContext>();
+    const needsOnLeave = callbacks.onLeave !== undefined;
+    let onEnter: NativeCallback<"void", ["pointer"]> = null;
+    let onLeave: NativeCallback<"void", ["pointer"]> = null;
+
+    if (callbacks.onEnter !== undefined || needsOnLeave) {
+        onEnter = new NativeCallback(
+            (frame: NativePointer) => {
+                const invocation: GatedInvocationContext = {
+                    context: frame
+                        .add(SwiftCallFrame.OFFSETOF_X20)
+                        .readPointer(),
+                    returnAddress: frame
+                        .add(SwiftCallFrame.OFFSETOF_RETURN_ADDRESS)
+                        .readPointer(),
+                    threadId: Process.getCurrentThreadId(),
+                };
+
+                if (needsOnLeave) {
+                    invocations.set(frame.toString(), invocation);
+                }
+
+                if (callbacks.onEnter !== undefined) {
+                    const args = liftArguments(parsed.argTypeNames, (i) =>
+                        readSwiftCallFrameArgument(frame, i)
+                    );
+                    callbacks.onEnter.call(invocation as any, args);
+                }
+            },
+            "void",
+            ["pointer"]
+        );
+    }
+
+    if (needsOnLeave) {
+        onLeave = new NativeCallback(
+            (frame: NativePointer) => {
+                const key = frame.toString();
+                const invocation = invocations.get(key);
+                invocations.delete(key);
+
+                const retval = liftReturnValue(
+                    parsed.retTypeName,
+                    (i) => frame.add(i * Process.pointerSize).readPointer(),
+                    frame.add(SwiftCallFrame.OFFSETOF_X8).readPointer()
+                );
+                callbacks.onLeave.call(invocation as any, retval);
+            },
+            "void",
+            ["pointer"]
+        );
+    }
+
+    const filter =
+        options.where !== undefined
+            ? compileHookPredicates(parsed.argTypeNames, options.where)
+            : null;
+    const gate = attachSwiftHookGate(
+        target,
+        options,
+        filter,
+        onEnter,
+        onLeave
+    );
+
+    return {
+        detach() {
+            gate.detach();
+        },
+        stats() {
+            return gate.stats();
+        },
+        resetThreadBudgets() {
+            gate.resetThreadBudgets();
+        },
+    };
+}
+
+interface SwiftReplacementContext {
+    /* The value of the swiftself register, i.e. self for methods */
+    context: NativePointer;
+    original: SwiftNativeFunction;
+}
+
+type SwiftReplacementImplementation = (
+    this: SwiftReplacementContext,
+    ...args: RuntimeInstance[]
+) => RuntimeInstance | void;
+
+interface SwiftReplacement {
+    original: SwiftNativeFunction;
+    revert(): void;
+}
+
+interface ReplacementState {
+    target: NativePointer;
+    callback: NativeCallback<"void", ["pointer"]>;
+    thunk: NativePointer;
+    original: SwiftNativeFunction;
+}
+
+interface ThreadOriginal {
+    /* Holds swiftself for calls to the original made on this thread */
+    slot: NativePointer;
+    call: SwiftNativeFunction;
+}
+
+/* Keyed by target, for as long as it is replaced */
+const replacements = new Map<string, ReplacementState>();
+
+/*
+ * Reverted replacements are never freed, nor are their callbacks and thunks,
+ * as a thread may still be running through them after the revert.
+ */
+const revertedReplacements: ReplacementState[] = [];
+
+registerCacheSize("replacements", () => replacements.size);
+
+/* Passed in v0-v7, CGFloat being a Double on 64-bit platforms */
+const FLOATING_POINT_TYPE_NAMES = new Set([
+    "Swift.Float",
+    "Swift.Float16",
+    "Swift.Double",
+    "CoreGraphics.CGFloat",
+    "CoreFoundation.CGFloat",
+]);
+
+function makeReplacementThunk(callback: NativePointer): NativePointer {
+    const maxPatchSize = 0x80;
+    const thunk = TrampolinePool.allocateTrampoline(maxPatchSize);
+
+    Memory.patchCode(thunk, maxPatchSize, (code) => {
+        const writer = new Arm64Writer(code, { pc: thunk });
+
+        writer.putStpRegRegRegOffset("x29", "x30", "sp", -16, "pre-adjust");
+        writer.putMovRegReg("x29", "sp");
+        writer.putSubRegRegImm("sp", "sp", SwiftCallFrame.SIZE);
+
+        for (let i = 0; i !== SwiftCallFrame.NUM_ARGUMENT_REGISTERS; i += 2) {
+            const first = `x${i}` as Arm64Register;
+            const second = `x${i + 1}` as Arm64Register;
+            writer.putStpRegRegRegOffset(first, second, "sp", i * 8, "signed-offset");
+        }
+
+        writer.putStpRegRegRegOffset(
+            "x8",
+            "x20",
+            "sp",
+            SwiftCallFrame.OFFSETOF_X8,
+            "signed-offset"
+        );
+        writer.putAddRegRegImm("x9", "x29", 16);
+        writer.putStpRegRegRegOffset(
+            "x9",
+            "x30",
+            "sp",
+            SwiftCallFrame.OFFSETOF_STACK_ARGS,
+            "signed-offset"
+        );
+
+        writer.putMovRegReg("x0", "sp");
+        writer.putLdrRegAddress("x16", callback.strip());
+        writer.putBlrRegNoAuth("x16");
+
+        writer.putLdpRegRegRegOffset("x0", "x1", "sp", 0, "signed-offset");
+        writer.putLdpRegRegRegOffset("x2", "x3", "sp", 16, "signed-offset");
+
+        writer.putAddRegRegImm("sp", "sp", SwiftCallFrame.SIZE);
+        writer.putLdpRegRegRegOffset("x29", "x30", "sp", 16, "post-adjust");
+        writer.putRet();
+
+        writer.flush();
+    });
+
+    return thunk;
+}
+
+/**
+ * The thunk only spills general purpose registers, so values passed in v0-v7
+ * would be read as garbage rather than failing.
+ */
+function checkReplaceableTypes(typeNames: string[]) {
+    const unsupported = typeNames.find((name) =>
+        FLOATING_POINT_TYPE_NAMES.has(name)
+    );
+
+    if (unsupported !== undefined) {
+        throw new Error(
+            `Can't replace functions taking or returning ${unsupported}: floating point registers aren't supported yet`
+        );
+    }
+}
+
+function getReplacementType(typeName: string): NativeSwiftType {
+    if (typeName === "()" || typeName === "void") {
+        return "void";
+    }
+
+    if (isProtocolTypeName(typeName)) {
+        return ProtocolComposition.fromSignature(typeName);
+    }
+
+    return untypedMetadataFor(typeName);
+}
+
+/**
+ * Hands the implementation's return value over to the caller: the caller
+ * owns it afterwards, hence copies and retains rather than moves.
+ */
+function lowerReturnValue(
+    value: RuntimeInstance | void,
+    retType: NativeSwiftType,
+    frame: NativePointer
+) {
+    if (retType === "void") {
+        return;
+    }
+
+    if (!(value instanceof RuntimeInstance)) {
+        throw new Error("Expected a Swift value to be returned");
+    }
+
+    const direct = frame.add(SwiftCallFrame.OFFSETOF_X0);
+    const indirect = frame.add(SwiftCallFrame.OFFSETOF_X8).readPointer();
+
+    if (retType instanceof ProtocolComposition) {
+        const container = boxExistential(value, retType);
+        const dest = container.sizeof <= MAX_LOADABLE_SIZE ? direct : indirect;
+
+        if (value instanceof ObjectInstance) {
+            getApi().swift_retain(value.handle);
+        }
+
+        Memory.copy(dest, container.handle, container.sizeof);
+        return;
+    }
+
+    const metadata = retType as TargetMetadata;
+    if (!value.$metadata.handle.equals(metadata.handle)) {
+        throw new Error(
+            `Expected a value of type ${metadata.getFullTypeName()} to be returned`
+        );
+    }
+
+    if (metadata.isClassObject()) {
+        getApi().swift_retain(value.handle);
+        direct.writePointer(value.handle);
+        return;
+    }
+
+    const plan = metadata.getCopyPlan();
+    const isDirect =
+        plan.stride <= MAX_LOADABLE_SIZE && !shouldPassIndirectly(metadata);
+
+    plan.initializeWithCopy(isDirect ? direct : indirect, value.handle);
+}
+
+/**
+ * Decodes arguments as laid out by swiftcc, `readArg` returning the i-th
+ * pointer-sized argument, be it passed in a register or on the stack.
+ */
+function liftArguments(
+    argTypeNames: string[],
+    readArg: (i: number) => NativePointer
+): RuntimeInstance[] {
+    const swiftyArgs: RuntimeInstance[] = [];
+    let argsIndex = 0;
+    let currentArg: RuntimeInstance;
+
+    for (const argTypeName of argTypeNames) {
+        const decodeStart = profiler.mark();
+
+        if (isProtocolTypeName(argTypeName)) {
+            const composition = ProtocolComposition.fromSignature(argTypeName);
+            const size = composition.sizeofExistentialContainer;
+            let buf: NativePointer;
+
+            if (size <= MAX_LOADABLE_SIZE) {
+                const sizeQWords = sizeInQWordsRounded(size);
+                const end = argsIndex + sizeQWords;
+                const raw = sliceArgs(readArg, argsIndex, end);
+                buf = makeBufferFromValue(raw);
+                argsIndex += sizeQWords;
+            } else {
+                buf = readArg(argsIndex++);
+            }
+
+            const liftStart = profiler.mark();
+            currentArg = ValueInstance.fromExistentialContainer(
+                buf,
+                composition
+            );
+            profiler.recordOperation(
+                "ValueInstance.fromExistentialContainer",
+                liftStart
+            );
+            swiftyArgs.push(currentArg);
+            profiler.recordArgumentDecode(argTypeName, decodeStart);
+            continue;
+        }
+
+        const metadataStart = profiler.mark();
+        const argType = untypedMetadataFor(argTypeName);
+        profiler.recordOperation("untypedMetadataFor", metadataStart);
+
+        if (argType.isClassObject()) {
+            currentArg = new ObjectInstance(readArg(argsIndex++));
+        } else {
+            const sizeQWords = sizeInQWordsRounded(
+                argType.getTypeLayout().stride
+            );
+            const kind = argType.getKind();
+            const end = argsIndex + sizeQWords;
+            const raw = sliceArgs(readArg, argsIndex, end);
+
+            if (kind === MetadataKind.Struct) {
+                const metadata = argType as TargetStructMetadata;
+                currentArg = new StructValue(metadata, { raw });
+            } else if (kind === MetadataKind.Enum) {
+                const metadata = argType as TargetEnumMetadata;
+                currentArg = new EnumValue(metadata, { raw });
+            } else {
+                throw new Error("Unhandled metadata kind: " + kind);
+            }
+
+            argsIndex += sizeQWords;
+        }
+        swiftyArgs.push(currentArg);
+        profiler.recordArgumentDecode(argTypeName, decodeStart);
+    }
+
+    return swiftyArgs;
+}
+
+/**
+ * Decodes a return value, `readReg` returning the i-th direct result register,
+ * i.e. x0-x3.
+ */
+function liftReturnValue(
+    retTypeName: string,
+    readReg: (i: number) => NativePointer,
+    indirectRetAddr: NativePointer
+): RuntimeInstance {
+    if (isProtocolTypeName(retTypeName)) {
+        const composition = ProtocolComposition.fromSignature(retTypeName);
+        const size = composition.sizeofExistentialContainer;
+        let buf: NativePointer;
+
+        if (size <= MAX_LOADABLE_SIZE) {
+            const sizeQWords = sizeInQWordsRounded(size);
+            buf = makeBufferFromValue(sliceArgs(readReg, 0, sizeQWords));
+        } else {
+            buf = indirectRetAddr;
+        }
+
+        const liftStart = profiler.mark();
+        const retval = ValueInstance.fromExistentialContainer(buf, composition);
+        profiler.recordOperation(
+            "ValueInstance.fromExistentialContainer",
+            liftStart
+        );
+        return retval;
+    }
+
+    const metadataStart = profiler.mark();
+    const retType = untypedMetadataFor(retTypeName);
+    profiler.recordOperation("untypedMetadataFor", metadataStart);
+
+    if (retType.isClassObject()) {
+        return new ObjectInstance(readReg(0));
+    }
+
+    const stride = retType.getTypeLayout().stride;
+    let retval: RuntimeInstance;
+
+    if (stride <= MAX_LOADABLE_SIZE && !shouldPassIndirectly(retType)) {
+        const raw: RawFields = sliceArgs(
+            readReg,
+            0,
+            sizeInQWordsRounded(stride)
+        );
+
+        const liftStart = profiler.mark();
+        retval = ValueInstance.fromRaw(raw, retType as TargetValueMetadata);
+        profiler.recordOperation("ValueInstance.fromRaw", liftStart);
+    } else {
+        const liftStart = profiler.mark();
+        retval = ValueInstance.fromCopy(
+            indirectRetAddr,
+            retType as TargetValueMetadata
+        );
+        profiler.recordOperation("ValueInstance.fromCopy", liftStart);
+    }
+
+    return retval;
+}
+
+interface HookProfileState {
+    profile: CallProfile;
+    start: number;
+    scriptNs: number;
+    calleeStart: number;
+}
+
+function recordHookProfile(
+    state: HookProfileState,
+    calleeEnd: number,
+    onLeaveScriptNs: number
+) {
+    const { profile, start, calleeStart } = state;
+    const end = profiler.now();
+    const scriptNs = state.scriptNs + onLeaveScriptNs;
+    const nativeNs = calleeEnd - calleeStart;
+
+    profile.latency.record(end - start);
+    profile.nativeNs += nativeNs;
+    profile.scriptNs += scriptNs;
+    profile.bridgeNs += end - start - nativeNs - scriptNs;
 }
 
 function isProtocolTypeName(name: string) {
@@ -200,13 +744,13 @@ function isProtocolTypeName(name: string) {
 }
 
 function sliceArgs(
-    args: InvocationArguments,
+    readArg: (i: number) => NativePointer,
     start: number,
     end: number
-): InvocationArguments {
-    const result: InvocationArguments = [];
+): NativePointer[] {
+    const result: NativePointer[] = [];
     for (let i = start; i != end; i++) {
-        result.push(args[i]);
+        result.push(readArg(i));
     }
     return result;
 }
@@ -8,14 +8,27 @@ import {
     TargetProtocolConformanceDescriptor,
 } from "../abi/metadata.js";
 import { ContextDescriptorKind } from "../abi/metadatavalues.js";
-import { getPrivateAPI } from "./api.js";
+import {
+    getSectionDiscoveryBackend,
+    getSwiftSection,
+    SwiftSection,
+} from "./sections.js";
 import { RelativeDirectPointer } from "../basic/relativepointer.js";
 import { demangledSymbolFromAddress, findProtocolNameInConformanceDescriptor } from "./symbols.js";
-
-interface MachOSection {
-    vmAddress: NativePointer;
-    size: number;
-}
+import {
+    counters,
+    millisecondsSince,
+    monotonicNow,
+    registerCacheSize,
+    traceLazyStep,
+} from "./stats.js";
+import { metadataForTypeName } from "./typeresolver.js";
+import {
+    SWIFT_INDEX_FORMAT,
+    SWIFT_INDEX_VERSION,
+    SwiftImageIndex,
+    SwiftIndex,
+} from "./swiftindex.js";
 
 interface ProtocolDescriptorMap {
     [protoName: string]: TargetProtocolDescriptor;
@@ -48,47 +61,202 @@ interface TypeDataConstructor<T> {
     new (handle: NativePointer): T;
 }
 
-const allModules = new ModuleMap();
+let allModules: ModuleMap = null;
 const protocolDescriptorMap: ProtocolDescriptorMap = {};
 const fullTypeDataMap: FullTypeDataMap = {};
 const demangledSymbols = new Map<string, string>();
+const prebuiltImageIndexes = new Map<string, SwiftImageIndex>();
+let indexed = false;
+
+registerCacheSize("demangledSymbols", () => demangledSymbols.size);
+registerCacheSize("typeData", () => Object.keys(fullTypeDataMap).length);
+registerCacheSize("protocolDescriptors", () =>
+    Object.keys(protocolDescriptorMap).length
+);
+
+const LC_UUID = 0x1b;
+const SIZEOF_MACH_HEADER_64 = 0x20;
+
+/**
+ * Registers indexes built offline by tools/swift-index.ts. Images whose UUID
+ * matches one of them are populated from it instead of being scanned. Only
+ * effective before the first type or protocol look-up.
+ */
+export function loadSwiftIndex(index: SwiftIndex): void {
+    if (index.format !== SWIFT_INDEX_FORMAT) {
+        throw new Error("Not a Swift index");
+    }
+
+    if (index.version !== SWIFT_INDEX_VERSION) {
+        throw new Error(`Unsupported Swift index version: ${index.version}`);
+    }
+
+    if (indexed) {
+        console.warn("Swift index loaded after modules were already scanned");
+    }
+
+    for (const image of index.images) {
+        prebuiltImageIndexes.set(image.uuid, image);
+    }
+}
+
+function getAllModules(): ModuleMap {
+    if (allModules === null) {
+        allModules = traceLazyStep("moduleMap", () => new ModuleMap());
+    }
+
+    return allModules;
+}
+
+function ensureIndexed() {
+    if (indexed || getSectionDiscoveryBackend() === null) {
+        return;
+    }
+
+    indexed = true;
+    traceLazyStep("indexing", indexAllModules);
+}
+
+function indexAllModules() {
+    const modules = getAllModules();
+    const start = monotonicNow();
+
+    const prebuilt = new Map<Module, SwiftImageIndex>();
+    if (prebuiltImageIndexes.size > 0 && Process.platform === "darwin") {
+        for (const module of modules.values()) {
+            const image = prebuiltImageIndexes.get(readImageUuid(module));
+            if (image !== undefined) {
+                prebuilt.set(module, image);
+            }
+        }
+    }
+
+    for (const module of modules.values()) {
+        counters.indexing.modules++;
+
+        const image = prebuilt.get(module);
+        if (image !== undefined) {
+            loadPrebuiltTypes(module, image);
+            continue;
+        }
 
-/* XXX: Ugly hack(TM) until we lazily-parse MachOs */
-if (Process.arch === "arm64" && Process.platform === "darwin") {
-    for (const module of allModules.values()) {
         for (const descriptor of enumerateTypeDescriptors(module)) {
             /* TODO: figure out why multiple descriptors could have the same name */
             fullTypeDataMap[descriptor.getFullTypeName()] = {
                 descriptor,
                 conformances: {},
             };
+            counters.indexing.typeDescriptors++;
         }
 
         for (const descriptor of enumerateProtocolDescriptors(module)) {
             protocolDescriptorMap[descriptor.getFullProtocolName()] = descriptor;
+            counters.indexing.protocolDescriptors++;
         }
     }
 
-    for (const module of allModules.values()) {
+    for (const module of modules.values()) {
+        const image = prebuilt.get(module);
+        if (image !== undefined) {
+            for (const [offset, typeName] of image.conformances) {
+                bindProtocolConformance(module.base.add(offset), typeName);
+            }
+            continue;
+        }
+
         bindProtocolConformances(module);
     }
+
+    counters.indexing.timeMs += millisecondsSince(start);
+}
+
+function loadPrebuiltTypes(module: Module, image: SwiftImageIndex) {
+    for (const [offset, kind, fullTypeName] of image.types) {
+        const handle = module.base.add(offset);
+        let descriptor: TargetTypeContextDescriptor;
+
+        switch (kind) {
+            case ContextDescriptorKind.Class:
+                descriptor = new TargetClassDescriptor(handle);
+                break;
+            case ContextDescriptorKind.Struct:
+                descriptor = new TargetStructDescriptor(handle);
+                break;
+            case ContextDescriptorKind.Enum:
+                descriptor = new TargetEnumDescriptor(handle);
+                break;
+            default:
+                continue;
+        }
+
+        fullTypeDataMap[fullTypeName ?? descriptor.getFullTypeName()] = {
+            descriptor,
+            conformances: {},
+        };
+        counters.indexing.typeDescriptors++;
+    }
+
+    for (const [offset, fullProtocolName] of image.protocols) {
+        const descriptor = new TargetProtocolDescriptor(module.base.add(offset));
+        const name = fullProtocolName ?? descriptor.getFullProtocolName();
+        protocolDescriptorMap[name] = descriptor;
+        counters.indexing.protocolDescriptors++;
+    }
+}
+
+function readImageUuid(module: Module): string {
+    const header = module.base;
+    const numCommands = header.add(0x10).readU32();
+    let command = header.add(SIZEOF_MACH_HEADER_64);
+
+    for (let i = 0; i !== numCommands; i++) {
+        if (command.readU32() === LC_UUID) {
+            const uuid = new Uint8Array(command.add(8).readByteArray(16));
+            return Array.from(uuid)
+                .map((b) => b.toString(16).padStart(2, "0"))
+                .join("");
+        }
+
+        command = command.add(command.add(4).readU32());
+    }
+
+    return null;
 }
 
 export function getAllFullTypeData(): FullTypeData[] {
+    ensureIndexed();
+
     return Object.values(fullTypeDataMap);
 }
 
+export function findTypeDescriptor(
+    typeName: string
+): TargetTypeContextDescriptor {
+    ensureIndexed();
+
+    return fullTypeDataMap[typeName]?.descriptor;
+}
+
+/**
+ * Falls back to the runtime for types that aren't indexed, e.g. generic
+ * instantiations, see typeresolver.ts.
+ */
 export function untypedMetadataFor(typeName: string): TargetMetadata {
+    ensureIndexed();
+
     const fullTypeData = fullTypeDataMap[typeName];
 
     if (fullTypeData === undefined) {
-        throw new Error("Type not found: " + typeName);
+        return metadataForTypeName(typeName);
     }
 
     if (fullTypeData.metadata !== undefined) {
+        counters.metadata.cache.hits++;
         return fullTypeDataMap[typeName].metadata;
     }
 
+    counters.metadata.cache.misses++;
+    counters.metadata.accessorCalls++;
     const metadataPtr = fullTypeData.descriptor
         .getAccessFunction()
         .call() as NativePointer;
@@ -101,6 +269,8 @@ export function metadataFor<T extends TargetMetadata>(
     typeName: string,
     c: TypeDataConstructor<T>
 ): T {
+    ensureIndexed();
+
     const fullTypeData = fullTypeDataMap[typeName];
 
     if (fullTypeData === undefined) {
@@ -108,9 +278,12 @@ export function metadataFor<T extends TargetMetadata>(
     }
 
     if (fullTypeData.metadata !== undefined) {
+        counters.metadata.cache.hits++;
         return fullTypeDataMap[typeName].metadata as T;
     }
 
+    counters.metadata.cache.misses++;
+    counters.metadata.accessorCalls++;
     const metadataPtr = fullTypeData.descriptor
         .getAccessFunction()
         .call() as NativePointer;
@@ -122,6 +295,8 @@ export function metadataFor<T extends TargetMetadata>(
 export function getProtocolConformancesFor(
     typeName: string
 ): ProtocolConformanceMap {
+    ensureIndexed();
+
     const fullTypeData = fullTypeDataMap[typeName];
 
     if (fullTypeData === undefined) {
@@ -132,18 +307,24 @@ export function getProtocolConformancesFor(
 }
 
 export function getAllProtocolDescriptors(): TargetProtocolDescriptor[] {
+    ensureIndexed();
+
     return Object.values(protocolDescriptorMap);
 }
 
 export function findProtocolDescriptor(
     protoName: string
 ): TargetProtocolDescriptor {
+    ensureIndexed();
+
     return protocolDescriptorMap[protoName];
 }
 
 export function getProtocolDescriptor(
     protoName: string
 ): TargetProtocolDescriptor {
+    ensureIndexed();
+
     const desc = protocolDescriptorMap[protoName];
     if (desc === undefined) {
         throw new Error(`Can't find protocol descriptor for: "${protoName}"`);
@@ -217,9 +398,17 @@ function bindProtocolConformances(module: Module) {
             i * RelativeDirectPointer.sizeOf
         );
         const descPtr = RelativeDirectPointer.From(recordPtr).get();
-        const conformanceDesc = new TargetProtocolConformanceDescriptor(
-            descPtr
-        );
+        bindProtocolConformance(descPtr);
+    }
+}
+
+/**
+ * @param typeName the conforming type's full name, if already known
+ */
+function bindProtocolConformance(descPtr: NativePointer, typeName?: string) {
+    const conformanceDesc = new TargetProtocolConformanceDescriptor(descPtr);
+
+    if (typeName === undefined || typeName === null) {
         const typeDescPtr = conformanceDesc.getTypeDescriptor();
         const typeDesc = new TargetTypeContextDescriptor(typeDescPtr);
 
@@ -233,75 +422,58 @@ function bindProtocolConformances(module: Module) {
             typeDesc.isGeneric() ||
             typeDesc.getKind() === ContextDescriptorKind.Protocol
         ) {
-            continue;
-        }
-
-        const type = fullTypeDataMap[typeDesc.getFullTypeName()];
-        if (type === undefined) {
-            continue;
+            return;
         }
 
-        if (conformanceDesc.protocol.isNull()) {
-            /* Since we can't read the protocol's name via its conformance descriptor, we try to extract it via the
-            conformance descriptor's symbol. */
-            const mangledSymbol = demangledSymbolFromAddress(descPtr);
-            const protocolName = findProtocolNameInConformanceDescriptor(mangledSymbol);
+        typeName = typeDesc.getFullTypeName();
+    }
 
-            if (protocolName === null) {
-                console.warn(`Failed to parse protocol name from conformance descriptor '${mangledSymbol}'. Please file a bug.`);
-                continue;
-            }
+    const type = fullTypeDataMap[typeName];
+    if (type === undefined) {
+        return;
+    }
 
-            type.conformances[protocolName] = {
-                protocol: null,
-                witnessTable: null,
-            };
-        } else {
-            const protocolDesc = new TargetProtocolDescriptor(conformanceDesc.protocol);
+    if (conformanceDesc.protocol.isNull()) {
+        /* Since we can't read the protocol's name via its conformance descriptor, we try to extract it via the
+        conformance descriptor's symbol. */
+        const mangledSymbol = demangledSymbolFromAddress(descPtr);
+        const protocolName = findProtocolNameInConformanceDescriptor(mangledSymbol);
 
-            type.conformances[protocolDesc.name] = {
-                protocol: protocolDesc,
-                witnessTable: conformanceDesc.witnessTablePattern,
-            };
+        if (protocolName === null) {
+            console.warn(`Failed to parse protocol name from conformance descriptor '${mangledSymbol}'. Please file a bug.`);
+            return;
         }
-    }
-}
 
-function getSwift5TypesSection(module: Module): MachOSection {
-    return getMachoSection(module, "__swift5_types");
+        type.conformances[protocolName] = {
+            protocol: null,
+            witnessTable: null,
+        };
+        counters.indexing.conformances++;
+    } else {
+        const protocolDesc = new TargetProtocolDescriptor(conformanceDesc.protocol);
+
+        type.conformances[protocolDesc.name] = {
+            protocol: protocolDesc,
+            witnessTable: conformanceDesc.witnessTablePattern,
+        };
+        counters.indexing.conformances++;
+    }
 }
 
-function getSwift5ProtocolsSection(module: Module): MachOSection {
-    return getMachoSection(module, "__swift5_protos");
+function getSwift5TypesSection(module: Module): SwiftSection {
+    return getSwiftSection(module, "types");
 }
 
-function getSwift5ProtocolConformanceSection(module: Module): MachOSection {
-    return getMachoSection(module, "__swift5_proto");
+function getSwift5ProtocolsSection(module: Module): SwiftSection {
+    return getSwiftSection(module, "protocols");
 }
 
-function getMachoSection(
-    module: Module,
-    sectionName: string,
-    segmentName = "__TEXT"
-): MachOSection {
-    const machHeader = module.base;
-    const segName = Memory.allocUtf8String(segmentName);
-    const sectName = Memory.allocUtf8String(sectionName);
-    const sizeOut = Memory.alloc(Process.pointerSize);
-
-    const vmAddress = getPrivateAPI().getsectiondata(
-        machHeader,
-        segName,
-        sectName,
-        sizeOut
-    ) as NativePointer;
-    const size = sizeOut.readU32() as number;
-
-    return { vmAddress, size };
+function getSwift5ProtocolConformanceSection(module: Module): SwiftSection {
+    return getSwiftSection(module, "protocolConformances");
 }
 
 export function findDemangledSymbol(address: NativePointer): string {
-    const module = allModules.find(address);
+    const module = getAllModules().find(address);
     if (module === null) {
         return undefined;
     }
@@ -309,9 +481,12 @@ export function findDemangledSymbol(address: NativePointer): string {
     const rawAddr = address.toString();
     const cached = demangledSymbols.get(rawAddr);
     if (cached !== undefined) {
+        counters.symbolication.cache.hits++;
         return cached;
     }
 
+    counters.symbolication.cache.misses++;
+
     const demangled = demangledSymbolFromAddress(address);
     if (demangled === undefined) {
         return undefined;
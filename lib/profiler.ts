@@ -0,0 +1,558 @@
+/**
+ * Opt-in call profiler for Swift.NativeFunction and Swift.Interceptor, see
+ * Swift.profiler. Off by default: the instrumented paths only check
+ * `profiler.enabled` until it's started.
+ *
+ * Each call is split into bridge time (lowering arguments, boxing
+ * existentials, decoding arguments and return values), native time (the
+ * callee itself) and, for hooks, script time (the user's callbacks).
+ *
+ * TODO:
+ *  - Per-thread attribution
+ */
+
+const SNAPSHOT_MAGIC = 0x46505753; /* "SWPF" */
+const SNAPSHOT_VERSION = 1;
+
+export type ProfileKind = "function" | "hook";
+
+export type ProfiledOperation =
+    | "lowerPhysically"
+    | "existentialBoxing"
+    | "untypedMetadataFor"
+    | "ValueInstance.fromCopy"
+    | "ValueInstance.fromRaw"
+    | "ValueInstance.fromExistentialContainer";
+
+/**
+ * A log-linear latency histogram in the spirit of HdrHistogram: every power
+ * of two is split into 2^SUB_BUCKET_BITS linear sub-buckets, so that any
+ * recorded value is reported within ~6% of its actual value whatever its
+ * magnitude, using a fixed amount of memory.
+ */
+export class LatencyHistogram {
+    static readonly SUB_BUCKET_BITS = 4;
+    static readonly SUB_BUCKET_COUNT = 1 << LatencyHistogram.SUB_BUCKET_BITS;
+    /* Up to 2^44 ns, i.e. ~4.8 hours */
+    static readonly MAX_MAGNITUDE = 44;
+    static readonly BUCKET_COUNT =
+        LatencyHistogram.SUB_BUCKET_COUNT *
+        (LatencyHistogram.MAX_MAGNITUDE - LatencyHistogram.SUB_BUCKET_BITS + 1);
+
+    readonly counts = new Uint32Array(LatencyHistogram.BUCKET_COUNT);
+    count = 0;
+    totalNs = 0;
+    minNs = Infinity;
+    maxNs = 0;
+
+    record(ns: number) {
+        const value = Math.max(0, Math.round(ns));
+        this.counts[LatencyHistogram.bucketIndexOf(value)]++;
+        this.count++;
+        this.totalNs += value;
+        this.minNs = Math.min(this.minNs, value);
+        this.maxNs = Math.max(this.maxNs, value);
+    }
+
+    get meanNs(): number {
+        return this.count === 0 ? 0 : this.totalNs / this.count;
+    }
+
+    /**
+     * @param percentile in the range [0, 100]
+     * @returns the upper bound of the bucket holding the percentile, clamped
+     * to the largest value recorded
+     */
+    percentile(percentile: number): number {
+        if (this.count === 0) {
+            return 0;
+        }
+
+        const rank = Math.max(1, Math.ceil((percentile / 100) * this.count));
+        let seen = 0;
+
+        for (let i = 0; i !== this.counts.length; i++) {
+            seen += this.counts[i];
+            if (seen >= rank) {
+                const upper = LatencyHistogram.bucketLowerBoundOf(i + 1) - 1;
+                return Math.min(Math.max(upper, this.minNs), this.maxNs);
+            }
+        }
+
+        return this.maxNs;
+    }
+
+    static bucketIndexOf(value: number): number {
+        const { SUB_BUCKET_BITS, SUB_BUCKET_COUNT, BUCKET_COUNT } =
+            LatencyHistogram;
+
+        if (value < SUB_BUCKET_COUNT) {
+            return value;
+        }
+
+        const magnitude = Math.floor(Math.log2(value));
+        const shift = magnitude - SUB_BUCKET_BITS;
+        const subBucket = Math.floor(value / 2 ** shift) - SUB_BUCKET_COUNT;
+        const index = SUB_BUCKET_COUNT * (shift + 1) + subBucket;
+
+        return Math.min(index, BUCKET_COUNT - 1);
+    }
+
+    static bucketLowerBoundOf(index: number): number {
+        const { SUB_BUCKET_COUNT } = LatencyHistogram;
+
+        if (index < SUB_BUCKET_COUNT) {
+            return index;
+        }
+
+        const shift = Math.floor(index / SUB_BUCKET_COUNT) - 1;
+        const subBucket = index % SUB_BUCKET_COUNT;
+
+        return (SUB_BUCKET_COUNT + subBucket) * 2 ** shift;
+    }
+}
+
+export class CallProfile {
+    readonly latency = new LatencyHistogram();
+    bridgeNs = 0;
+    nativeNs = 0;
+    scriptNs = 0;
+
+    constructor(
+        readonly kind: ProfileKind,
+        readonly address: NativePointer,
+        public name: string
+    ) {}
+
+    get calls(): number {
+        return this.latency.count;
+    }
+}
+
+export interface ProfileSummary {
+    name: string;
+    address: string;
+    calls: number;
+    totalMs: number;
+    meanUs: number;
+    p50Us: number;
+    p90Us: number;
+    p99Us: number;
+    maxUs: number;
+    bridgeMs: number;
+    nativeMs: number;
+    scriptMs: number;
+}
+
+export interface ProfileReport {
+    functions: ProfileSummary[];
+    hooks: ProfileSummary[];
+    argumentTypes: ProfileSummary[];
+    operations: ProfileSummary[];
+}
+
+class Profiler {
+    enabled = false;
+
+    #profiles = new Map<string, CallProfile>();
+    #argumentTypes = new Map<string, LatencyHistogram>();
+    #operations = new Map<string, LatencyHistogram>();
+    #clock: () => number = null;
+
+    start() {
+        if (this.#clock === null) {
+            this.#clock = makeMonotonicClock();
+        }
+        this.enabled = true;
+    }
+
+    stop() {
+        this.enabled = false;
+    }
+
+    reset() {
+        this.#profiles.clear();
+        this.#argumentTypes.clear();
+        this.#operations.clear();
+    }
+
+    /** Monotonic time in nanoseconds. */
+    now(): number {
+        return this.#clock();
+    }
+
+    getProfile(
+        kind: ProfileKind,
+        address: NativePointer,
+        name?: string
+    ): CallProfile {
+        const key = kind + address.toString();
+        let profile = this.#profiles.get(key);
+
+        if (profile === undefined) {
+            profile = new CallProfile(kind, address, name ?? null);
+            this.#profiles.set(key, profile);
+        }
+
+        return profile;
+    }
+
+    /**
+     * Starts timing a bridge operation, to be passed to recordOperation() or
+     * recordArgumentDecode() once done.
+     * @returns -1 if the profiler isn't running
+     */
+    mark(): number {
+        return this.enabled ? this.#clock() : -1;
+    }
+
+    recordArgumentDecode(typeName: string, since: number) {
+        if (since >= 0) {
+            const ns = this.#clock() - since;
+            getOrCreateHistogram(this.#argumentTypes, typeName).record(ns);
+        }
+    }
+
+    recordOperation(operation: ProfiledOperation, since: number) {
+        if (since >= 0) {
+            const ns = this.#clock() - since;
+            getOrCreateHistogram(this.#operations, operation).record(ns);
+        }
+    }
+
+    report(): ProfileReport {
+        const functions: ProfileSummary[] = [];
+        const hooks: ProfileSummary[] = [];
+
+        for (const profile of this.#profiles.values()) {
+            const summary = summarize(
+                getProfileName(profile),
+                profile.latency,
+                profile.address
+            );
+            summary.bridgeMs = profile.bridgeNs / 1e6;
+            summary.nativeMs = profile.nativeNs / 1e6;
+            summary.scriptMs = profile.scriptNs / 1e6;
+
+            (profile.kind === "function" ? functions : hooks).push(summary);
+        }
+
+        const byTotal = (a: ProfileSummary, b: ProfileSummary) =>
+            b.totalMs - a.totalMs;
+
+        return {
+            functions: functions.sort(byTotal),
+            hooks: hooks.sort(byTotal),
+            argumentTypes: summarizeAll(this.#argumentTypes).sort(byTotal),
+            operations: summarizeAll(this.#operations).sort(byTotal),
+        };
+    }
+
+    table(): string {
+        const report = this.report();
+        const lines: string[] = [];
+
+        const sections: [string, ProfileSummary[], boolean][] = [
+            ["Native functions", report.functions, true],
+            ["Hooks", report.hooks, true],
+            ["Argument decoding", report.argumentTypes, false],
+            ["Bridge operations", report.operations, false],
+        ];
+
+        for (const [title, rows, hasPhases] of sections) {
+            if (rows.length === 0) {
+                continue;
+            }
+
+            const header = [
+                title,
+                "calls",
+                "total ms",
+                "mean us",
+                "p50 us",
+                "p90 us",
+                "p99 us",
+                "max us",
+            ];
+            if (hasPhases) {
+                header.push("bridge %", "native %", "script %");
+            }
+
+            const table = [header];
+            for (const row of rows) {
+                const cells = [
+                    row.name,
+                    row.calls.toString(),
+                    row.totalMs.toFixed(3),
+                    row.meanUs.toFixed(2),
+                    row.p50Us.toFixed(2),
+                    row.p90Us.toFixed(2),
+                    row.p99Us.toFixed(2),
+                    row.maxUs.toFixed(2),
+                ];
+                if (hasPhases) {
+                    for (const ms of [row.bridgeMs, row.nativeMs, row.scriptMs]) {
+                        const share =
+                            row.totalMs === 0 ? 0 : (ms / row.totalMs) * 100;
+                        cells.push(share.toFixed(1));
+                    }
+                }
+                table.push(cells);
+            }
+
+            lines.push(...formatTable(table), "");
+        }
+
+        return lines.join("\n");
+    }
+
+    /**
+     * Serializes the raw histograms, little-endian:
+     *
+     *   u32 magic ("SWPF"), u16 version, u16 sub-bucket bits, u32 count
+     *   count x {
+     *     u8 section (0: function, 1: hook, 2: argument type, 3: operation)
+     *     u16 name length, name (UTF-8), u64 address
+     *     f64 bridge ns, f64 native ns, f64 script ns
+     *     f64 total ns, f64 min ns, f64 max ns
+     *     u16 non-empty buckets, non-empty buckets x {u16 index, u32 count}
+     *   }
+     */
+    snapshot(): ArrayBuffer {
+        const entries: SnapshotEntry[] = [];
+
+        for (const profile of this.#profiles.values()) {
+            entries.push({
+                section: profile.kind === "function" ? 0 : 1,
+                name: getProfileName(profile),
+                address: profile.address,
+                phases: [profile.bridgeNs, profile.nativeNs, profile.scriptNs],
+                histogram: profile.latency,
+            });
+        }
+        for (const [section, histograms] of [
+            [2, this.#argumentTypes],
+            [3, this.#operations],
+        ] as [number, Map<string, LatencyHistogram>][]) {
+            for (const [name, histogram] of histograms) {
+                entries.push({
+                    section,
+                    name,
+                    address: null,
+                    phases: [0, 0, 0],
+                    histogram,
+                });
+            }
+        }
+
+        const encoded = entries.map((e) => encodeUtf8(e.name));
+        let size = 12;
+        for (const [i, entry] of entries.entries()) {
+            const buckets = countNonEmptyBuckets(entry.histogram);
+            size += 1 + 2 + encoded[i].length + 8 + 6 * 8 + 2 + buckets * 6;
+        }
+
+        const buffer = new ArrayBuffer(size);
+        const view = new DataView(buffer);
+        const bytes = new Uint8Array(buffer);
+        let offset = 0;
+
+        view.setUint32(offset, SNAPSHOT_MAGIC, true);
+        view.setUint16(offset + 4, SNAPSHOT_VERSION, true);
+        view.setUint16(offset + 6, LatencyHistogram.SUB_BUCKET_BITS, true);
+        view.setUint32(offset + 8, entries.length, true);
+        offset += 12;
+
+        for (const [i, entry] of entries.entries()) {
+            const name = encoded[i];
+            const histogram = entry.histogram;
+
+            view.setUint8(offset, entry.section);
+            view.setUint16(offset + 1, name.length, true);
+            offset += 3;
+            bytes.set(name, offset);
+            offset += name.length;
+
+            const address = entry.address ?? ptr(0);
+            view.setUint32(offset, address.and(0xffffffff).toUInt32(), true);
+            view.setUint32(offset + 4, address.shr(32).toUInt32(), true);
+            offset += 8;
+
+            const values = [
+                ...entry.phases,
+                histogram.totalNs,
+                histogram.count === 0 ? 0 : histogram.minNs,
+                histogram.maxNs,
+            ];
+            for (const value of values) {
+                view.setFloat64(offset, value, true);
+                offset += 8;
+            }
+
+            view.setUint16(offset, countNonEmptyBuckets(histogram), true);
+            offset += 2;
+            for (let j = 0; j !== histogram.counts.length; j++) {
+                if (histogram.counts[j] !== 0) {
+                    view.setUint16(offset, j, true);
+                    view.setUint32(offset + 2, histogram.counts[j], true);
+                    offset += 6;
+                }
+            }
+        }
+
+        return buffer;
+    }
+}
+
+interface SnapshotEntry {
+    section: number;
+    name: string;
+    address: NativePointer;
+    phases: number[];
+    histogram: LatencyHistogram;
+}
+
+export const profiler = new Profiler();
+
+function getOrCreateHistogram(
+    histograms: Map<string, LatencyHistogram>,
+    key: string
+): LatencyHistogram {
+    let histogram = histograms.get(key);
+    if (histogram === undefined) {
+        histogram = new LatencyHistogram();
+        histograms.set(key, histogram);
+    }
+    return histogram;
+}
+
+/* Symbolication is deferred to report time to keep it off the hot path */
+function getProfileName(profile: CallProfile): string {
+    if (profile.name === null) {
+        const symbol = DebugSymbol.fromAddress(profile.address);
+        profile.name =
+            symbol.name !== null ? symbol.name : profile.address.toString();
+    }
+    return profile.name;
+}
+
+function summarize(
+    name: string,
+    histogram: LatencyHistogram,
+    address: NativePointer = null
+): ProfileSummary {
+    return {
+        name,
+        address: address !== null ? address.toString() : null,
+        calls: histogram.count,
+        totalMs: histogram.totalNs / 1e6,
+        meanUs: histogram.meanNs / 1e3,
+        p50Us: histogram.percentile(50) / 1e3,
+        p90Us: histogram.percentile(90) / 1e3,
+        p99Us: histogram.percentile(99) / 1e3,
+        maxUs: histogram.maxNs / 1e3,
+        bridgeMs: 0,
+        nativeMs: 0,
+        scriptMs: 0,
+    };
+}
+
+function summarizeAll(
+    histograms: Map<string, LatencyHistogram>
+): ProfileSummary[] {
+    return Array.from(histograms.entries()).map(([name, histogram]) =>
+        summarize(name, histogram)
+    );
+}
+
+function countNonEmptyBuckets(histogram: LatencyHistogram): number {
+    let result = 0;
+    for (let i = 0; i !== histogram.counts.length; i++) {
+        if (histogram.counts[i] !== 0) {
+            result++;
+        }
+    }
+    return result;
+}
+
+function formatTable(rows: string[][]): string[] {
+    const widths = rows[0].map((_, column) =>
+        Math.max(...rows.map((row) => row[column].length))
+    );
+
+    return rows.map((row) =>
+        row
+            .map((cell, column) =>
+                column === 0
+                    ? cell.padEnd(widths[column])
+                    : cell.padStart(widths[column])
+            )
+            .join("  ")
+    );
+}
+
+function encodeUtf8(str: string): Uint8Array {
+    const result: number[] = [];
+
+    for (const char of str) {
+        const code = char.codePointAt(0);
+
+        if (code < 0x80) {
+            result.push(code);
+        } else if (code < 0x800) {
+            result.push(0xc0 | (code >> 6), 0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            result.push(
+                0xe0 | (code >> 12),
+                0x80 | ((code >> 6) & 0x3f),
+                0x80 | (code & 0x3f)
+            );
+        } else {
+            result.push(
+                0xf0 | (code >> 18),
+                0x80 | ((code >> 12) & 0x3f),
+                0x80 | ((code >> 6) & 0x3f),
+                0x80 | (code & 0x3f)
+            );
+        }
+    }
+
+    return new Uint8Array(result.slice(0, 0xffff));
+}
+
+/**
+ * Date.now() is far too coarse for calls that take a few hundred
+ * nanoseconds, so read the OS' monotonic clock directly.
+ */
+export function makeMonotonicClock(): () => number {
+    if (Process.platform === "darwin") {
+        const CLOCK_UPTIME_RAW = 8;
+        const clockGettimeNsecNp = new NativeFunction(
+            Process.getModuleByName("libsystem_c.dylib").getExportByName(
+                "clock_gettime_nsec_np"
+            ),
+            "uint64",
+            ["int"],
+            { exceptions: "propagate" }
+        );
+
+        return () =>
+            (clockGettimeNsecNp(CLOCK_UPTIME_RAW) as UInt64).toNumber();
+    }
+
+    const CLOCK_MONOTONIC = 1;
+    const clockGettime = new NativeFunction(
+        DebugSymbol.getFunctionByName("clock_gettime"),
+        "int",
+        ["int", "pointer"],
+        { exceptions: "propagate" }
+    );
+    const timespec = Memory.alloc(2 * Process.pointerSize);
+
+    return () => {
+        clockGettime(CLOCK_MONOTONIC, timespec);
+        const seconds = timespec.readLong() as number;
+        const nanoseconds = timespec.add(Process.pointerSize).readLong();
+        return seconds * 1e9 + (nanoseconds as number);
+    };
+}
@@ -6,6 +6,7 @@ import {
 import { ContextDescriptorKind } from "../abi/metadatavalues.js";
 import { getAllFullTypeData, getAllProtocolDescriptors } from "./macho.js";
 import { Class, Enum, Protocol, Struct, Type } from "./types.js";
+import { traceLazyStep } from "./stats.js";
 
 export type TypeMap = Record<string, Type>;
 export type ClassMap = Record<string, Class>;
@@ -25,7 +26,10 @@ export class Registry {
 
     static shared(): Registry {
         if (Registry.sharedInstance === undefined) {
-            Registry.sharedInstance = new Registry();
+            Registry.sharedInstance = traceLazyStep(
+                "registry",
+                () => new Registry()
+            );
         }
 
         return Registry.sharedInstance;
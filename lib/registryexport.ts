@@ -0,0 +1,318 @@
+/**
+ * Streaming export of the type registry, see Swift.exportRegistry(). Unlike
+ * serializing Swift.modules and friends, which builds the whole registry and
+ * ships it as one message, types are reflected one at a time, without their
+ * metadata being cached, and sent as NDJSON chunks of bounded size. Field
+ * type names and method symbols do go through the symbolic reference and
+ * demangling caches, like everywhere else.
+ *
+ * The host acknowledges each chunk, which keeps at most `window` chunks in
+ * flight, and may stop the export at any point: the cursor it got with the
+ * last chunk resumes it from there. Acknowledgements echo the run they're
+ * for, as those of chunks still in flight when an export stopped may come in
+ * after a resumed one reusing its id has started.
+ *
+ * Records come in a stable order, modules and then types sorted by name, so a
+ * cursor stays valid for as long as the same images are loaded.
+ *
+ * TODO:
+ *  - Export generic requirements and the layout of generic types
+ *  - A binary encoding of records
+ */
+
+import {
+    TargetClassDescriptor,
+    TargetClassMetadata,
+    TargetContextDescriptor,
+    TargetMetadata,
+    TargetProtocolDescriptor,
+    TargetTypeContextDescriptor,
+} from "../abi/metadata.js";
+import { ContextDescriptorKind } from "../abi/metadatavalues.js";
+import {
+    getAllFullTypeData,
+    getAllProtocolDescriptors,
+    ProtocolConformanceMap,
+} from "./macho.js";
+import { demangledSymbolFromAddress } from "./symbols.js";
+import { getMethodsDetails, reflectFieldsDetails } from "./types.js";
+
+export interface RegistryExportOptions {
+    /** Tags the export's messages, so that several can run at once */
+    id?: string;
+    /** Where a previous export stopped, 0 by default */
+    cursor?: number;
+    /** Approximate size of a chunk's records, in characters, 64 KiB by default */
+    chunkSize?: number;
+    /** Chunks sent but not acknowledged before waiting, 4 by default */
+    window?: number;
+    /**
+     * Whether to include sizes and strides, which calls the metadata accessor
+     * of every non-generic type, false by default
+     */
+    layout?: boolean;
+}
+
+export interface RegistryExportResult {
+    id: string;
+    records: number;
+    chunks: number;
+    /** Where to resume from, if not complete, i.e. past the last chunk acked */
+    cursor: number;
+    complete: boolean;
+}
+
+/**
+ * Sent for each chunk, `records` holding one JSON record per line and
+ * `cursor` being where to resume from once the chunk has been ingested.
+ */
+export interface RegistryChunkMessage {
+    type: "swift-export:chunk";
+    id: string;
+    /* Unique to this call of exportRegistry(), to be echoed by acks */
+    run: number;
+    seq: number;
+    cursor: number;
+    records: string;
+}
+
+/** Posted by the host, as type `swift-export:ack:<id>`, for each chunk */
+export interface RegistryAckMessage {
+    run: number;
+    seq: number;
+    stop?: boolean;
+}
+
+type EntryKind = "class" | "struct" | "enum" | "protocol";
+
+interface RegistryEntry {
+    kind: EntryKind;
+    module: string;
+    name: string;
+    descriptor: TargetContextDescriptor;
+    conformances?: ProtocolConformanceMap;
+}
+
+const DEFAULT_CHUNK_SIZE = 64 * 1024;
+const DEFAULT_WINDOW = 4;
+
+let nextExportId = 1;
+let nextRun = 1;
+
+export async function exportRegistry(
+    options: RegistryExportOptions = {}
+): Promise<RegistryExportResult> {
+    const id = options.id ?? `export${nextExportId++}`;
+    const chunkSize = options.chunkSize ?? DEFAULT_CHUNK_SIZE;
+    const window = Math.max(options.window ?? DEFAULT_WINDOW, 1);
+    const withLayout = options.layout ?? false;
+    const run = nextRun++;
+
+    const entries = collectEntries();
+
+    const startCursor = Math.min(options.cursor ?? 0, entries.length);
+    let cursor = startCursor;
+    /* Where to resume from once each chunk sent has been acked */
+    const chunkCursors: number[] = [];
+    let seq = 0;
+    let acked = 0;
+    let records = 0;
+    let stopped = false;
+
+    while (cursor !== entries.length && !stopped) {
+        let chunk = "";
+        while (cursor !== entries.length && chunk.length < chunkSize) {
+            const record = describeEntry(entries[cursor], withLayout);
+            chunk += JSON.stringify(record) + "\n";
+            cursor++;
+            records++;
+        }
+
+        const message: RegistryChunkMessage = {
+            type: "swift-export:chunk",
+            id,
+            run,
+            seq,
+            cursor,
+            records: chunk,
+        };
+        send(message);
+        chunkCursors.push(cursor);
+        seq++;
+
+        while (seq - acked >= window && !stopped) {
+            const ack = await receiveAck(id, run);
+            acked = Math.max(acked, ack.seq + 1);
+            stopped = ack.stop === true;
+        }
+
+        if (!stopped) {
+            await yieldToEventLoop();
+        }
+    }
+
+    const complete = cursor === entries.length && !stopped;
+    if (complete) {
+        send({ type: "swift-export:end", id, run, seq, cursor });
+    } else if (acked !== 0) {
+        /* Chunks sent after the last acked one may not have been ingested */
+        cursor = chunkCursors[acked - 1];
+    } else {
+        cursor = startCursor;
+    }
+
+    return { id, records, chunks: seq, cursor, complete };
+}
+
+/** Skips acks left over from previous runs with the same id */
+async function receiveAck(
+    id: string,
+    run: number
+): Promise<RegistryAckMessage> {
+    for (;;) {
+        const ack = await new Promise<RegistryAckMessage>((resolve) => {
+            recv(`swift-export:ack:${id}`, resolve);
+        });
+        if (ack.run === run) {
+            return ack;
+        }
+    }
+}
+
+function yieldToEventLoop(): Promise<void> {
+    return new Promise((resolve) => setImmediate(resolve));
+}
+
+/**
+ * Only what's needed to order the records: the descriptors have been indexed
+ * anyway, and reflection is deferred to describeEntry().
+ */
+function collectEntries(): RegistryEntry[] {
+    const entries: RegistryEntry[] = [];
+
+    for (const { descriptor, conformances } of getAllFullTypeData()) {
+        const kind = kindOf(descriptor);
+        if (kind === undefined) {
+            continue;
+        }
+
+        entries.push({
+            kind,
+            module: descriptor.getModuleContext().name,
+            name: descriptor.getFullTypeName(),
+            descriptor,
+            conformances,
+        });
+    }
+
+    for (const descriptor of getAllProtocolDescriptors()) {
+        entries.push({
+            kind: "protocol",
+            module: descriptor.getModuleContext().name,
+            name: descriptor.getFullProtocolName(),
+            descriptor,
+        });
+    }
+
+    return entries.sort(
+        (a, b) =>
+            compareStrings(a.module, b.module) ||
+            compareStrings(a.name, b.name) ||
+            compareStrings(a.kind, b.kind)
+    );
+}
+
+function kindOf(descriptor: TargetTypeContextDescriptor): EntryKind {
+    switch (descriptor.getKind()) {
+        case ContextDescriptorKind.Class:
+            return "class";
+        case ContextDescriptorKind.Struct:
+            return "struct";
+        case ContextDescriptorKind.Enum:
+            return "enum";
+        default:
+            return undefined;
+    }
+}
+
+function compareStrings(a: string, b: string): number {
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+function describeEntry(entry: RegistryEntry, withLayout: boolean): object {
+    const { kind, module, name } = entry;
+
+    if (kind === "protocol") {
+        const descriptor = entry.descriptor as TargetProtocolDescriptor;
+        return {
+            kind,
+            module,
+            name,
+            requirements: descriptor.numRequirements,
+        };
+    }
+
+    const descriptor = entry.descriptor as TargetTypeContextDescriptor;
+    const image = findImageBase(descriptor.handle);
+    const fields = (reflectFieldsDetails(descriptor) ?? []).map((f) => ({
+        name: f.name,
+        type: f.typeName,
+        var: f.isVar,
+    }));
+
+    const record: Record<string, any> = {
+        kind,
+        module,
+        name,
+        generic: descriptor.isGeneric(),
+        [kind === "enum" ? "cases" : "fields"]: fields,
+        conformances: Object.keys(entry.conformances),
+    };
+
+    if (kind === "class") {
+        record.methods = getMethodsDetails(
+            descriptor as TargetClassDescriptor,
+            demangledSymbolFromAddress
+        ).map((m) => ({
+            name: m.name,
+            type: m.type,
+            offset:
+                image === null || m.address.isNull()
+                    ? null
+                    : m.address.sub(image).toUInt32(),
+        }));
+    }
+
+    if (withLayout && !descriptor.isGeneric()) {
+        record.layout = describeLayout(descriptor);
+    }
+
+    return record;
+}
+
+/**
+ * Method addresses are exported relative to their image, so that dumps of the
+ * same app version compare across launches.
+ */
+function findImageBase(address: NativePointer): NativePointer | null {
+    return Process.findModuleByAddress(address)?.base ?? null;
+}
+
+/**
+ * Goes straight to the accessor rather than through metadataFor(), whose
+ * cache would hold on to every type's metadata.
+ */
+function describeLayout(descriptor: TargetTypeContextDescriptor): object {
+    try {
+        const handle = descriptor.getAccessFunction().call() as NativePointer;
+        const metadata = TargetMetadata.from(handle);
+
+        if (metadata instanceof TargetClassMetadata) {
+            return { instanceSize: metadata.instanceSize };
+        }
+
+        return metadata.getTypeLayout();
+    } catch (e) {
+        return null;
+    }
+}
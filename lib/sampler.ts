@@ -0,0 +1,565 @@
+/**
+ * Opt-in CPU profiler scoped to Swift code, see Swift.sampler. Chosen threads
+ * are followed by Stalker, with every module lacking Swift type metadata
+ * excluded so that it runs uninstrumented, and a CModule callout counts
+ * executions of each basic block in a lock-free table, occasionally capturing
+ * the stack too. JS only aggregates the counts by function, and functions by
+ * owning type, when asked for a report.
+ *
+ * TODO:
+ *  - Attribute blocks inlined from other functions to their caller
+ *  - Follow threads as they're created
+ */
+
+import { ContextDescriptorKind } from "../abi/metadatavalues.js";
+import { findDemangledSymbol, findTypeDescriptor } from "./macho.js";
+import { getSwiftSection } from "./sections.js";
+import { registerCacheSize } from "./stats.js";
+
+export interface SamplerOptions {
+    /** Threads to follow, the main thread by default */
+    threads?: ThreadId[];
+    /** Capture the stack once in every N blocks executed, 0 to never */
+    stackSampling?: number;
+}
+
+export interface HotFunction {
+    name: string;
+    module: string;
+    /* The class, struct or enum the function is a member of, if any */
+    owner: string;
+    ownerKind: "class" | "struct" | "enum";
+    blocks: number;
+    /* Share of all blocks executed, in the range [0, 1] */
+    share: number;
+}
+
+export interface HotType {
+    name: string;
+    kind: "class" | "struct" | "enum";
+    blocks: number;
+    share: number;
+}
+
+export interface SamplerReport {
+    functions: HotFunction[];
+    types: HotType[];
+    /* In the folded format flame graph tools consume: `root;...;leaf count` */
+    stacks: string[];
+    /* Executions of blocks that didn't fit in the table */
+    dropped: number;
+}
+
+interface SamplerBackend {
+    module: CModule;
+    sampler: NativePointer;
+    reset: NativeFunction<void, []>;
+}
+
+interface FunctionDetails {
+    name: string;
+    module: string;
+    owner: string;
+    ownerKind: "class" | "struct" | "enum";
+}
+
+const TABLE_SIZE = 65536;
+const MAX_RANGES = 512;
+const MAX_FRAMES = 32;
+const MAX_STACKS = 4096;
+
+/* Keep in sync with the structs below */
+const OFFSETOF_SAMPLER_ENABLED = 0x0;
+const OFFSETOF_SAMPLER_STACK_SAMPLING = 0x4;
+const OFFSETOF_SAMPLER_DROPPED = 0x8;
+const OFFSETOF_SAMPLER_NUM_RANGES = 0x20;
+const OFFSETOF_SAMPLER_RANGES = 0x28;
+const SIZEOF_RANGE = 2 * 8;
+const OFFSETOF_SAMPLER_ENTRIES =
+    OFFSETOF_SAMPLER_RANGES + MAX_RANGES * SIZEOF_RANGE;
+const SIZEOF_ENTRY = 2 * 8;
+const OFFSETOF_SAMPLER_STACKS =
+    OFFSETOF_SAMPLER_ENTRIES + TABLE_SIZE * SIZEOF_ENTRY;
+const SIZEOF_STACK = (1 + MAX_FRAMES) * 8;
+
+const SAMPLER_CODE = `
+#include <glib.h>
+#include <gum/gumstalker.h>
+#include <string.h>
+
+#define SAMPLER_TABLE_SIZE ${TABLE_SIZE}
+#define SAMPLER_MAX_PROBES 64
+#define SAMPLER_MAX_RANGES ${MAX_RANGES}
+#define SAMPLER_MAX_FRAMES ${MAX_FRAMES}
+#define SAMPLER_MAX_STACKS ${MAX_STACKS}
+
+typedef struct _BlockEntry BlockEntry;
+typedef struct _StackSample StackSample;
+typedef struct _Sampler Sampler;
+
+struct _BlockEntry
+{
+  gpointer volatile address;
+  volatile gssize count;
+};
+
+struct _StackSample
+{
+  gsize num_frames;
+  gsize frames[SAMPLER_MAX_FRAMES];
+};
+
+struct _Sampler
+{
+  volatile gint enabled;
+  guint stack_sampling;
+  volatile gssize dropped;
+  volatile gssize blocks;
+  volatile gssize next_stack;
+  guint num_ranges;
+  GumMemoryRange ranges[SAMPLER_MAX_RANGES];
+  BlockEntry entries[SAMPLER_TABLE_SIZE];
+  StackSample stacks[SAMPLER_MAX_STACKS];
+};
+
+Sampler * sampler;
+
+static void on_block (GumCpuContext * cpu, gpointer user_data);
+static gboolean is_swift_code (gsize address);
+static BlockEntry * lookup_entry (gsize address);
+static void record_stack (gsize address, GumCpuContext * cpu);
+
+void
+init (void)
+{
+  sampler = g_new0 (Sampler, 1);
+}
+
+void
+finalize (void)
+{
+  g_free (sampler);
+}
+
+void
+sampler_reset (void)
+{
+  memset (sampler->entries, 0, sizeof (sampler->entries));
+  memset (sampler->stacks, 0, sizeof (sampler->stacks));
+  sampler->dropped = 0;
+  sampler->blocks = 0;
+  sampler->next_stack = 0;
+}
+
+void
+transform (GumStalkerIterator * iterator,
+           GumStalkerOutput * output,
+           gpointer user_data)
+{
+  cs_insn * insn;
+  gboolean is_first = TRUE;
+
+  while (gum_stalker_iterator_next (iterator, &insn))
+  {
+    /* Decided once per block at compile time, not on every execution */
+    if (is_first && is_swift_code (insn->address))
+    {
+      gum_stalker_iterator_put_callout (iterator, on_block,
+          GSIZE_TO_POINTER (insn->address), NULL);
+    }
+    is_first = FALSE;
+
+    gum_stalker_iterator_keep (iterator);
+  }
+}
+
+static void
+on_block (GumCpuContext * cpu,
+          gpointer user_data)
+{
+  gsize address = GPOINTER_TO_SIZE (user_data);
+  BlockEntry * entry;
+
+  if (!g_atomic_int_get (&sampler->enabled))
+    return;
+
+  entry = lookup_entry (address);
+  if (entry != NULL)
+    g_atomic_pointer_add (&entry->count, 1);
+
+  if (sampler->stack_sampling != 0 &&
+      g_atomic_pointer_add (&sampler->blocks, 1) %
+      sampler->stack_sampling == 0)
+  {
+    record_stack (address, cpu);
+  }
+}
+
+static gboolean
+is_swift_code (gsize address)
+{
+  guint i;
+
+  for (i = 0; i != sampler->num_ranges; i++)
+  {
+    const GumMemoryRange * range = &sampler->ranges[i];
+
+    if (address >= range->base_address &&
+        address < range->base_address + range->size)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static BlockEntry *
+lookup_entry (gsize address)
+{
+  gsize hash = ((address >> 2) * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)) >>
+      (64 - 16);
+  guint i;
+
+  for (i = 0; i != SAMPLER_MAX_PROBES; i++)
+  {
+    BlockEntry * entry =
+        &sampler->entries[(hash + i) & (SAMPLER_TABLE_SIZE - 1)];
+    gpointer key = g_atomic_pointer_get (&entry->address);
+
+    if (key == NULL)
+    {
+      if (g_atomic_pointer_compare_and_exchange (&entry->address, NULL,
+          GSIZE_TO_POINTER (address)))
+        return entry;
+
+      key = g_atomic_pointer_get (&entry->address);
+    }
+
+    if (key == GSIZE_TO_POINTER (address))
+      return entry;
+  }
+
+  g_atomic_pointer_add (&sampler->dropped, 1);
+
+  return NULL;
+}
+
+static void
+record_stack (gsize address,
+              GumCpuContext * cpu)
+{
+  StackSample * sample;
+  gsize * fp;
+  gsize n = 0;
+
+  sample = &sampler->stacks[
+      g_atomic_pointer_add (&sampler->next_stack, 1) % SAMPLER_MAX_STACKS];
+
+  /* Stalker keeps the real return addresses in the frame records */
+  sample->frames[n++] = address;
+
+  for (fp = GSIZE_TO_POINTER (cpu->fp);
+      n != SAMPLER_MAX_FRAMES && fp != NULL &&
+      (GPOINTER_TO_SIZE (fp) & 0xf) == 0;
+      fp = (gsize *) fp[0])
+  {
+    if (fp[1] == 0)
+      break;
+
+    sample->frames[n++] = fp[1];
+
+    if ((gsize *) fp[0] <= fp)
+      break;
+  }
+
+  sample->num_frames = n;
+}
+`;
+
+class Sampler {
+    #backend: SamplerBackend = null;
+    #threads: ThreadId[] = [];
+    #excluded = new Set<string>();
+    #functions = new Map<string, FunctionDetails>();
+
+    constructor() {
+        registerCacheSize("sampledFunctions", () => this.#functions.size);
+    }
+
+    get running(): boolean {
+        return this.#threads.length !== 0;
+    }
+
+    /**
+     * Modules without Swift type metadata are excluded from Stalker for the
+     * rest of the process' lifetime, as Stalker exclusions can't be undone.
+     */
+    start(options: SamplerOptions = {}) {
+        if (this.running) {
+            this.stop();
+        }
+
+        const { module, sampler } = this.getBackend();
+        const stackSampling = options.stackSampling ?? 0;
+
+        if (stackSampling < 0) {
+            throw new Error("Invalid stack sampling");
+        }
+
+        sampler.add(OFFSETOF_SAMPLER_STACK_SAMPLING).writeU32(stackSampling);
+        this.updateRanges(sampler);
+
+        const threads = options.threads ?? [Process.enumerateThreads()[0].id];
+
+        for (const threadId of threads) {
+            Stalker.follow(threadId, {
+                transform: module.transform,
+            } as StalkerOptions);
+        }
+        this.#threads = threads;
+
+        sampler.add(OFFSETOF_SAMPLER_ENABLED).writeS32(1);
+    }
+
+    stop() {
+        if (this.#backend === null) {
+            return;
+        }
+
+        this.#backend.sampler.add(OFFSETOF_SAMPLER_ENABLED).writeS32(0);
+
+        for (const threadId of this.#threads) {
+            Stalker.unfollow(threadId);
+        }
+        this.#threads = [];
+        Stalker.flush();
+        Stalker.garbageCollect();
+    }
+
+    /**
+     * Racy while running: blocks counted as it clears the table may be lost.
+     */
+    reset() {
+        if (this.#backend !== null) {
+            this.#backend.reset();
+        }
+    }
+
+    /**
+     * @param limit maximum number of functions and types to report
+     */
+    report(limit = 100): SamplerReport {
+        if (this.#backend === null) {
+            return { functions: [], types: [], stacks: [], dropped: 0 };
+        }
+
+        const { sampler } = this.#backend;
+        const byFunction = new Map<string, HotFunction>();
+        const byType = new Map<string, HotType>();
+        let total = 0;
+
+        for (let i = 0; i !== TABLE_SIZE; i++) {
+            const entry = sampler.add(OFFSETOF_SAMPLER_ENTRIES + i * SIZEOF_ENTRY);
+            const address = entry.readPointer();
+
+            if (address.isNull()) {
+                continue;
+            }
+
+            const count = entry.add(8).readS64().toNumber();
+            const details = this.getFunctionDetails(address);
+            total += count;
+
+            let hot = byFunction.get(details.name);
+            if (hot === undefined) {
+                hot = { ...details, blocks: 0, share: 0 };
+                byFunction.set(details.name, hot);
+            }
+            hot.blocks += count;
+
+            if (details.owner !== null) {
+                let type = byType.get(details.owner);
+                if (type === undefined) {
+                    type = {
+                        name: details.owner,
+                        kind: details.ownerKind,
+                        blocks: 0,
+                        share: 0,
+                    };
+                    byType.set(details.owner, type);
+                }
+                type.blocks += count;
+            }
+        }
+
+        const rank = <T extends { blocks: number; share: number }>(
+            items: Iterable<T>
+        ) =>
+            Array.from(items)
+                .sort((a, b) => b.blocks - a.blocks)
+                .slice(0, limit)
+                .map((item) => {
+                    item.share = total === 0 ? 0 : item.blocks / total;
+                    return item;
+                });
+
+        return {
+            functions: rank(byFunction.values()),
+            types: rank(byType.values()),
+            stacks: this.foldStacks(sampler),
+            dropped: sampler.add(OFFSETOF_SAMPLER_DROPPED).readS64().toNumber(),
+        };
+    }
+
+    private foldStacks(sampler: NativePointer): string[] {
+        const folded = new Map<string, number>();
+
+        for (let i = 0; i !== MAX_STACKS; i++) {
+            const sample = sampler.add(OFFSETOF_SAMPLER_STACKS + i * SIZEOF_STACK);
+            const numFrames = Math.min(
+                sample.readU64().toNumber(),
+                MAX_FRAMES
+            );
+
+            if (numFrames === 0) {
+                continue;
+            }
+
+            const names: string[] = [];
+            for (let j = numFrames - 1; j >= 0; j--) {
+                const address = sample.add(8 + j * 8).readPointer().strip();
+                /* Semicolons delimit frames in the folded format */
+                names.push(
+                    this.getFunctionDetails(address).name.replace(/;/g, ",")
+                );
+            }
+
+            const stack = names.join(";");
+            folded.set(stack, (folded.get(stack) ?? 0) + 1);
+        }
+
+        return Array.from(folded.entries())
+            .sort((a, b) => b[1] - a[1])
+            .map(([stack, count]) => `${stack} ${count}`);
+    }
+
+    /* Resolved once per address, blocks of the same function sharing names */
+    private getFunctionDetails(address: NativePointer): FunctionDetails {
+        const key = address.toString();
+
+        let details = this.#functions.get(key);
+        if (details !== undefined) {
+            return details;
+        }
+
+        const module = Process.findModuleByAddress(address);
+        const name =
+            findDemangledSymbol(address) ??
+            DebugSymbol.fromAddress(address).name ??
+            (module !== null
+                ? `${module.name}!${address.sub(module.base)}`
+                : key);
+
+        details = {
+            name,
+            module: module !== null ? module.name : null,
+            owner: null,
+            ownerKind: null,
+        };
+
+        const owner = findOwningType(name);
+        if (owner !== null) {
+            details.owner = owner.name;
+            details.ownerKind = owner.kind;
+        }
+
+        this.#functions.set(key, details);
+        return details;
+    }
+
+    private updateRanges(sampler: NativePointer) {
+        const ranges = sampler.add(OFFSETOF_SAMPLER_RANGES);
+        let numRanges = 0;
+
+        for (const module of Process.enumerateModules()) {
+            if (getSwiftSection(module, "types").size === 0) {
+                if (!this.#excluded.has(module.path)) {
+                    Stalker.exclude(module);
+                    this.#excluded.add(module.path);
+                }
+                continue;
+            }
+
+            if (numRanges === MAX_RANGES) {
+                throw new Error("Too many Swift modules to sample");
+            }
+
+            const range = ranges.add(numRanges * SIZEOF_RANGE);
+            range.writePointer(module.base);
+            range.add(8).writeU64(module.size);
+            numRanges++;
+        }
+
+        sampler.add(OFFSETOF_SAMPLER_NUM_RANGES).writeU32(numRanges);
+    }
+
+    private getBackend(): SamplerBackend {
+        if (this.#backend !== null) {
+            return this.#backend;
+        }
+
+        if (Process.arch !== "arm64") {
+            throw new Error("The sampler is only supported on arm64");
+        }
+
+        const cm = new CModule(SAMPLER_CODE);
+
+        this.#backend = {
+            module: cm,
+            sampler: cm.sampler.readPointer(),
+            reset: new NativeFunction(cm.sampler_reset, "void", []),
+        };
+        return this.#backend;
+    }
+}
+
+const OWNER_KINDS: Partial<Record<ContextDescriptorKind, HotType["kind"]>> = {
+    [ContextDescriptorKind.Class]: "class",
+    [ContextDescriptorKind.Struct]: "struct",
+    [ContextDescriptorKind.Enum]: "enum",
+};
+
+/**
+ * Finds the type a method belongs to from its demangled name, e.g.
+ * dummy.SimpleClass for "closure #1 in dummy.SimpleClass.run() -> ()", by
+ * trimming components off its qualified name until one names a type.
+ */
+function findOwningType(
+    symbol: string
+): { name: string; kind: HotType["kind"] } | null {
+    const inIndex = symbol.lastIndexOf(" in ");
+    let name = inIndex === -1 ? symbol : symbol.substring(inIndex + 4);
+
+    /* Drop the signature or accessor type, then prefixes such as "merged" */
+    name = name.split(" : ")[0];
+    const end = name.search(/[(<]/);
+    if (end !== -1) {
+        name = name.substring(0, end);
+    }
+    name = name.substring(name.lastIndexOf(" ") + 1);
+
+    const components = name.split(".");
+
+    for (let n = components.length - 1; n >= 2; n--) {
+        const descriptor = findTypeDescriptor(components.slice(0, n).join("."));
+        if (descriptor !== undefined) {
+            const kind = OWNER_KINDS[descriptor.getKind()];
+            return kind === undefined
+                ? null
+                : { name: components.slice(0, n).join("."), kind };
+        }
+    }
+
+    return null;
+}
+
+export const sampler = new Sampler();
@@ -0,0 +1,279 @@
+/**
+ * Discovery of the sections the Swift compiler emits metadata records into.
+ * The records themselves are laid out identically across object file formats,
+ * only their whereabouts differ.
+ *
+ * TODO:
+ *  - Add a PE/COFF backend
+ */
+
+export interface SwiftSection {
+    vmAddress: NativePointer;
+    size: number;
+}
+
+export type SwiftSectionKind =
+    | "types"
+    | "protocols"
+    | "protocolConformances"
+    | "fieldDescriptors";
+
+export interface SectionDiscoveryBackend {
+    /** The image the Swift runtime's entry points are bound from */
+    readonly swiftCoreModuleName: string;
+
+    /**
+     * @returns a section with a null address and a zero size if the module
+     * doesn't contain it
+     */
+    findSection(module: Module, kind: SwiftSectionKind): SwiftSection;
+}
+
+const NO_SECTION: SwiftSection = { vmAddress: ptr(0), size: 0 };
+
+let cachedBackend: SectionDiscoveryBackend | undefined;
+
+export function getSectionDiscoveryBackend(): SectionDiscoveryBackend | null {
+    if (cachedBackend !== undefined) {
+        return cachedBackend;
+    }
+
+    if (Process.platform === "darwin" && Process.arch === "arm64") {
+        cachedBackend = new MachOSectionDiscoveryBackend("libswiftCore.dylib");
+    } else if (
+        Process.platform === "linux" &&
+        (Process.arch === "arm64" || Process.arch === "x64")
+    ) {
+        cachedBackend = new ElfSectionDiscoveryBackend("libswiftCore.so");
+    } else {
+        cachedBackend = null;
+    }
+
+    return cachedBackend;
+}
+
+export function getSwiftSection(
+    module: Module,
+    kind: SwiftSectionKind
+): SwiftSection {
+    return getSectionDiscoveryBackend().findSection(module, kind);
+}
+
+class MachOSectionDiscoveryBackend implements SectionDiscoveryBackend {
+    static readonly SECTION_NAMES: Record<SwiftSectionKind, string> = {
+        types: "__swift5_types",
+        protocols: "__swift5_protos",
+        protocolConformances: "__swift5_proto",
+        fieldDescriptors: "__swift5_fieldmd",
+    };
+
+    #segmentName = Memory.allocUtf8String("__TEXT");
+    #sectionNames = new Map<SwiftSectionKind, NativePointer>();
+    #sizeOut = Memory.alloc(Process.pointerSize);
+    #getsectiondata: NativeFunction<
+        NativePointer,
+        [NativePointer, NativePointer, NativePointer, NativePointer]
+    > = null;
+
+    constructor(readonly swiftCoreModuleName: string) {}
+
+    findSection(module: Module, kind: SwiftSectionKind): SwiftSection {
+        let sectName = this.#sectionNames.get(kind);
+        if (sectName === undefined) {
+            sectName = Memory.allocUtf8String(
+                MachOSectionDiscoveryBackend.SECTION_NAMES[kind]
+            );
+            this.#sectionNames.set(kind, sectName);
+        }
+
+        if (this.#getsectiondata === null) {
+            this.#getsectiondata = new NativeFunction(
+                Process.getModuleByName("libmacho.dylib").getExportByName(
+                    "getsectiondata"
+                ),
+                "pointer",
+                ["pointer", "pointer", "pointer", "pointer"]
+            );
+        }
+
+        const vmAddress = this.#getsectiondata(
+            module.base,
+            this.#segmentName,
+            sectName,
+            this.#sizeOut
+        );
+        const size = this.#sizeOut.readU32() as number;
+
+        return { vmAddress, size };
+    }
+}
+
+/**
+ * Linux Swift images carry the same records in ELF sections. Their section
+ * headers may be gone, e.g. for stripped images, in which case the sections
+ * are found through the PT_NOTE segment swiftrt.o emits, which points at the
+ * swift::MetadataSections it registers the image's sections with.
+ */
+export class ElfSectionDiscoveryBackend implements SectionDiscoveryBackend {
+    static readonly SECTION_NAMES: Record<SwiftSectionKind, string> = {
+        types: "swift5_type_metadata",
+        protocols: "swift5_protocols",
+        protocolConformances: "swift5_protocol_conformances",
+        fieldDescriptors: "swift5_fieldmd",
+    };
+
+    /* Where each section's range lies in swift::MetadataSections */
+    static readonly OFFSETOF_METADATA_SECTIONS_RANGE: Record<SwiftSectionKind, number> = {
+        protocols: 0x20,
+        protocolConformances: 0x30,
+        types: 0x40,
+        fieldDescriptors: 0x70,
+    };
+
+    static readonly OFFSETOF_EHDR_PHOFF = 0x20;
+    static readonly OFFSETOF_EHDR_PHENTSIZE = 0x36;
+    static readonly OFFSETOF_EHDR_PHNUM = 0x38;
+    static readonly OFFSETOF_PHDR_VADDR = 0x10;
+    static readonly OFFSETOF_PHDR_MEMSZ = 0x28;
+    static readonly OFFSETOF_PHDR_ALIGN = 0x30;
+    static readonly SIZEOF_NHDR = 12;
+    static readonly PT_LOAD = 1;
+    static readonly PT_NOTE = 4;
+
+    #sections = new Map<string, Map<string, SwiftSection>>();
+
+    constructor(readonly swiftCoreModuleName: string) {}
+
+    findSection(module: Module, kind: SwiftSectionKind): SwiftSection {
+        const name = ElfSectionDiscoveryBackend.SECTION_NAMES[kind];
+        const sections = this.getSwiftSections(module);
+
+        return sections.get(name) ?? NO_SECTION;
+    }
+
+    private getSwiftSections(module: Module): Map<string, SwiftSection> {
+        let sections = this.#sections.get(module.path);
+        if (sections !== undefined) {
+            return sections;
+        }
+
+        sections = new Map<string, SwiftSection>();
+
+        try {
+            for (const s of module.enumerateSections()) {
+                if (s.name.startsWith("swift5_")) {
+                    sections.set(s.name, { vmAddress: s.address, size: s.size });
+                }
+            }
+        } catch (e) {
+            /* Section headers may be unavailable, e.g. for stripped images */
+        }
+
+        if (sections.size === 0) {
+            const metadataSections = this.findMetadataSections(module);
+
+            if (metadataSections !== null) {
+                this.readMetadataSections(module, metadataSections, sections);
+            }
+        }
+
+        this.#sections.set(module.path, sections);
+        return sections;
+    }
+
+    /**
+     * Walks the program headers of the image mapped at the module's base for
+     * a "swift" note whose descriptor points into the image.
+     */
+    private findMetadataSections(module: Module): NativePointer | null {
+        const E = ElfSectionDiscoveryBackend;
+        const base = module.base;
+        const phdrs = base.add(base.add(E.OFFSETOF_EHDR_PHOFF).readU64());
+        const phentsize = base.add(E.OFFSETOF_EHDR_PHENTSIZE).readU16();
+        const phnum = base.add(E.OFFSETOF_EHDR_PHNUM).readU16();
+        const notes: { vaddr: number; size: number; align: number }[] = [];
+        let loadBias: NativePointer = null;
+
+        for (let i = 0; i !== phnum; i++) {
+            const phdr = phdrs.add(i * phentsize);
+            const type = phdr.readU32();
+            const vaddr = phdr.add(E.OFFSETOF_PHDR_VADDR).readU64().toNumber();
+
+            if (type === E.PT_LOAD && loadBias === null) {
+                loadBias = base.sub(vaddr - (vaddr % Process.pageSize));
+            } else if (type === E.PT_NOTE) {
+                notes.push({
+                    vaddr,
+                    size: phdr.add(E.OFFSETOF_PHDR_MEMSZ).readU64().toNumber(),
+                    align: phdr.add(E.OFFSETOF_PHDR_ALIGN).readU64().toNumber(),
+                });
+            }
+        }
+
+        if (loadBias === null) {
+            return null;
+        }
+
+        for (const { vaddr, size, align } of notes) {
+            const padding = Math.max(align, 4);
+            const end = vaddr + size;
+            let offset = vaddr;
+
+            while (offset + E.SIZEOF_NHDR <= end) {
+                const note = loadBias.add(offset);
+                const nameSize = note.readU32();
+                const descSize = note.add(4).readU32();
+                const name = note.add(E.SIZEOF_NHDR).readUtf8String(nameSize);
+                const descOffset =
+                    offset + E.SIZEOF_NHDR + alignUp(nameSize, padding);
+
+                if (
+                    name.startsWith("swift") &&
+                    descSize === Process.pointerSize
+                ) {
+                    const metadataSections = loadBias
+                        .add(descOffset)
+                        .readPointer();
+                    if (isWithinModule(module, metadataSections)) {
+                        return metadataSections;
+                    }
+                }
+
+                offset = descOffset + alignUp(descSize, padding);
+            }
+        }
+
+        return null;
+    }
+
+    private readMetadataSections(
+        module: Module,
+        metadataSections: NativePointer,
+        sections: Map<string, SwiftSection>
+    ) {
+        const E = ElfSectionDiscoveryBackend;
+
+        for (const [kind, name] of Object.entries(E.SECTION_NAMES)) {
+            const range = metadataSections.add(
+                E.OFFSETOF_METADATA_SECTIONS_RANGE[kind as SwiftSectionKind]
+            );
+            const vmAddress = range.readPointer();
+            const size = range.add(Process.pointerSize).readU64().toNumber();
+
+            if (size !== 0 && isWithinModule(module, vmAddress)) {
+                sections.set(name, { vmAddress, size });
+            }
+        }
+    }
+}
+
+function alignUp(value: number, alignment: number): number {
+    return Math.ceil(value / alignment) * alignment;
+}
+
+function isWithinModule(module: Module, address: NativePointer): boolean {
+    return (
+        address.compare(module.base) >= 0 &&
+        address.compare(module.base.add(module.size)) < 0
+    );
+}
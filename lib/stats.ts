@@ -0,0 +1,147 @@
+/**
+ * Cheap counters describing what the bridge costs, see Swift.stats(). They're
+ * plain number increments so that they can stay on in long-running sessions.
+ *
+ * All counters are cumulative since the bridge was loaded, except where noted.
+ */
+
+import { makeMonotonicClock } from "./profiler.js";
+
+export interface CacheCounters {
+    hits: number;
+    misses: number;
+}
+
+export const counters = {
+    indexing: {
+        modules: 0,
+        typeDescriptors: 0,
+        protocolDescriptors: 0,
+        conformances: 0,
+        timeMs: 0,
+    },
+    metadata: {
+        accessorCalls: 0,
+        runtimeLookups: 0,
+        cache: newCacheCounters(),
+    },
+    demangling: {
+        calls: 0,
+        timeMs: 0,
+        cache: newCacheCounters(),
+    },
+    symbolicReferences: {
+        cache: newCacheCounters(),
+    },
+    existentials: {
+        cache: newCacheCounters(),
+    },
+    symbolication: {
+        lookups: 0,
+        timeMs: 0,
+        cache: newCacheCounters(),
+    },
+    trampolines: {
+        count: 0,
+        pages: 0,
+        bytes: 0,
+    },
+    nativeFunctions: {
+        swiftcall: 0,
+        valueWitnesses: 0,
+    },
+    values: {
+        podCopies: 0,
+        witnessCopies: 0,
+    },
+    memory: {
+        allocations: 0,
+        bytes: 0,
+    },
+};
+
+/* Live sizes of caches owned by other modules, registered by them */
+const cacheSizeProviders: Record<string, () => number> = {};
+
+export interface LazyStepTrace {
+    step: string;
+    timeMs: number;
+}
+
+/* Initialization steps deferred until first use, in the order they ran */
+const lazySteps: LazyStepTrace[] = [];
+
+export function newCacheCounters(): CacheCounters {
+    return { hits: 0, misses: 0 };
+}
+
+export function registerCacheSize(name: string, provider: () => number) {
+    cacheSizeProviders[name] = provider;
+}
+
+let clock: () => number = null;
+
+/**
+ * Monotonic time in nanoseconds, for timing demangling, symbolication and
+ * the like, which take microseconds and so would mostly be rounded down to 0
+ * by Date.now().
+ */
+export function monotonicNow(): number {
+    if (clock === null) {
+        clock = makeMonotonicClock();
+    }
+
+    return clock();
+}
+
+export function millisecondsSince(start: number): number {
+    return (monotonicNow() - start) / 1e6;
+}
+
+/**
+ * Runs a one-off initialization step, recording what it cost, whether it
+ * succeeded or not.
+ */
+export function traceLazyStep<T>(step: string, fn: () => T): T {
+    const start = monotonicNow();
+
+    try {
+        return fn();
+    } finally {
+        lazySteps.push({ step, timeMs: millisecondsSince(start) });
+    }
+}
+
+/**
+ * Memory.alloc() for values and containers, accounted for in the stats.
+ */
+export function allocValueMemory(size: number): NativePointer {
+    counters.memory.allocations++;
+    counters.memory.bytes += size;
+    return Memory.alloc(size);
+}
+
+export function getStats() {
+    const snapshot = JSON.parse(JSON.stringify(counters));
+
+    for (const subsystem of Object.values(snapshot) as any[]) {
+        const cache: CacheCounters = subsystem.cache;
+        if (cache === undefined) {
+            continue;
+        }
+
+        const total = cache.hits + cache.misses;
+        subsystem.cache = Object.assign(cache, {
+            hitRatio: total === 0 ? 0 : cache.hits / total,
+        });
+    }
+
+    const cacheEntries: Record<string, number> = {};
+    for (const [name, provider] of Object.entries(cacheSizeProviders)) {
+        cacheEntries[name] = provider();
+    }
+    snapshot.cacheEntries = cacheEntries;
+    snapshot.initialization = lazySteps.map((s) => Object.assign({}, s));
+
+    return snapshot;
+}
@@ -0,0 +1,362 @@
+/**
+ * Direct access to the stored properties of class instances, see
+ * Swift.Object.$stored. Unlike the getters and setters, which are full
+ * swiftcalls that may run arbitrary code, these only read and write the
+ * object's memory, using the field offsets from the class metadata.
+ *
+ * Only classes from the first Swift one up the hierarchy down are covered,
+ * Objective-C ancestors having ivars rather than stored properties.
+ *
+ * Weak and unowned references are only exposed by address, as their storage
+ * holds a side table or an unowned reference rather than a strong one.
+ *
+ * TODO:
+ *  - Read and write weak and unowned references
+ *  - Read the field offsets of classes with resilient superclasses
+ */
+
+import {
+    TargetClassMetadata,
+    TargetMetadata,
+    TargetValueMetadata,
+} from "../abi/metadata.js";
+import { MetadataKind } from "../abi/metadatavalues.js";
+import { FieldDescriptor } from "../reflection/records.js";
+import { getApi } from "./api.js";
+import {
+    readMangledNameSuffix,
+    resolveSymbolicReferences,
+} from "./symbols.js";
+import { registerCacheSize } from "./stats.js";
+import { metadataForMangledName } from "./typeresolver.js";
+import { ObjectInstance, RuntimeInstance, ValueInstance } from "./types.js";
+
+type FieldReader = (address: NativePointer) => any;
+type FieldWriter = (address: NativePointer, value: any) => void;
+
+interface TrivialFieldAccessors {
+    read: FieldReader;
+    write: FieldWriter;
+}
+
+/* Decoded to JS values, as wrapping them would cost more than reading them */
+const TRIVIAL_FIELD_TYPES: Record<string, TrivialFieldAccessors> = {
+    "Swift.Int": {
+        read: (p) => p.readS64(),
+        write: (p, v) => p.writeS64(v),
+    },
+    "Swift.UInt": {
+        read: (p) => p.readU64(),
+        write: (p, v) => p.writeU64(v),
+    },
+    "Swift.Int64": {
+        read: (p) => p.readS64(),
+        write: (p, v) => p.writeS64(v),
+    },
+    "Swift.UInt64": {
+        read: (p) => p.readU64(),
+        write: (p, v) => p.writeU64(v),
+    },
+    "Swift.Int32": {
+        read: (p) => p.readS32(),
+        write: (p, v) => p.writeS32(v),
+    },
+    "Swift.UInt32": {
+        read: (p) => p.readU32(),
+        write: (p, v) => p.writeU32(v),
+    },
+    "Swift.Int16": {
+        read: (p) => p.readS16(),
+        write: (p, v) => p.writeS16(v),
+    },
+    "Swift.UInt16": {
+        read: (p) => p.readU16(),
+        write: (p, v) => p.writeU16(v),
+    },
+    "Swift.Int8": {
+        read: (p) => p.readS8(),
+        write: (p, v) => p.writeS8(v),
+    },
+    "Swift.UInt8": {
+        read: (p) => p.readU8(),
+        write: (p, v) => p.writeU8(v),
+    },
+    "Swift.Bool": {
+        read: (p) => p.readU8() !== 0,
+        write: (p, v) => p.writeU8(v ? 1 : 0),
+    },
+    "Swift.Double": {
+        read: (p) => p.readDouble(),
+        write: (p, v) => p.writeDouble(v),
+    },
+    "Swift.Float": {
+        read: (p) => p.readFloat(),
+        write: (p, v) => p.writeFloat(v),
+    },
+};
+
+const HANDLE = Symbol("handle");
+
+export interface StoredProperties {
+    [HANDLE]: NativePointer;
+    [name: string]: any;
+}
+
+interface StoredField {
+    name: string;
+    offset: number;
+    typeName: string;
+    /* Resolved by the runtime, in the context of the declaring class */
+    mangledTypeName: NativePointer;
+    context: NativePointer;
+    genericArgs: NativePointer;
+    read: FieldReader;
+    write: FieldWriter;
+}
+
+interface StoredPropertiesLayout {
+    fields: StoredField[];
+    prototype: object;
+}
+
+/* Per class metadata, as field offsets are only known once it's initialized */
+const layouts = new Map<string, StoredPropertiesLayout>();
+
+registerCacheSize("storedPropertyLayouts", () => layouts.size);
+
+export function makeStoredProperties(
+    instance: ObjectInstance
+): StoredProperties {
+    const layout = getStoredPropertiesLayout(instance.$metadata);
+    const properties: StoredProperties = Object.create(layout.prototype);
+    properties[HANDLE] = instance.handle;
+    return properties;
+}
+
+function getStoredPropertiesLayout(
+    metadata: TargetClassMetadata
+): StoredPropertiesLayout {
+    const key = metadata.handle.toString();
+
+    let layout = layouts.get(key);
+    if (layout !== undefined) {
+        return layout;
+    }
+
+    const fields: StoredField[] = [];
+    const classes: TargetClassMetadata[] = [];
+
+    for (let c = metadata; c !== null; c = c.getSuperclass()) {
+        classes.unshift(c);
+    }
+
+    /*
+     * The fields of classes whose offsets can't be read, i.e. those with a
+     * resilient superclass, are left out rather than failing the others
+     */
+    for (const klass of classes) {
+        try {
+            fields.push(...getStoredFieldsDeclaredBy(klass));
+        } catch (e) {
+            continue;
+        }
+    }
+
+    const prototype = {};
+
+    for (const field of fields) {
+        Object.defineProperty(prototype, field.name, {
+            enumerable: true,
+            get(this: StoredProperties) {
+                return field.read(this[HANDLE].add(field.offset));
+            },
+            set(this: StoredProperties, value: any) {
+                field.write(this[HANDLE].add(field.offset), value);
+            },
+        });
+    }
+
+    Object.defineProperty(prototype, "toJSON", {
+        value(this: StoredProperties) {
+            const result: Record<string, any> = {};
+            for (const field of fields) {
+                result[field.name] = this[field.name];
+            }
+            return result;
+        },
+    });
+
+    layout = { fields, prototype };
+    layouts.set(key, layout);
+    return layout;
+}
+
+function getStoredFieldsDeclaredBy(klass: TargetClassMetadata): StoredField[] {
+    const descriptor = klass.getDescription();
+
+    if (descriptor.numFields === 0 || !descriptor.isReflectable()) {
+        return [];
+    }
+
+    const offsets = klass.getFieldOffsets();
+    const genericArgs = klass.getGenericArguments();
+    const records = new FieldDescriptor(descriptor.fields.get()).getFields();
+
+    return records.map((record, i) => {
+        const mangledTypeName =
+            record.mangledTypeName === null
+                ? null
+                : record.mangledTypeName.get();
+        const typeName =
+            mangledTypeName === null
+                ? undefined
+                : resolveSymbolicReferences(mangledTypeName);
+        const field: StoredField = {
+            name: record.fieldName,
+            offset: offsets[i],
+            typeName,
+            mangledTypeName,
+            context: descriptor.handle,
+            genericArgs,
+            read: null,
+            write: null,
+        };
+
+        bindFieldAccessors(field);
+        return field;
+    });
+}
+
+/* Mangled suffixes of weak, unowned and unowned(unsafe) storage */
+const REFERENCE_STORAGE_SUFFIXES = ["Xw", "Xo", "Xu"];
+
+/**
+ * Resolution of the field's type is left to its first access, as dumping an
+ * object shouldn't instantiate the metadata of every type it references.
+ */
+function bindFieldAccessors(field: StoredField) {
+    const trivial = TRIVIAL_FIELD_TYPES[field.typeName];
+    if (trivial !== undefined) {
+        field.read = trivial.read;
+        field.write = trivial.write;
+        return;
+    }
+
+    /*
+     * The runtime resolves these to their referent's type, e.g. Optional<T>
+     * for a weak var, which would have the storage read as a strong reference
+     */
+    if (isReferenceStorage(field)) {
+        bindAddressOnlyAccessors(field);
+        return;
+    }
+
+    const resolve = () => {
+        const metadata = tryResolveFieldType(field);
+
+        if (metadata === null) {
+            bindAddressOnlyAccessors(field);
+        } else if (metadata.getKind() === MetadataKind.Class) {
+            field.read = (address) => {
+                const object = address.readPointer();
+                return object.isNull() ? null : new ObjectInstance(object);
+            };
+            field.write = (address, value: ObjectInstance) => {
+                if (value === null || value === undefined) {
+                    throw new Error(
+                        `Can't assign to ${field.name}: expected an instance of ${field.typeName}, not ${value}`
+                    );
+                }
+
+                const api = getApi();
+                const old = address.readPointer();
+
+                api.swift_retain(value.handle);
+                address.writePointer(value.handle);
+                api.swift_release(old);
+            };
+        } else {
+            const valueMetadata = metadata as TargetValueMetadata;
+            const plan = valueMetadata.getCopyPlan();
+            const valueWitnesses = valueMetadata.getValueWitnesses();
+
+            field.read = (address) =>
+                RuntimeInstance.fromAdopted(address, valueMetadata);
+            field.write = (address, value: ValueInstance) => {
+                if (!value.$metadata.handle.equals(valueMetadata.handle)) {
+                    throw new Error(
+                        `Can't assign to ${field.name}: expected a value of type ${field.typeName}`
+                    );
+                }
+
+                if (plan.isPOD) {
+                    plan.initializeWithCopy(address, value.handle);
+                } else {
+                    valueWitnesses.assignWithCopy(
+                        address,
+                        value.handle,
+                        valueMetadata.handle
+                    );
+                }
+            };
+        }
+    };
+
+    field.read = (address) => {
+        resolve();
+        return field.read(address);
+    };
+    field.write = (address, value) => {
+        resolve();
+        field.write(address, value);
+    };
+}
+
+function isReferenceStorage(field: StoredField): boolean {
+    const { typeName, mangledTypeName } = field;
+
+    if (
+        typeName !== undefined &&
+        (typeName.startsWith("weak ") || typeName.startsWith("unowned"))
+    ) {
+        return true;
+    }
+
+    return (
+        mangledTypeName !== null &&
+        REFERENCE_STORAGE_SUFFIXES.includes(
+            readMangledNameSuffix(mangledTypeName, 2)
+        )
+    );
+}
+
+/* Its storage's address is the best we can do */
+function bindAddressOnlyAccessors(field: StoredField) {
+    field.read = (address) => address;
+    field.write = () => {
+        throw new Error(
+            `Can't assign to ${field.name}: unsupported type ${field.typeName}`
+        );
+    };
+}
+
+/**
+ * By mangled name, which unlike the demangled one also covers Optionals,
+ * tuples and other generic instantiations, and with the declaring class'
+ * generic arguments for fields of generic parameter types.
+ */
+function tryResolveFieldType(field: StoredField): TargetMetadata {
+    if (field.mangledTypeName === null) {
+        return null;
+    }
+
+    try {
+        return metadataForMangledName(
+            field.mangledTypeName,
+            field.context,
+            field.genericArgs
+        );
+    } catch (e) {
+        return null;
+    }
+}
@@ -0,0 +1,296 @@
+/**
+ * Construction of struct values from their stored properties, see
+ * Swift.Struct.make(). Fields of trivial types are laid out in a scratch
+ * buffer on the JS side, copied to the value's memory with a single write,
+ * and only the other fields are then initialized in place, through their
+ * copy witnesses.
+ *
+ * Plans are built once per struct metadata, from its field offset vector
+ * and field types, so that constructing values in a loop doesn't reflect
+ * anything.
+ *
+ * TODO:
+ *  - Default values, which only the memberwise initializer knows about
+ *  - Construct enum fields from JS objects as well
+ */
+
+import { TargetMetadata, TargetStructMetadata } from "../abi/metadata.js";
+import { MetadataKind } from "../abi/metadatavalues.js";
+import { FieldDescriptor } from "../reflection/records.js";
+import { getApi } from "./api.js";
+import { resolveSymbolicReferences } from "./symbols.js";
+import { allocValueMemory, registerCacheSize } from "./stats.js";
+import { metadataForMangledName } from "./typeresolver.js";
+import {
+    ObjectInstance,
+    RuntimeInstance,
+    StructValue,
+    ValueInstance,
+} from "./types.js";
+
+type ByteWriter = (view: DataView, offset: number, value: any) => void;
+
+/* Little-endian, as on all of the architectures Swift runs on */
+const TRIVIAL_FIELD_WRITERS: Record<string, ByteWriter> = {
+    "Swift.Int": (v, o, x) => v.setBigInt64(o, toBigInt(x), true),
+    "Swift.UInt": (v, o, x) => v.setBigUint64(o, toBigInt(x), true),
+    "Swift.Int64": (v, o, x) => v.setBigInt64(o, toBigInt(x), true),
+    "Swift.UInt64": (v, o, x) => v.setBigUint64(o, toBigInt(x), true),
+    "Swift.Int32": (v, o, x) => v.setInt32(o, x, true),
+    "Swift.UInt32": (v, o, x) => v.setUint32(o, x, true),
+    "Swift.Int16": (v, o, x) => v.setInt16(o, x, true),
+    "Swift.UInt16": (v, o, x) => v.setUint16(o, x, true),
+    "Swift.Int8": (v, o, x) => v.setInt8(o, x),
+    "Swift.UInt8": (v, o, x) => v.setUint8(o, x),
+    "Swift.Bool": (v, o, x) => v.setUint8(o, x ? 1 : 0),
+    "Swift.Double": (v, o, x) => v.setFloat64(o, x, true),
+    "Swift.Float": (v, o, x) => v.setFloat32(o, x, true),
+};
+
+interface StructFieldPlan {
+    name: string;
+    offset: number;
+    typeName: string;
+    /* Null if the field's type isn't trivial */
+    writeBytes: ByteWriter | null;
+    /* For struct fields, which may be given as JS objects too */
+    nested: StructInitPlan | null;
+    metadata: TargetMetadata;
+}
+
+interface StructInitPlan {
+    metadata: TargetStructMetadata;
+    fields: StructFieldPlan[];
+    /* Only used by outermost plans, nested ones writing into their parent's */
+    scratch: Uint8Array;
+    view: DataView;
+}
+
+/* A field to initialize in place, once the scratch buffer has been copied */
+type PendingField = [number, RuntimeInstance];
+
+const plans = new Map<string, StructInitPlan>();
+
+registerCacheSize("structInitPlans", () => plans.size);
+
+/**
+ * @param values every stored property, trivial ones as numbers, booleans,
+ * Int64s or UInt64s, struct ones as instances or nested objects, and others
+ * as instances of the field's type
+ */
+export function makeStructValue(
+    metadata: TargetStructMetadata,
+    values: Record<string, any>
+): StructValue {
+    const plan = getStructInitPlan(metadata);
+    const { scratch, view } = plan;
+    const pending: PendingField[] = [];
+
+    scratch.fill(0);
+    layOut(plan, view, 0, values, pending);
+
+    const handle = allocValueMemory(Math.max(scratch.length, 1));
+    handle.writeByteArray(scratch.buffer as ArrayBuffer);
+
+    for (const [offset, value] of pending) {
+        initializeField(handle.add(offset), value);
+    }
+
+    return new StructValue(metadata, { handle });
+}
+
+/**
+ * Checks every value before anything is retained or copied, so that a bad
+ * one doesn't leave a half-initialized value behind.
+ */
+function layOut(
+    plan: StructInitPlan,
+    view: DataView,
+    base: number,
+    values: Record<string, any>,
+    pending: PendingField[]
+) {
+    const { fields } = plan;
+
+    if (Object.keys(values).length !== fields.length) {
+        const known = new Set(fields.map((f) => f.name));
+        const unknown = Object.keys(values).find((k) => !known.has(k));
+        if (unknown !== undefined) {
+            throw new Error(
+                `${plan.metadata.getFullTypeName()} has no field named ${unknown}`
+            );
+        }
+    }
+
+    for (const field of fields) {
+        const value = values[field.name];
+        const offset = base + field.offset;
+
+        if (value === undefined) {
+            throw new Error(
+                `Missing field ${field.name} of ${plan.metadata.getFullTypeName()}`
+            );
+        }
+
+        if (field.writeBytes !== null && !isRuntimeInstance(value)) {
+            field.writeBytes(view, offset, value);
+        } else if (field.nested !== null && isPlainObject(value)) {
+            layOut(field.nested, view, offset, value, pending);
+        } else {
+            checkFieldValue(field, value);
+            pending.push([offset, value]);
+        }
+    }
+}
+
+function checkFieldValue(field: StructFieldPlan, value: any) {
+    const { metadata } = field;
+
+    if (metadata === null) {
+        throw new Error(
+            `Can't initialize ${field.name}: unsupported type ${field.typeName}`
+        );
+    }
+
+    const expected =
+        metadata.getKind() === MetadataKind.Class
+            ? value instanceof ObjectInstance
+            : isRuntimeInstance(value) &&
+              value.$metadata.handle.equals(metadata.handle);
+
+    if (!expected) {
+        throw new Error(
+            `Can't initialize ${field.name}: expected a value of type ${field.typeName}`
+        );
+    }
+}
+
+/* The field's memory is uninitialized, hence no release nor destroy */
+function initializeField(address: NativePointer, value: RuntimeInstance) {
+    if (value instanceof ObjectInstance) {
+        getApi().swift_retain(value.handle);
+        address.writePointer(value.handle);
+    } else {
+        (value as ValueInstance).$metadata
+            .getCopyPlan()
+            .initializeWithCopy(address, value.handle);
+    }
+}
+
+/* StructValue and EnumValue only implement ValueInstance */
+function isRuntimeInstance(value: any): value is RuntimeInstance {
+    return (
+        typeof value === "object" &&
+        value !== null &&
+        value.$metadata instanceof TargetMetadata
+    );
+}
+
+function isPlainObject(value: any): boolean {
+    return (
+        typeof value === "object" &&
+        value !== null &&
+        Object.getPrototypeOf(value) === Object.prototype
+    );
+}
+
+function toBigInt(value: number | Int64 | UInt64 | bigint): bigint {
+    return typeof value === "number" || typeof value === "bigint"
+        ? BigInt(value)
+        : BigInt(value.toString());
+}
+
+function getStructInitPlan(metadata: TargetStructMetadata): StructInitPlan {
+    const key = metadata.handle.toString();
+
+    let plan = plans.get(key);
+    if (plan === undefined) {
+        plan = makeStructInitPlan(metadata);
+        plans.set(key, plan);
+    }
+
+    return plan;
+}
+
+function makeStructInitPlan(metadata: TargetStructMetadata): StructInitPlan {
+    const descriptor = metadata.getDescription();
+    const size = metadata.getCopyPlan().stride;
+    const scratch = new Uint8Array(size);
+    const view = new DataView(scratch.buffer);
+    const fields: StructFieldPlan[] = [];
+
+    if (descriptor.numFields !== 0) {
+        if (!descriptor.isReflectable()) {
+            throw new Error(
+                `Can't construct ${metadata.getFullTypeName()}: its fields aren't reflectable`
+            );
+        }
+
+        const offsets = metadata.getFieldOffsets();
+        const genericArgs = metadata.getGenericArguments();
+        const records = new FieldDescriptor(
+            descriptor.fields.get()
+        ).getFields();
+
+        for (const [i, record] of records.entries()) {
+            const mangledTypeName =
+                record.mangledTypeName === null
+                    ? null
+                    : record.mangledTypeName.get();
+            const typeName =
+                mangledTypeName === null
+                    ? undefined
+                    : resolveSymbolicReferences(mangledTypeName);
+            const fieldMetadata = tryResolveFieldType(
+                mangledTypeName,
+                descriptor.handle,
+                genericArgs
+            );
+            /* Fields of generic parameter types only have a name once resolved */
+            const writeBytes =
+                TRIVIAL_FIELD_WRITERS[typeName] ??
+                (fieldMetadata?.isClassObject() === false
+                    ? TRIVIAL_FIELD_WRITERS[fieldMetadata.getFullTypeName()]
+                    : undefined) ??
+                null;
+
+            fields.push({
+                name: record.fieldName,
+                offset: offsets[i],
+                typeName,
+                writeBytes,
+                nested:
+                    fieldMetadata?.getKind() === MetadataKind.Struct
+                        ? getStructInitPlan(
+                              fieldMetadata as TargetStructMetadata
+                          )
+                        : null,
+                metadata: fieldMetadata,
+            });
+        }
+    }
+
+    return { metadata, fields, scratch, view };
+}
+
+/**
+ * By mangled name, in the context of the struct and with its generic
+ * arguments, which covers generic instantiations such as Optionals as well as
+ * fields of generic parameter types. Plans being per metadata, each
+ * instantiation gets its own field types.
+ */
+function tryResolveFieldType(
+    mangledTypeName: NativePointer,
+    context: NativePointer,
+    genericArgs: NativePointer
+): TargetMetadata {
+    if (mangledTypeName === null) {
+        return null;
+    }
+
+    try {
+        return metadataForMangledName(mangledTypeName, context, genericArgs);
+    } catch (e) {
+        return null;
+    }
+}
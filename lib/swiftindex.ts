@@ -0,0 +1,47 @@
+/**
+ * Format of the Swift metadata index emitted by tools/swift-index.ts and
+ * consumed by the agent in place of scanning an image's Swift sections.
+ *
+ * This file must not depend on the Frida runtime, as it's shared with the
+ * host-side tooling.
+ *
+ * All offsets are relative to the image's Mach-O header, i.e. to the start of
+ * its __TEXT segment, which is where every record we refer to lives. That way
+ * they remain valid in the dyld shared cache, where segments are slid apart.
+ *
+ * Field descriptors, i.e. __swift5_fieldmd, aren't indexed: they're reached
+ * from each type descriptor's relative `fields` pointer when reflecting, and
+ * nothing scans that section in-process either.
+ */
+
+export const SWIFT_INDEX_FORMAT = "frida-swift-index";
+export const SWIFT_INDEX_VERSION = 1;
+
+/**
+ * [descriptor offset, ContextDescriptorKind, full type name]
+ * The name is null when it can't be computed offline, e.g. when the
+ * descriptor's parent is imported from another image.
+ */
+export type SwiftIndexTypeRecord = [number, number, string | null];
+
+/** [descriptor offset, full protocol name] */
+export type SwiftIndexProtocolRecord = [number, string | null];
+
+/** [conformance descriptor offset, full name of the conforming type] */
+export type SwiftIndexConformanceRecord = [number, string | null];
+
+export interface SwiftImageIndex {
+    /* LC_UUID as 32 lowercase hex digits */
+    uuid: string;
+    name: string;
+    arch: string;
+    types: SwiftIndexTypeRecord[];
+    protocols: SwiftIndexProtocolRecord[];
+    conformances: SwiftIndexConformanceRecord[];
+}
+
+export interface SwiftIndex {
+    format: typeof SWIFT_INDEX_FORMAT;
+    version: number;
+    images: SwiftImageIndex[];
+}
@@ -4,6 +4,21 @@
  */
 
 import { getApi, getPrivateAPI } from "../lib/api.js";
+import {
+    TargetContextDescriptor,
+    TargetModuleContextDescriptor,
+    TargetProtocolDescriptor,
+    TargetTypeContextDescriptor,
+} from "../abi/metadata.js";
+import { ContextDescriptorKind } from "../abi/metadatavalues.js";
+import { RelativeDirectPointer } from "../basic/relativepointer.js";
+import {
+    counters,
+    millisecondsSince,
+    monotonicNow,
+    registerCacheSize,
+    traceLazyStep,
+} from "./stats.js";
 
 export interface SimpleSymbolDetails {
     address: string;
@@ -14,9 +29,39 @@ type CSSymbolicator = [NativePointer, NativePointer];
 const kCSNow = 0x8000000000000000;
 
 const demangleCache = new Map<string, string>();
+const symbolicReferenceCache = new Map<string, string>();
 let cachedSymbolicator: CSSymbolicator | null = null;
 
+registerCacheSize("demangle", () => demangleCache.size);
+registerCacheSize("symbolicReferences", () => symbolicReferenceCache.size);
+
 export function demangledSymbolFromAddress(address: NativePointer): string {
+    const mangled = mangledSymbolFromAddress(address);
+
+    if (mangled === undefined) {
+        return undefined;
+    }
+
+    return tryDemangleSymbol(mangled);
+}
+
+export function mangledSymbolFromAddress(address: NativePointer): string {
+    const start = monotonicNow();
+    counters.symbolication.lookups++;
+
+    try {
+        return lookUpMangledSymbol(address);
+    } finally {
+        counters.symbolication.timeMs += millisecondsSince(start);
+    }
+}
+
+function lookUpMangledSymbol(address: NativePointer): string {
+    if (Process.platform !== "darwin") {
+        const name = DebugSymbol.fromAddress(address).name;
+        return name === null ? undefined : name;
+    }
+
     const api = getPrivateAPI();
 
     const symbol = api.CSSymbolicatorGetSymbolWithAddressAtTime(
@@ -36,7 +81,7 @@ export function demangledSymbolFromAddress(address: NativePointer): string {
         return undefined;
     }
 
-    return tryDemangleSymbol(mangled);
+    return mangled;
 }
 
 export function tryDemangleSymbol(name: string): string {
@@ -46,9 +91,13 @@ export function tryDemangleSymbol(name: string): string {
 
     const cached = demangleCache.get(name);
     if (cached !== undefined) {
+        counters.demangling.cache.hits++;
         return cached;
     }
 
+    counters.demangling.cache.misses++;
+    counters.demangling.calls++;
+    const start = monotonicNow();
     const api = getApi();
 
     try {
@@ -67,9 +116,237 @@ export function tryDemangleSymbol(name: string): string {
         return demangled;
     } catch (e) {
         return undefined;
+    } finally {
+        counters.demangling.timeMs += millisecondsSince(start);
+    }
+}
+
+/**
+ * Resolves a mangled type name, e.g. that of a field record, to its demangled
+ * form. Symbolic references embedded in the name are substituted with the
+ * mangling of what they point to, so the demangler is called at most once per
+ * name. Results are cached by the address of the mangled name since many
+ * records share the same one.
+ * @returns undefined for names it can't resolve
+ */
+export function resolveSymbolicReferences(symbol: NativePointer): string {
+    const key = symbol.toString();
+
+    if (symbolicReferenceCache.has(key)) {
+        counters.symbolicReferences.cache.hits++;
+        return symbolicReferenceCache.get(key);
+    }
+
+    counters.symbolicReferences.cache.misses++;
+
+    let resolved: string;
+    try {
+        resolved = tryResolveSymbolicReferences(symbol);
+    } catch (e) {
+        resolved = undefined;
+    }
+
+    symbolicReferenceCache.set(key, resolved);
+    return resolved;
+}
+
+enum SymbolicReferenceKind {
+    DirectContext = 0x01,
+    IndirectContext = 0x02,
+    AccessorFunctionReference = 0x09,
+    DirectObjCProtocol = 0x0c,
+}
+
+function tryResolveSymbolicReferences(symbol: NativePointer): string {
+    let mangled = "";
+    let cursor = symbol;
+    let value = cursor.readU8();
+
+    /* A lone reference to a type is by far the most common case, and it
+    doesn't need the demangler at all. */
+    const handle = findLoneContextReference(symbol);
+    if (handle !== null) {
+        const descriptor = new TargetTypeContextDescriptor(handle);
+
+        if (descriptor.getKind() >= ContextDescriptorKind.TypeFirst) {
+            return descriptor.getFullTypeName();
+        }
+    }
+
+    while (value !== 0) {
+        if (value >= 0x01 && value <= 0x17) {
+            const target = readSymbolicReference(cursor.add(1), value);
+            const substitution = mangleSymbolicReference(target, value);
+
+            if (substitution === undefined) {
+                return undefined;
+            }
+
+            mangled += substitution;
+            cursor = cursor.add(1 + RelativeDirectPointer.sizeOf);
+        } else if (value >= 0x18 && value <= 0x1f) {
+            /* Absolute references are only ever built at runtime, never
+            emitted into a binary, so there's nothing sensible to map. */
+            return undefined;
+        } else {
+            mangled += String.fromCharCode(value);
+            cursor = cursor.add(1);
+        }
+
+        value = cursor.readU8();
+    }
+
+    return tryDemangleSymbol("_$s" + mangled);
+}
+
+/**
+ * The trailing characters of a mangled name, with its symbolic references
+ * standing in as NULs, e.g. to tell reference storage kinds apart.
+ */
+export function readMangledNameSuffix(
+    symbol: NativePointer,
+    length: number
+): string {
+    let suffix = "";
+    let cursor = symbol;
+    let value = cursor.readU8();
+
+    while (value !== 0) {
+        if (value >= 0x01 && value <= 0x17) {
+            suffix += "\0";
+            cursor = cursor.add(1 + RelativeDirectPointer.sizeOf);
+        } else if (value >= 0x18 && value <= 0x1f) {
+            suffix += "\0";
+            cursor = cursor.add(1 + Process.pointerSize);
+        } else {
+            suffix += String.fromCharCode(value);
+            cursor = cursor.add(1);
+        }
+
+        suffix = suffix.slice(-length);
+        value = cursor.readU8();
+    }
+
+    return suffix;
+}
+
+/**
+ * The context descriptor a mangled name refers to when it's nothing but a
+ * symbolic reference to it, as is the case for non-generic nominal types.
+ * @returns null for any other name
+ */
+export function findLoneContextReference(
+    symbol: NativePointer
+): NativePointer | null {
+    const kind = symbol.readU8();
+
+    if (
+        (kind !== SymbolicReferenceKind.DirectContext &&
+            kind !== SymbolicReferenceKind.IndirectContext) ||
+        symbol.add(1 + RelativeDirectPointer.sizeOf).readU8() !== 0
+    ) {
+        return null;
+    }
+
+    return readSymbolicReference(symbol.add(1), kind);
+}
+
+function readSymbolicReference(
+    handle: NativePointer,
+    kind: number
+): NativePointer {
+    const target = RelativeDirectPointer.From(handle).get();
+
+    if (kind === SymbolicReferenceKind.IndirectContext) {
+        return target.readPointer().strip();
+    }
+
+    return target;
+}
+
+function mangleSymbolicReference(
+    target: NativePointer,
+    kind: number
+): string {
+    switch (kind) {
+        case SymbolicReferenceKind.DirectContext:
+        case SymbolicReferenceKind.IndirectContext:
+            return mangleContextDescriptor(target);
+        case SymbolicReferenceKind.DirectObjCProtocol: {
+            /* Points to the protocol_t, whose name follows the isa */
+            const name = target.add(Process.pointerSize).readPointer();
+            return "So" + mangleIdentifier(name.readCString()) + "P";
+        }
+        case SymbolicReferenceKind.AccessorFunctionReference: {
+            /* Accessors are named after the type mangling plus "Ma" */
+            const accessor = mangledSymbolFromAddress(target);
+            const match = /^_?\$s(.+)Ma$/.exec(accessor ?? "");
+            return match === null ? undefined : match[1];
+        }
+        default:
+            return undefined;
+    }
+}
+
+export function mangleContextDescriptor(handle: NativePointer): string {
+    const context = new TargetContextDescriptor(handle);
+    const kind = context.getKind();
+
+    if (kind === ContextDescriptorKind.Module) {
+        const name = new TargetModuleContextDescriptor(handle).name;
+
+        switch (name) {
+            case "Swift":
+                return "s";
+            case "__C":
+                return "So";
+            case "__C_Synthesized":
+                return "SC";
+            default:
+                return mangleIdentifier(name);
+        }
+    }
+
+    const parent =
+        context.parent === null
+            ? ""
+            : mangleContextDescriptor(context.parent.get());
+
+    if (parent === undefined) {
+        return undefined;
+    }
+
+    switch (kind) {
+        /* XXX: we don't mangle extension and anonymous contexts, so types
+        nested in them are approximated by the enclosing context */
+        case ContextDescriptorKind.Extension:
+        case ContextDescriptorKind.Anonymous:
+            return parent;
+        case ContextDescriptorKind.Protocol: {
+            const name = new TargetProtocolDescriptor(handle).name;
+            return parent + mangleIdentifier(name) + "P";
+        }
+        case ContextDescriptorKind.Class:
+        case ContextDescriptorKind.Struct:
+        case ContextDescriptorKind.Enum: {
+            const name = new TargetTypeContextDescriptor(handle).name;
+            const suffix =
+                kind === ContextDescriptorKind.Class
+                    ? "C"
+                    : kind === ContextDescriptorKind.Struct
+                    ? "V"
+                    : "O";
+            return parent + mangleIdentifier(name) + suffix;
+        }
+        default:
+            return undefined;
     }
 }
 
+function mangleIdentifier(name: string): string {
+    return `${name.length}${name}`;
+}
+
 function isSwiftSymbol(name: string): boolean {
     if (name.length == 0) {
         return false;
@@ -92,7 +369,7 @@ function isSwiftSymbol(name: string): boolean {
     return false;
 }
 
-interface MethodSignatureParseResult {
+export interface MethodSignatureParseResult {
     methodName: string;
     argNames: string[];
     argTypeNames: string[];
@@ -217,15 +494,19 @@ export function getSymbolicator(): CSSymbolicator {
     }
 
     const api = getPrivateAPI();
-    let symbolicator = api.CSSymbolicatorCreateWithPid(Process.id);
+    const symbolicator = traceLazyStep("symbolicator", () => {
+        let result = api.CSSymbolicatorCreateWithPid(Process.id);
 
-    if (api.CSIsNull(symbolicator)) {
-        symbolicator = api.CSSymbolicatorCreateWithTask(api.mach_task_self());
+        if (api.CSIsNull(result)) {
+            result = api.CSSymbolicatorCreateWithTask(api.mach_task_self());
 
-        if (api.CSIsNull(symbolicator)) {
-            throw new Error("Failed to create symbolicator");
+            if (api.CSIsNull(result)) {
+                throw new Error("Failed to create symbolicator");
+            }
         }
-    }
+
+        return result;
+    });
 
     cachedSymbolicator = symbolicator;
 
@@ -0,0 +1,875 @@
+/**
+ * Opt-in tracing of Swift concurrency, see Swift.taskTracer, for finding out
+ * where async code waits to be scheduled. The concurrency runtime's entry
+ * points are hooked by a CModule that timestamps task creations, enqueues,
+ * runs and executor switches into a ring buffer, leaving JS out of the
+ * scheduling path: events are only decoded, and task entry points only
+ * symbolicated, when the trace is drained.
+ *
+ * A task's queueing latency is measured from its last enqueue to the start
+ * of its next run, and its run time until it suspends, completes, or its
+ * thread moves on to another job. Runs are observed where the runtime flags
+ * a task as running and suspended, which it does through the exclusivity
+ * entry points swift_task_{enter,exit}ThreadLocalContext(), so that tasks
+ * drained inline by default actors, i.e. those of user actors, are seen as
+ * well as those run by swift_job_run(). Runtimes lacking these fall back to
+ * swift_job_run() alone, missing the former.
+ *
+ * Events are published through a per-slot sequence number, written last, so
+ * that events still being written aren't decoded.
+ *
+ * TODO:
+ *  - Attribute child tasks to their parent
+ */
+
+import { getIsaMask, describeHeapMetadata } from "./heap.js";
+import { LatencyHistogram } from "./profiler.js";
+import { registerCacheSize } from "./stats.js";
+import { demangledSymbolFromAddress } from "./symbols.js";
+
+export interface TaskTracerOptions {
+    /** Whether to also record executor switches, true by default */
+    switches?: boolean;
+}
+
+export interface LatencySummary {
+    count: number;
+    totalMs: number;
+    meanUs: number;
+    p50Us: number;
+    p90Us: number;
+    p99Us: number;
+    maxUs: number;
+}
+
+export interface TaskFunctionSummary {
+    name: string;
+    address: string;
+    tasks: number;
+    queueing: LatencySummary;
+    running: LatencySummary;
+}
+
+export interface ActorSummary {
+    name: string;
+    enqueues: number;
+    switches: number;
+    queueing: LatencySummary;
+    running: LatencySummary;
+}
+
+/** One run of a task, from its enqueue to it suspending */
+export interface TaskSlice {
+    task: NativePointer;
+    function: string;
+    executor: string;
+    threadId: number;
+    /* Monotonic timestamps in nanoseconds, enqueuedAt being null if unseen */
+    enqueuedAt: number;
+    startedAt: number;
+    finishedAt: number;
+}
+
+export interface TaskTraceReport {
+    functions: TaskFunctionSummary[];
+    actors: ActorSummary[];
+    /* Events overwritten before being drained */
+    lost: number;
+}
+
+enum TaskEventKind {
+    Create,
+    Enqueue,
+    EnqueueMain,
+    EnqueueDelayed,
+    RunBegin,
+    RunEnd,
+    Switch,
+}
+
+interface TaskTracerBackend {
+    module: CModule;
+    trace: NativePointer;
+    callbacks: Map<string, NativeInvocationListenerCallbacks>;
+}
+
+interface TracedTask {
+    entry: NativePointer;
+}
+
+interface PendingEnqueue {
+    time: number;
+    executor: string;
+}
+
+interface RunningJob {
+    job: NativePointer;
+    time: number;
+    executor: string;
+    enqueue: PendingEnqueue;
+}
+
+interface TaskTracerHook {
+    target: NativePointer | null;
+    callbacks: string;
+    data?: NativePointer;
+}
+
+interface Aggregate {
+    queueing: LatencyHistogram;
+    running: LatencyHistogram;
+    tasks: number;
+    enqueues: number;
+    switches: number;
+}
+
+const CAPACITY = 65536;
+/*
+ * Tasks and enqueues tracked across drains, the least recently seen being
+ * forgotten first, as task completions aren't observed
+ */
+const MAX_TRACKED_TASKS = 65536;
+
+/* Keep in sync with the structs below */
+const OFFSETOF_TRACE_ENABLED = 0x0;
+const OFFSETOF_TRACE_CLOCK_ID = 0x4;
+const OFFSETOF_TRACE_ISA_MASK = 0x8;
+const OFFSETOF_TRACE_NEXT = 0x10;
+const OFFSETOF_TRACE_EVENTS = 0x18;
+const OFFSETOF_EVENT_SEQ = 0x0;
+const OFFSETOF_EVENT_TIME = 0x8;
+const OFFSETOF_EVENT_KIND = 0x10;
+const OFFSETOF_EVENT_THREAD_ID = 0x18;
+const OFFSETOF_EVENT_JOB = 0x20;
+const OFFSETOF_EVENT_DATA = 0x28;
+const OFFSETOF_EVENT_DATA_TYPE = 0x30;
+const SIZEOF_EVENT = 7 * 8;
+
+const GENERIC_EXECUTOR = "<generic>";
+const MAIN_EXECUTOR = "<main>";
+const UNKNOWN_FUNCTION = "<unknown>";
+
+const TASK_TRACER_CODE = `
+#include <glib.h>
+#include <gum/guminterceptor.h>
+#include <gum/gumprocess.h>
+
+#define TASK_TRACE_CAPACITY ${CAPACITY}
+
+typedef struct _TaskEvent TaskEvent;
+typedef struct _TaskTrace TaskTrace;
+typedef struct _TraceTimespec TraceTimespec;
+typedef struct _SerialExecutorRef SerialExecutorRef;
+typedef guint TaskEventKind;
+
+enum _TaskEventKind
+{
+  TASK_EVENT_CREATE,
+  TASK_EVENT_ENQUEUE,
+  TASK_EVENT_ENQUEUE_MAIN,
+  TASK_EVENT_ENQUEUE_DELAYED,
+  TASK_EVENT_RUN_BEGIN,
+  TASK_EVENT_RUN_END,
+  TASK_EVENT_SWITCH
+};
+
+struct _TaskEvent
+{
+  /* Index of the event plus one once written, zero while being written */
+  volatile gsize seq;
+  guint64 time;
+  guint64 kind;
+  gsize thread_id;
+  gpointer job;
+  gpointer data;
+  gsize data_type;
+};
+
+struct _TaskTrace
+{
+  volatile gint enabled;
+  gint clock_id;
+  gsize isa_mask;
+  volatile gssize next;
+  TaskEvent events[TASK_TRACE_CAPACITY];
+};
+
+struct _TraceTimespec
+{
+  gint64 tv_sec;
+  glong tv_nsec;
+};
+
+struct _SerialExecutorRef
+{
+  gpointer identity;
+  gpointer implementation;
+};
+
+extern int clock_gettime (int clock_id, TraceTimespec * tp);
+extern gpointer swift_task_getCurrent (void);
+/* Returned in x0 and x1 under both calling conventions */
+extern SerialExecutorRef swift_task_getCurrentExecutor (void);
+
+TaskTrace * trace;
+
+static void record_event (TaskEventKind kind, gpointer job, gpointer data,
+    gboolean data_is_object);
+
+void
+init (void)
+{
+  trace = g_new0 (TaskTrace, 1);
+}
+
+void
+finalize (void)
+{
+  g_free (trace);
+}
+
+void
+on_task_create_enter (GumInvocationContext * ic)
+{
+  gpointer * entry = GUM_IC_GET_INVOCATION_DATA (ic, gpointer);
+
+  *entry = gum_invocation_context_get_nth_argument (ic, 3);
+}
+
+void
+on_task_create_leave (GumInvocationContext * ic)
+{
+  gpointer * entry = GUM_IC_GET_INVOCATION_DATA (ic, gpointer);
+
+  /* AsyncTaskAndContext, the task coming first */
+  record_event (TASK_EVENT_CREATE,
+      gum_invocation_context_get_return_value (ic), *entry, FALSE);
+}
+
+void
+on_enqueue (GumInvocationContext * ic)
+{
+  /* The executor's identity, its witness table following */
+  record_event (TASK_EVENT_ENQUEUE,
+      gum_invocation_context_get_nth_argument (ic, 0),
+      gum_invocation_context_get_nth_argument (ic, 1), TRUE);
+}
+
+void
+on_enqueue_global (GumInvocationContext * ic)
+{
+  record_event (TASK_EVENT_ENQUEUE,
+      gum_invocation_context_get_nth_argument (ic, 0), NULL, FALSE);
+}
+
+void
+on_enqueue_main (GumInvocationContext * ic)
+{
+  record_event (TASK_EVENT_ENQUEUE_MAIN,
+      gum_invocation_context_get_nth_argument (ic, 0), NULL, FALSE);
+}
+
+void
+on_enqueue_delayed (GumInvocationContext * ic)
+{
+  guint job_index = GPOINTER_TO_UINT (GUM_IC_GET_FUNC_DATA (ic, gpointer));
+
+  record_event (TASK_EVENT_ENQUEUE_DELAYED,
+      gum_invocation_context_get_nth_argument (ic, job_index), NULL, FALSE);
+}
+
+void
+on_job_run_enter (GumInvocationContext * ic)
+{
+  gpointer * job = GUM_IC_GET_INVOCATION_DATA (ic, gpointer);
+
+  *job = gum_invocation_context_get_nth_argument (ic, 0);
+
+  record_event (TASK_EVENT_RUN_BEGIN, *job,
+      gum_invocation_context_get_nth_argument (ic, 1), TRUE);
+}
+
+void
+on_job_run_leave (GumInvocationContext * ic)
+{
+  gpointer * job = GUM_IC_GET_INVOCATION_DATA (ic, gpointer);
+
+  record_event (TASK_EVENT_RUN_END, *job, NULL, FALSE);
+}
+
+void
+on_task_resume (GumInvocationContext * ic)
+{
+  SerialExecutorRef executor = swift_task_getCurrentExecutor ();
+
+  /* The task has just been made the current one */
+  record_event (TASK_EVENT_RUN_BEGIN, swift_task_getCurrent (),
+      executor.identity, TRUE);
+}
+
+void
+on_task_suspend (GumInvocationContext * ic)
+{
+  record_event (TASK_EVENT_RUN_END, swift_task_getCurrent (), NULL, FALSE);
+}
+
+void
+on_job_run_return (GumInvocationContext * ic)
+{
+  /* Whatever ran last on this thread is done, e.g. a task that completed */
+  record_event (TASK_EVENT_RUN_END, NULL, NULL, FALSE);
+}
+
+void
+on_task_switch (GumInvocationContext * ic)
+{
+  /* swiftasynccc: the context is in x22, the resume function comes first */
+  record_event (TASK_EVENT_SWITCH, swift_task_getCurrent (),
+      gum_invocation_context_get_nth_argument (ic, 1), TRUE);
+}
+
+static void
+record_event (TaskEventKind kind,
+              gpointer job,
+              gpointer data,
+              gboolean data_is_object)
+{
+  gssize index;
+  TaskEvent * event;
+  TraceTimespec now;
+
+  if (!g_atomic_int_get (&trace->enabled))
+    return;
+
+  clock_gettime (trace->clock_id, &now);
+
+  index = g_atomic_pointer_add (&trace->next, 1);
+  event = &trace->events[index % TASK_TRACE_CAPACITY];
+  g_atomic_pointer_set (&event->seq, 0);
+  event->time = now.tv_sec * G_GUINT64_CONSTANT (1000000000) + now.tv_nsec;
+  event->kind = kind;
+  event->thread_id = gum_process_get_current_thread_id ();
+  event->job = job;
+  event->data = data;
+  event->data_type = (data_is_object && data != NULL)
+      ? *(gsize *) data & trace->isa_mask
+      : 0;
+  g_atomic_pointer_set (&event->seq, index + 1);
+}
+`;
+
+class TaskTracer {
+    #backend: TaskTracerBackend = null;
+    #listeners: InvocationListener[] = [];
+    #cursor = 0;
+    #lost = 0;
+
+    #tasks = new Map<string, TracedTask>();
+    #pending = new Map<string, PendingEnqueue>();
+    /* At most one task runs on a thread at a time */
+    #running = new Map<number, RunningJob>();
+    #byFunction = new Map<string, Aggregate>();
+    #byExecutor = new Map<string, Aggregate>();
+    #functionNames = new Map<string, string>();
+    #typeNames = new Map<string, string>();
+
+    constructor() {
+        registerCacheSize("tracedTasks", () => this.#tasks.size);
+    }
+
+    get running(): boolean {
+        return this.#listeners.length !== 0;
+    }
+
+    start(options: TaskTracerOptions = {}) {
+        if (this.running) {
+            this.stop();
+        }
+
+        const { trace, callbacks } = this.getBackend();
+
+        trace.add(OFFSETOF_TRACE_ISA_MASK).writePointer(getIsaMask());
+
+        const concurrency = getConcurrencyModule();
+        const find = (name: string) => concurrency.findExportByName(name);
+        const hooks: TaskTracerHook[] = [
+            { target: find("swift_task_create"), callbacks: "create" },
+            { target: find("swift_task_enqueue"), callbacks: "enqueue" },
+            { target: find("swift_task_enqueueGlobal"), callbacks: "enqueueGlobal" },
+            {
+                target: find("swift_task_enqueueMainExecutor"),
+                callbacks: "enqueueMain",
+            },
+            {
+                target: find("swift_task_enqueueGlobalWithDelay"),
+                callbacks: "enqueueDelayed",
+                data: ptr(1),
+            },
+            {
+                target: find("swift_task_enqueueGlobalWithDeadline"),
+                callbacks: "enqueueDelayed",
+                data: ptr(5),
+            },
+        ];
+
+        /* Exported by the stdlib, for tracking exclusive accesses per task */
+        const resume = Module.findExportByName(
+            null,
+            "swift_task_enterThreadLocalContext"
+        );
+        const suspend = Module.findExportByName(
+            null,
+            "swift_task_exitThreadLocalContext"
+        );
+        if (resume !== null && suspend !== null) {
+            hooks.push(
+                { target: resume, callbacks: "resume" },
+                { target: suspend, callbacks: "suspend" },
+                { target: find("swift_job_run"), callbacks: "runReturn" }
+            );
+        } else {
+            hooks.push({ target: find("swift_job_run"), callbacks: "run" });
+        }
+
+        if (options.switches ?? true) {
+            hooks.push({ target: find("swift_task_switch"), callbacks: "switch" });
+        }
+
+        for (const { target, callbacks: name, data } of hooks) {
+            /* Newer entry points are missing from older runtimes */
+            if (target === null) {
+                continue;
+            }
+
+            this.#listeners.push(
+                Interceptor.attach(target, callbacks.get(name), data)
+            );
+        }
+
+        trace.add(OFFSETOF_TRACE_ENABLED).writeS32(1);
+    }
+
+    stop() {
+        if (this.#backend === null) {
+            return;
+        }
+
+        this.#backend.trace.add(OFFSETOF_TRACE_ENABLED).writeS32(0);
+
+        for (const listener of this.#listeners) {
+            listener.detach();
+        }
+        this.#listeners = [];
+        Interceptor.flush();
+    }
+
+    reset() {
+        this.#tasks.clear();
+        this.#pending.clear();
+        this.#running.clear();
+        this.#byFunction.clear();
+        this.#byExecutor.clear();
+        this.#lost = 0;
+
+        if (this.#backend !== null) {
+            this.#cursor = this.readNext();
+        }
+    }
+
+    /**
+     * Decodes the events recorded since the last call, to be polled often
+     * enough for the ring buffer not to wrap around.
+     *
+     * @returns the runs that completed since the last call, for aggregating
+     * on the host
+     */
+    drain(): TaskSlice[] {
+        if (this.#backend === null) {
+            return [];
+        }
+
+        const events = this.#backend.trace.add(OFFSETOF_TRACE_EVENTS);
+        const next = this.readNext();
+        const slices: TaskSlice[] = [];
+
+        if (next - this.#cursor > CAPACITY) {
+            this.#lost += next - this.#cursor - CAPACITY;
+            this.#cursor = next - CAPACITY;
+        }
+
+        for (; this.#cursor !== next; this.#cursor++) {
+            const event = events.add((this.#cursor % CAPACITY) * SIZEOF_EVENT);
+            const seq = readEventSeq(event);
+
+            /* Still being written: picked up by the next drain */
+            if (seq <= this.#cursor) {
+                break;
+            }
+
+            /* Overwritten by a writer that lapped us */
+            if (seq !== this.#cursor + 1) {
+                this.#lost++;
+                continue;
+            }
+
+            const decoded = decodeEvent(event);
+            if (readEventSeq(event) !== seq) {
+                this.#lost++;
+                continue;
+            }
+
+            const slice = this.handleEvent(decoded);
+            if (slice !== null) {
+                slices.push(slice);
+            }
+        }
+
+        return slices;
+    }
+
+    report(): TaskTraceReport {
+        this.drain();
+
+        const functions: TaskFunctionSummary[] = [];
+        for (const [address, aggregate] of this.#byFunction) {
+            functions.push({
+                name: this.getFunctionName(address),
+                address,
+                tasks: aggregate.tasks,
+                queueing: summarizeLatency(aggregate.queueing),
+                running: summarizeLatency(aggregate.running),
+            });
+        }
+
+        const actors: ActorSummary[] = [];
+        for (const [name, aggregate] of this.#byExecutor) {
+            actors.push({
+                name,
+                enqueues: aggregate.enqueues,
+                switches: aggregate.switches,
+                queueing: summarizeLatency(aggregate.queueing),
+                running: summarizeLatency(aggregate.running),
+            });
+        }
+
+        const byQueueing = (
+            a: { queueing: LatencySummary },
+            b: { queueing: LatencySummary }
+        ) => b.queueing.totalMs - a.queueing.totalMs;
+
+        return {
+            functions: functions.sort(byQueueing),
+            actors: actors.sort(byQueueing),
+            lost: this.#lost,
+        };
+    }
+
+    private handleEvent(event: TaskEvent): TaskSlice {
+        const { time, kind, threadId, job, data, dataType } = event;
+        const key = job.toString();
+
+        switch (kind) {
+            case TaskEventKind.Create: {
+                /* The same address may be reused by a later task */
+                this.#tasks.delete(key);
+                track(this.#tasks, key, { entry: data });
+                this.getAggregate(
+                    this.#byFunction,
+                    this.getEntryKey(key)
+                ).tasks++;
+                break;
+            }
+            case TaskEventKind.Enqueue:
+            case TaskEventKind.EnqueueMain: {
+                const executor =
+                    kind === TaskEventKind.EnqueueMain
+                        ? MAIN_EXECUTOR
+                        : this.getExecutorName(data, dataType);
+                track(this.#pending, key, { time, executor });
+                this.getAggregate(this.#byExecutor, executor).enqueues++;
+                break;
+            }
+            case TaskEventKind.EnqueueDelayed:
+                /* Sleeping isn't waiting to be scheduled */
+                this.#pending.delete(key);
+                break;
+            case TaskEventKind.RunBegin: {
+                /* The previous job on this thread completed without a trace */
+                const previous = this.#running.get(threadId);
+                const slice =
+                    previous !== undefined
+                        ? this.recordRun(previous, threadId, time)
+                        : null;
+
+                const enqueue = this.#pending.get(key) ?? null;
+                this.#pending.delete(key);
+
+                const task = this.#tasks.get(key);
+                if (task !== undefined) {
+                    track(this.#tasks, key, task);
+                }
+
+                this.#running.set(threadId, {
+                    job,
+                    time,
+                    executor: this.getExecutorName(data, dataType),
+                    enqueue,
+                });
+                return slice;
+            }
+            case TaskEventKind.RunEnd: {
+                /* Null when swift_job_run() returns, ending whatever ran */
+                const run = this.#running.get(threadId);
+                if (run === undefined) {
+                    break;
+                }
+
+                this.#running.delete(threadId);
+                return this.recordRun(run, threadId, time);
+            }
+            case TaskEventKind.Switch:
+                this.getAggregate(
+                    this.#byExecutor,
+                    this.getExecutorName(data, dataType)
+                ).switches++;
+                break;
+        }
+
+        return null;
+    }
+
+    private recordRun(
+        run: RunningJob,
+        threadId: number,
+        finishedAt: number
+    ): TaskSlice {
+        const key = run.job.toString();
+        const byFunction = this.getAggregate(
+            this.#byFunction,
+            this.getEntryKey(key)
+        );
+        /* Where it was enqueued names main actor jobs consistently */
+        const executor =
+            run.enqueue !== null ? run.enqueue.executor : run.executor;
+        const byExecutor = this.getAggregate(this.#byExecutor, executor);
+
+        byFunction.running.record(finishedAt - run.time);
+        byExecutor.running.record(finishedAt - run.time);
+
+        if (run.enqueue !== null) {
+            const queueing = run.time - run.enqueue.time;
+
+            byFunction.queueing.record(queueing);
+            byExecutor.queueing.record(queueing);
+        }
+
+        return {
+            task: run.job,
+            function: this.getFunctionName(this.getEntryKey(key)),
+            executor,
+            threadId,
+            enqueuedAt: run.enqueue !== null ? run.enqueue.time : null,
+            startedAt: run.time,
+            finishedAt,
+        };
+    }
+
+    private getAggregate(
+        aggregates: Map<string, Aggregate>,
+        key: string
+    ): Aggregate {
+        let aggregate = aggregates.get(key);
+        if (aggregate === undefined) {
+            aggregate = {
+                queueing: new LatencyHistogram(),
+                running: new LatencyHistogram(),
+                tasks: 0,
+                enqueues: 0,
+                switches: 0,
+            };
+            aggregates.set(key, aggregate);
+        }
+        return aggregate;
+    }
+
+    /**
+     * The entry point of tasks created while tracing, i.e. the function the
+     * async function pointer passed to swift_task_create() refers to.
+     */
+    private getEntryKey(task: string): string {
+        const traced = this.#tasks.get(task);
+        if (traced === undefined) {
+            return UNKNOWN_FUNCTION;
+        }
+
+        const asyncFunctionPointer = traced.entry.strip();
+        return asyncFunctionPointer
+            .add(asyncFunctionPointer.readS32())
+            .toString();
+    }
+
+    /* Symbolicated once per entry point, and only when reporting */
+    private getFunctionName(address: string): string {
+        if (address === UNKNOWN_FUNCTION) {
+            return address;
+        }
+
+        let name = this.#functionNames.get(address);
+        if (name === undefined) {
+            const pointer = ptr(address);
+            name =
+                demangledSymbolFromAddress(pointer) ??
+                DebugSymbol.fromAddress(pointer).name ??
+                address;
+            this.#functionNames.set(address, name);
+        }
+        return name;
+    }
+
+    /* By type, as the actor may be gone by the time the trace is drained */
+    private getExecutorName(identity: NativePointer, type: NativePointer): string {
+        if (identity.isNull()) {
+            return GENERIC_EXECUTOR;
+        }
+
+        const key = type.toString();
+
+        let name = this.#typeNames.get(key);
+        if (name === undefined) {
+            name = describeHeapMetadata(type);
+            this.#typeNames.set(key, name);
+        }
+        return name;
+    }
+
+    private readNext(): number {
+        return this.#backend.trace
+            .add(OFFSETOF_TRACE_NEXT)
+            .readS64()
+            .toNumber();
+    }
+
+    private getBackend(): TaskTracerBackend {
+        if (this.#backend !== null) {
+            return this.#backend;
+        }
+
+        if (Process.arch !== "arm64") {
+            throw new Error("The task tracer is only supported on arm64");
+        }
+
+        const concurrency = getConcurrencyModule();
+        const cm = new CModule(TASK_TRACER_CODE, {
+            clock_gettime: Module.getExportByName(null, "clock_gettime"),
+            swift_task_getCurrent: concurrency.getExportByName(
+                "swift_task_getCurrent"
+            ),
+            swift_task_getCurrentExecutor: concurrency.getExportByName(
+                "swift_task_getCurrentExecutor"
+            ),
+        });
+        const trace = cm.trace.readPointer();
+
+        /* The same clocks as the call profiler's */
+        const CLOCK_UPTIME_RAW = 8;
+        const CLOCK_MONOTONIC = 1;
+        trace
+            .add(OFFSETOF_TRACE_CLOCK_ID)
+            .writeS32(
+                Process.platform === "darwin" ? CLOCK_UPTIME_RAW : CLOCK_MONOTONIC
+            );
+
+        const listener = (onEnter: NativePointer, onLeave?: NativePointer) =>
+            ({
+                ...(onEnter !== null ? { onEnter } : {}),
+                ...(onLeave !== undefined ? { onLeave } : {}),
+            } as NativeInvocationListenerCallbacks);
+
+        this.#backend = {
+            module: cm,
+            trace,
+            callbacks: new Map([
+                [
+                    "create",
+                    listener(cm.on_task_create_enter, cm.on_task_create_leave),
+                ],
+                ["enqueue", listener(cm.on_enqueue)],
+                ["enqueueGlobal", listener(cm.on_enqueue_global)],
+                ["enqueueMain", listener(cm.on_enqueue_main)],
+                ["enqueueDelayed", listener(cm.on_enqueue_delayed)],
+                ["run", listener(cm.on_job_run_enter, cm.on_job_run_leave)],
+                ["resume", listener(cm.on_task_resume)],
+                ["suspend", listener(cm.on_task_suspend)],
+                ["runReturn", listener(null, cm.on_job_run_return)],
+                ["switch", listener(cm.on_task_switch)],
+            ]),
+        };
+        return this.#backend;
+    }
+}
+
+interface TaskEvent {
+    time: number;
+    kind: TaskEventKind;
+    threadId: number;
+    job: NativePointer;
+    data: NativePointer;
+    dataType: NativePointer;
+}
+
+function readEventSeq(event: NativePointer): number {
+    return event.add(OFFSETOF_EVENT_SEQ).readU64().toNumber();
+}
+
+function decodeEvent(event: NativePointer): TaskEvent {
+    return {
+        time: event.add(OFFSETOF_EVENT_TIME).readU64().toNumber(),
+        kind: event.add(OFFSETOF_EVENT_KIND).readU32() as TaskEventKind,
+        threadId: event.add(OFFSETOF_EVENT_THREAD_ID).readU32(),
+        job: event.add(OFFSETOF_EVENT_JOB).readPointer(),
+        data: event.add(OFFSETOF_EVENT_DATA).readPointer(),
+        dataType: event.add(OFFSETOF_EVENT_DATA_TYPE).readPointer(),
+    };
+}
+
+/**
+ * Marks the entry as the most recently seen, evicting the least recently
+ * seen one if there are too many, relying on Maps iterating in insertion
+ * order.
+ */
+function track<V>(entries: Map<string, V>, key: string, value: V) {
+    entries.delete(key);
+    entries.set(key, value);
+
+    if (entries.size > MAX_TRACKED_TASKS) {
+        entries.delete(entries.keys().next().value);
+    }
+}
+
+function getConcurrencyModule(): Module {
+    const name =
+        Process.platform === "darwin"
+            ? "libswift_Concurrency.dylib"
+            : "libswift_Concurrency.so";
+    const module = Process.findModuleByName(name);
+
+    if (module === null) {
+        throw new Error("The Swift concurrency runtime isn't loaded");
+    }
+
+    return module;
+}
+
+function summarizeLatency(histogram: LatencyHistogram): LatencySummary {
+    return {
+        count: histogram.count,
+        totalMs: histogram.totalNs / 1e6,
+        meanUs: histogram.meanNs / 1e3,
+        p50Us: histogram.percentile(50) / 1e3,
+        p90Us: histogram.percentile(90) / 1e3,
+        p99Us: histogram.percentile(99) / 1e3,
+        maxUs: histogram.maxNs / 1e3,
+    };
+}
+
+export const taskTracer = new TaskTracer();
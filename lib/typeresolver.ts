@@ -0,0 +1,297 @@
+/**
+ * Type metadata lookups by mangled name through the Swift runtime, for the
+ * types the index can't name: generic instantiations, tuples, and types whose
+ * descriptors live in images that weren't indexed. Demangled names are
+ * mangled back, nominal types by their descriptor, and the runtime does the
+ * rest.
+ *
+ * Lookups are memoized in a single cache, keyed by both mangled and demangled
+ * name as the two never collide: demangled names are module-qualified, and
+ * there's no '.' in the mangling alphabet.
+ *
+ * TODO:
+ *  - Mangle function types, labelled tuples and nested generic types
+ */
+
+import { TargetMetadata } from "../abi/metadata.js";
+import { getApi } from "./api.js";
+import { findTypeDescriptor } from "./macho.js";
+import { counters, registerCacheSize } from "./stats.js";
+import { mangleContextDescriptor } from "./symbols.js";
+
+/* Standard substitutions, see docs/ABI/Mangling.rst */
+const STANDARD_TYPES: Record<string, string> = {
+    "Swift.Array": "Sa",
+    "Swift.Bool": "Sb",
+    "Swift.Character": "SJ",
+    "Swift.Dictionary": "SD",
+    "Swift.Double": "Sd",
+    "Swift.Float": "Sf",
+    "Swift.Int": "Si",
+    "Swift.Optional": "Sq",
+    "Swift.Set": "Sh",
+    "Swift.String": "SS",
+    "Swift.Substring": "Ss",
+    "Swift.UInt": "Su",
+    "Swift.UnsafeMutablePointer": "Sp",
+    "Swift.UnsafeMutableRawPointer": "Sv",
+    "Swift.UnsafePointer": "SP",
+    "Swift.UnsafeRawPointer": "SV",
+};
+
+const typeCache = new Map<string, TargetMetadata>();
+
+registerCacheSize("typesByName", () => typeCache.size);
+
+/**
+ * @param typeName a demangled name, e.g. Swift.Optional<Swift.Int>, or a
+ * mangled one without its symbol prefix, e.g. SiSg
+ */
+export function metadataForTypeName(typeName: string): TargetMetadata {
+    /* Mangled names share their key with metadataForMangledName()'s, which
+    caches failed lookups as null */
+    let metadata = typeCache.get(typeName);
+    if (metadata !== undefined && metadata !== null) {
+        counters.metadata.cache.hits++;
+        return metadata;
+    }
+
+    const mangled = isMangledTypeName(typeName)
+        ? typeName
+        : mangleTypeName(typeName);
+    metadata = metadataForMangledName(mangled);
+
+    if (metadata === null) {
+        throw new Error("Type not found: " + typeName);
+    }
+
+    typeCache.set(typeName, metadata);
+    return metadata;
+}
+
+/**
+ * @param mangled a mangled name, or a pointer to one as found in field
+ * records, which may hold symbolic references relative to where it lives
+ * @param context descriptor of the context the name is to be resolved in,
+ * required for names referring to generic parameters
+ * @returns null if the runtime can't resolve the name
+ */
+export function metadataForMangledName(
+    mangled: string | NativePointer,
+    context: NativePointer = NULL,
+    genericArgs: NativePointer = NULL
+): TargetMetadata {
+    const key =
+        typeof mangled === "string"
+            ? mangled
+            : `@${mangled}:${context}:${genericArgs}`;
+
+    if (typeCache.has(key)) {
+        counters.metadata.cache.hits++;
+        return typeCache.get(key);
+    }
+
+    counters.metadata.cache.misses++;
+    counters.metadata.runtimeLookups++;
+
+    let name: NativePointer;
+    let length: number;
+
+    if (typeof mangled === "string") {
+        name = Memory.allocUtf8String(mangled);
+        length = mangled.length;
+    } else {
+        name = mangled;
+        length = getMangledNameLength(mangled);
+    }
+
+    const handle = getApi().swift_getTypeByMangledNameInContext(
+        name,
+        length,
+        context,
+        genericArgs
+    ) as NativePointer;
+    const metadata = handle.isNull() ? null : TargetMetadata.from(handle);
+
+    typeCache.set(key, metadata);
+    return metadata;
+}
+
+/* Names pointing into images embed 4-byte relative and pointer-sized absolute
+references, either of which may contain NUL bytes. */
+function getMangledNameLength(name: NativePointer): number {
+    let length = 0;
+
+    for (let value = name.readU8(); value !== 0; value = name.add(length).readU8()) {
+        if (value >= 0x01 && value <= 0x17) {
+            length += 1 + 4;
+        } else if (value >= 0x18 && value <= 0x1f) {
+            length += 1 + Process.pointerSize;
+        } else {
+            length++;
+        }
+    }
+
+    return length;
+}
+
+function isMangledTypeName(typeName: string): boolean {
+    return /^[A-Za-z0-9_$]+$/.test(typeName) && !/^\d/.test(typeName);
+}
+
+/**
+ * Mangles demangled type names as printed by swift_demangle(), with or
+ * without sugar, e.g. Swift.Dictionary<Swift.String, [Swift.Int?]>.
+ */
+export function mangleTypeName(typeName: string): string {
+    const parser = new TypeNameParser(typeName);
+    const mangled = parser.parseType();
+
+    if (!parser.atEnd()) {
+        throw new Error(`Can't mangle ${typeName}: unsupported syntax`);
+    }
+
+    return mangled;
+}
+
+class TypeNameParser {
+    #pos = 0;
+
+    constructor(readonly source: string) {}
+
+    atEnd(): boolean {
+        this.skipSpaces();
+        return this.#pos === this.source.length;
+    }
+
+    parseType(): string {
+        let mangled = this.parsePrimary();
+
+        while (this.accept("?")) {
+            mangled += "Sg";
+        }
+
+        this.skipSpaces();
+        if (this.source.startsWith("->", this.#pos)) {
+            this.fail("function types aren't supported");
+        }
+
+        return mangled;
+    }
+
+    private parsePrimary(): string {
+        if (this.accept("(")) {
+            const elements = this.parseList(")");
+            switch (elements.length) {
+                case 0:
+                    return "yt";
+                case 1:
+                    return elements[0];
+                default:
+                    return elements[0] + "_" + elements.slice(1).join("") + "t";
+            }
+        }
+
+        if (this.accept("[")) {
+            const element = this.parseType();
+
+            if (this.accept(":")) {
+                const value = this.parseType();
+                this.expect("]");
+                return "SDy" + element + value + "G";
+            }
+
+            this.expect("]");
+            return "Say" + element + "G";
+        }
+
+        const name = this.parseQualifiedName();
+        const nominal = mangleNominalTypeName(name);
+
+        if (this.accept("<")) {
+            const args = this.parseList(">");
+            return nominal + "y" + args.join("") + "G";
+        }
+
+        return nominal;
+    }
+
+    private parseList(terminator: string): string[] {
+        const elements: string[] = [];
+
+        if (this.accept(terminator)) {
+            return elements;
+        }
+
+        do {
+            elements.push(this.parseType());
+        } while (this.accept(","));
+
+        this.expect(terminator);
+        return elements;
+    }
+
+    private parseQualifiedName(): string {
+        this.skipSpaces();
+
+        const match = /^[A-Za-z_][\w.]*/.exec(this.source.substring(this.#pos));
+        if (match === null) {
+            this.fail("expected a type name");
+        }
+
+        this.#pos += match[0].length;
+
+        /* Labelled tuple elements */
+        if (this.source[this.#pos] === ":" && this.source[this.#pos + 1] === " ") {
+            this.fail("labelled tuples aren't supported");
+        }
+
+        return match[0];
+    }
+
+    private accept(token: string): boolean {
+        this.skipSpaces();
+
+        if (this.source.startsWith(token, this.#pos)) {
+            this.#pos += token.length;
+            return true;
+        }
+
+        return false;
+    }
+
+    private expect(token: string) {
+        if (!this.accept(token)) {
+            this.fail(`expected '${token}'`);
+        }
+    }
+
+    private skipSpaces() {
+        while (this.source[this.#pos] === " ") {
+            this.#pos++;
+        }
+    }
+
+    private fail(reason: string): never {
+        throw new Error(`Can't mangle ${this.source}: ${reason}`);
+    }
+}
+
+function mangleNominalTypeName(name: string): string {
+    const standard = STANDARD_TYPES[name];
+    if (standard !== undefined) {
+        return standard;
+    }
+
+    const descriptor = findTypeDescriptor(name);
+    const mangled =
+        descriptor === undefined
+            ? undefined
+            : mangleContextDescriptor(descriptor.handle);
+
+    if (mangled === undefined) {
+        throw new Error(`Can't mangle ${name}: unknown type`);
+    }
+
+    return mangled;
+}
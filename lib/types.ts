@@ -24,10 +24,11 @@ import {
 import {
     parseSwiftAccessorSignature,
     parseSwiftMethodSignature,
-    tryDemangleSymbol,
+    resolveSymbolicReferences,
     tryParseSwiftMethodSignature,
 } from "../lib/symbols.js";
 import { makeSwiftNativeFunction } from "./callingconvention.js";
+import { metadataForMangledName } from "./typeresolver.js";
 import { HeapObject } from "../runtime/heapobject.js";
 import { RawFields, makeBufferFromValue } from "./buffer.js";
 import {
@@ -38,7 +39,13 @@ import {
     untypedMetadataFor,
 } from "./macho.js";
 import { FieldDescriptor } from "../reflection/records.js";
-import { RelativeDirectPointer } from "../basic/relativepointer.js";
+import { allocValueMemory, registerCacheSize } from "./stats.js";
+import { getValueIdentityPlan } from "./valueidentity.js";
+import { makeStructValue } from "./structbuilder.js";
+import {
+    makeStoredProperties,
+    StoredProperties,
+} from "./storedproperties.js";
 import {
     ClassExistentialContainer,
     TargetOpaqueExistentialContainer,
@@ -146,6 +153,14 @@ export class Struct extends Type {
             TargetStructMetadata
         );
     }
+
+    /**
+     * Builds a value from all of its stored properties, e.g.
+     * `Point.make({ x: 1, y: 2 })`, see makeStructValue().
+     */
+    make(fields: Record<string, any>): StructValue {
+        return makeStructValue(this.$metadata, fields);
+    }
 }
 
 /* TODO: handle "default" protocol witnesses? See OnOffSwitch for an example */
@@ -277,10 +292,15 @@ export abstract class RuntimeInstance {
     abstract readonly $metadata: TargetMetadata;
     abstract readonly handle: NativePointer;
 
+    /* By identity, values overriding it to compare by content */
     equals(other: RuntimeInstance): boolean {
         return this.handle.equals(other.handle);
     }
 
+    hash(): string {
+        return this.handle.toString();
+    }
+
     toJSON() {
         return {
             handle: this.handle,
@@ -340,8 +360,9 @@ export abstract class ValueInstance extends RuntimeInstance {
         src: NativePointer,
         metadata: TargetValueMetadata
     ): ValueInstance {
-        const dest = Memory.alloc(metadata.getTypeLayout().stride);
-        metadata.vw_initializeWithCopy(dest, src);
+        const plan = metadata.getCopyPlan();
+        const dest = allocValueMemory(plan.stride);
+        plan.initializeWithCopy(dest, src);
 
         if (metadata.getKind() === MetadataKind.Struct) {
             return new StructValue(metadata as TargetStructMetadata, {
@@ -387,6 +408,111 @@ export abstract class ValueInstance extends RuntimeInstance {
     }
 }
 
+/**
+ * Values of the same type laid out contiguously, as in a Swift array's
+ * storage, copied in one go and wrapped as ValueInstances only when accessed.
+ */
+export class ValueArray {
+    /* Elements of Swift arrays start right after the storage's header */
+    static readonly OFFSETOF_ARRAY_STORAGE_COUNT = Process.pointerSize * 2;
+    static readonly OFFSETOF_ARRAY_STORAGE_ELEMENTS = Process.pointerSize * 4;
+
+    readonly stride: number;
+
+    #elements: ValueInstance[] = [];
+
+    constructor(
+        readonly $metadata: TargetValueMetadata,
+        readonly handle: NativePointer,
+        readonly length: number
+    ) {
+        this.stride = $metadata.getCopyPlan().stride;
+    }
+
+    static fromCopy(
+        src: NativePointer,
+        type: Struct | Enum | TargetValueMetadata,
+        count: number
+    ): ValueArray {
+        const metadata = getValueMetadata(type);
+        const stride = metadata.getCopyPlan().stride;
+        const dest = allocValueMemory(Math.max(count * stride, 1));
+        metadata.vw_initializeArrayWithCopy(dest, src, count);
+        return new ValueArray(metadata, dest, count);
+    }
+
+    /**
+     * @param storage a native Swift array's buffer, i.e. not a bridged one
+     */
+    static fromSwiftArrayStorage(
+        storage: NativePointer,
+        type: Struct | Enum | TargetValueMetadata
+    ): ValueArray {
+        const metadata = getValueMetadata(type);
+        const count = storage
+            .add(ValueArray.OFFSETOF_ARRAY_STORAGE_COUNT)
+            .readU64()
+            .toNumber();
+        const alignMask = metadata.getValueWitnesses().getAlignmentMask();
+        const offset =
+            (ValueArray.OFFSETOF_ARRAY_STORAGE_ELEMENTS + alignMask) &
+            ~alignMask;
+
+        return ValueArray.fromCopy(storage.add(offset), metadata, count);
+    }
+
+    get(index: number): ValueInstance {
+        if (index < 0 || index >= this.length) {
+            throw new Error(`Index out of bounds: ${index}`);
+        }
+
+        let element = this.#elements[index];
+        if (element === undefined) {
+            element = ValueInstance.fromAdopted(
+                this.handle.add(index * this.stride),
+                this.$metadata
+            );
+            this.#elements[index] = element;
+        }
+
+        return element;
+    }
+
+    *[Symbol.iterator](): IterableIterator<ValueInstance> {
+        for (let i = 0; i !== this.length; i++) {
+            yield this.get(i);
+        }
+    }
+
+    toArray(): ValueInstance[] {
+        return Array.from(this);
+    }
+
+    /**
+     * Releases whatever the elements hold on to, after which neither they nor
+     * the views handed out may be used.
+     */
+    dispose(): void {
+        this.$metadata.vw_destroyArray(this.handle, this.length);
+        this.#elements = [];
+    }
+
+    toJSON() {
+        return {
+            handle: this.handle,
+            length: this.length,
+        };
+    }
+}
+
+function getValueMetadata(
+    type: Struct | Enum | TargetValueMetadata
+): TargetValueMetadata {
+    return type instanceof Type
+        ? (type.$metadata as TargetValueMetadata)
+        : type;
+}
+
 interface StructValueConstructionOptions {
     raw?: RawFields;
     handle?: NativePointer;
@@ -409,8 +535,37 @@ export class StructValue implements ValueInstance {
         this.handle = options.handle || makeBufferFromValue(options.raw);
     }
 
-    equals(other: StructValue): boolean {
-        return this.handle.equals(other.handle);
+    /**
+     * By content, through the type's Equatable witness unless it's POD.
+     */
+    equals(other: RuntimeInstance): boolean {
+        if (!this.$metadata.handle.equals(other.$metadata.handle)) {
+            return false;
+        }
+
+        if (this.handle.equals(other.handle)) {
+            return true;
+        }
+
+        const { equals } = getValueIdentityPlan(this.$metadata);
+        if (equals === null) {
+            throw new Error(
+                `Can't compare values of ${this.$metadata.getFullTypeName()}: neither POD nor Equatable`
+            );
+        }
+
+        return equals(this.handle, other.handle);
+    }
+
+    hash(): string {
+        const { hash } = getValueIdentityPlan(this.$metadata);
+        if (hash === null) {
+            throw new Error(
+                `Can't hash values of ${this.$metadata.getFullTypeName()}: neither POD nor Hashable`
+            );
+        }
+
+        return hash(this.handle);
     }
 
     toJSON() {
@@ -427,6 +582,88 @@ interface EnumValueConstructionOptions {
     raw?: RawFields;
 }
 
+/**
+ * What EnumValue needs to know about an enum's cases, built once per enum
+ * metadata rather than reflected on every value construction.
+ */
+export class EnumCaseTable {
+    private static tables = new Map<string, EnumCaseTable>();
+
+    readonly descriptor: TargetEnumDescriptor;
+    /* In tag order: payload cases come first */
+    readonly cases: FieldDetails[];
+    readonly numPayloadCases: number;
+    readonly numEmptyCases: number;
+    readonly numCases: number;
+
+    #payloadTypes: TargetMetadata[] = [];
+
+    private constructor(readonly metadata: TargetEnumMetadata) {
+        this.descriptor = metadata.getDescription();
+        this.cases = getFieldsDetails(this.descriptor) ?? [];
+        this.numPayloadCases = this.descriptor.getNumPayloadCases();
+        this.numEmptyCases = this.descriptor.getNumEmptyCases();
+        this.numCases = this.numPayloadCases + this.numEmptyCases;
+    }
+
+    static of(metadata: TargetEnumMetadata): EnumCaseTable {
+        const key = metadata.handle.toString();
+
+        let table = EnumCaseTable.tables.get(key);
+        if (table === undefined) {
+            table = new EnumCaseTable(metadata);
+            EnumCaseTable.tables.set(key, table);
+        }
+
+        return table;
+    }
+
+    static get size(): number {
+        return EnumCaseTable.tables.size;
+    }
+
+    isPayloadTag(tag: number): boolean {
+        return tag < this.numPayloadCases;
+    }
+
+    getCaseName(tag: number): string {
+        return this.cases[tag]?.name;
+    }
+
+    getPayloadTypeName(tag: number): string {
+        return this.cases[tag].typeName;
+    }
+
+    /**
+     * Resolved on first use, as most cases of most enums never are. Payloads
+     * of generic enums, e.g. Optional's `some`, are mangled as generic
+     * parameters, hence the instantiation's generic arguments.
+     */
+    getPayloadType(tag: number): TargetMetadata {
+        let metadata = this.#payloadTypes[tag];
+
+        if (metadata === undefined) {
+            const mangledTypeName = this.cases[tag].mangledTypeName;
+            metadata =
+                mangledTypeName === undefined
+                    ? null
+                    : metadataForMangledName(
+                          mangledTypeName,
+                          this.descriptor.handle,
+                          this.metadata.getGenericArguments()
+                      );
+            if (metadata === null) {
+                metadata = untypedMetadataFor(this.getPayloadTypeName(tag));
+            }
+            this.#payloadTypes[tag] = metadata;
+        }
+
+        return metadata;
+    }
+}
+
+registerCacheSize("enumCaseTables", () => EnumCaseTable.size);
+
 export class EnumValue implements ValueInstance {
     readonly $metadata: TargetEnumMetadata;
     readonly handle: NativePointer;
@@ -440,8 +677,8 @@ export class EnumValue implements ValueInstance {
         options: EnumValueConstructionOptions
     ) {
         this.$metadata = type instanceof Enum ? type.$metadata : type;
-        this.descriptor = this.$metadata.getDescription();
-        const fields = getFieldsDetails(this.descriptor);
+        const cases = EnumCaseTable.of(this.$metadata);
+        this.descriptor = cases.descriptor;
 
         if (
             options.tag === undefined &&
@@ -456,25 +693,25 @@ export class EnumValue implements ValueInstance {
         if (options.tag !== undefined) {
             const tag = options.tag;
             const payload = options.payload;
-            const stride = this.$metadata.getTypeLayout().stride;
+            const stride = this.$metadata.getCopyPlan().stride;
             /**
              * FIXME: rather than rounding the stride, we should be reading only
              * the stride's worth of data when handling a value of this type.
              */
             const size =
                 stride < Process.pointerSize ? Process.pointerSize : stride;
-            this.handle = Memory.alloc(size);
+            this.handle = allocValueMemory(size);
 
-            if (tag === undefined || tag >= this.descriptor.getNumCases()) {
+            if (tag === undefined || tag >= cases.numCases) {
                 throw new Error("Invalid tag for an enum of this type");
             }
 
-            if (this.descriptor.isPayloadTag(tag)) {
+            if (cases.isPayloadTag(tag)) {
                 if (payload === undefined) {
                     throw new Error("Payload must be provided for this tag");
                 }
 
-                const typeName = fields[tag].typeName;
+                const typeName = cases.getPayloadTypeName(tag);
 
                 if (payload.$metadata.getFullTypeName() !== typeName) {
                     throw new Error("Payload must be of type " + typeName);
@@ -488,7 +725,7 @@ export class EnumValue implements ValueInstance {
                         this.handle,
                         payload.$metadata as TargetValueMetadata
                     );
-                    this.$metadata.vw_initializeWithCopy(
+                    payload.$metadata.vw_initializeWithCopy(
                         this.handle,
                         payload.handle
                     );
@@ -502,18 +739,20 @@ export class EnumValue implements ValueInstance {
             const tag = this.$metadata.vw_getEnumTag(this.handle);
             let payload: RuntimeInstance;
 
-            if (tag >= this.descriptor.getNumCases()) {
+            if (tag >= cases.numCases) {
                 throw new Error("Invalid pointer for an enum of this type");
             }
 
-            if (this.descriptor.isPayloadTag(tag)) {
-                const typeName = fields[tag].typeName;
-                /* FIXME: metadata should be TargetMetadata, but it's abstract and TS disallows it */
-                const typeMetadata = metadataFor(typeName, TargetValueMetadata);
-                payload = RuntimeInstance.fromAdopted(
-                    this.handle,
-                    typeMetadata
-                );
+            if (cases.isPayloadTag(tag)) {
+                const typeMetadata = cases.getPayloadType(tag);
+
+                /* Class payloads are stored as a reference to the object */
+                payload = typeMetadata.isClassObject()
+                    ? new ObjectInstance(this.handle.readPointer())
+                    : ValueInstance.fromAdopted(
+                          this.handle,
+                          typeMetadata as TargetValueMetadata
+                      );
             }
 
             this.#tag = tag;
@@ -529,19 +768,46 @@ export class EnumValue implements ValueInstance {
         return this.#payload;
     }
 
-    equals(e: EnumValue): boolean {
-        let result = false;
+    /**
+     * By content, through the enum's Equatable witness unless it's POD, and
+     * otherwise by tag and payload.
+     */
+    equals(other: RuntimeInstance): boolean {
+        if (
+            !(other instanceof EnumValue) ||
+            !this.$metadata.handle.equals(other.$metadata.handle)
+        ) {
+            return false;
+        }
+
+        const { equals } = getValueIdentityPlan(this.$metadata);
+        if (equals !== null) {
+            return equals(this.handle, other.handle);
+        }
+
+        if (this.$tag !== other.$tag) {
+            return false;
+        }
+
+        if (!EnumCaseTable.of(this.$metadata).isPayloadTag(this.$tag)) {
+            return true;
+        }
+
+        return this.$payload.equals(other.$payload);
+    }
 
-        if (this.$tag !== undefined && e.$tag !== undefined) {
-            result = this.$tag === e.$tag;
+    hash(): string {
+        const { equals, hash } = getValueIdentityPlan(this.$metadata);
+        if (hash !== null) {
+            return hash(this.handle);
         }
 
-        if (this.$payload !== undefined && e.$payload !== undefined) {
-            /* TODO: handle value type equality properly */
-            result &&= this.$payload.handle.equals(e.$payload.handle);
+        /* Only consistent with payload equality if that's what's compared */
+        if (equals !== null || this.#payload === undefined) {
+            return this.#tag.toString();
         }
 
-        return result;
+        return this.#tag + ":" + this.#payload.hash();
     }
 
     toJSON() {
@@ -557,6 +823,7 @@ export class ObjectInstance extends RuntimeInstance {
     readonly $metadata: TargetClassMetadata;
 
     #heapObject: HeapObject;
+    #stored: StoredProperties;
 
     constructor(readonly handle: NativePointer) {
         super();
@@ -630,11 +897,24 @@ export class ObjectInstance extends RuntimeInstance {
             }
         }
     }
+
+    /**
+     * Stored properties read from and written to the object's memory, which
+     * unlike the accessors above doesn't call into Swift code.
+     */
+    get $stored(): StoredProperties {
+        if (this.#stored === undefined) {
+            this.#stored = makeStoredProperties(this);
+        }
+
+        return this.#stored;
+    }
 }
 
 interface FieldDetails {
     name: string;
     typeName?: string;
+    mangledTypeName?: NativePointer;
     isVar?: boolean;
 }
 
@@ -652,8 +932,25 @@ interface MethodDetails {
     type: MethodType;
 }
 
+/* Per descriptor, shared by the type wrappers and EnumCaseTable */
+const fieldsDetails = new Map<string, FieldDetails[]>();
+
 function getFieldsDetails(
     descriptor: TargetTypeContextDescriptor
+): FieldDetails[] {
+    const key = descriptor.handle.toString();
+
+    if (fieldsDetails.has(key)) {
+        return fieldsDetails.get(key);
+    }
+
+    const result = reflectFieldsDetails(descriptor);
+    fieldsDetails.set(key, result);
+    return result;
+}
+
+export function reflectFieldsDetails(
+    descriptor: TargetTypeContextDescriptor
 ): FieldDetails[] {
     const result: FieldDetails[] = [];
 
@@ -668,12 +965,16 @@ function getFieldsDetails(
 
     const fields = fieldsDescriptor.getFields();
     for (const f of fields) {
+        const mangledTypeName =
+            f.mangledTypeName === null ? undefined : f.mangledTypeName.get();
+
         result.push({
             name: f.fieldName,
             typeName:
-                f.mangledTypeName === null
+                mangledTypeName === undefined
                     ? undefined
-                    : resolveSymbolicReferences(f.mangledTypeName.get()),
+                    : resolveSymbolicReferences(mangledTypeName),
+            mangledTypeName,
             isVar: f.isVar,
         });
     }
@@ -681,12 +982,19 @@ function getFieldsDetails(
     return result;
 }
 
-function getMethodsDetails(descriptor: TargetClassDescriptor): MethodDetails[] {
+/**
+ * @param symbolicate defaults to the cached lookup, which the registry export
+ * swaps for an uncached one so that its memory use stays bounded
+ */
+export function getMethodsDetails(
+    descriptor: TargetClassDescriptor,
+    symbolicate: (address: NativePointer) => string = findDemangledSymbol
+): MethodDetails[] {
     const result: MethodDetails[] = [];
 
     for (const methDesc of descriptor.getMethodDescriptors()) {
         const address = methDesc.impl.get();
-        const name = findDemangledSymbol(address);
+        const name = symbolicate(address);
         const kind = methDesc.flags.getKind();
         let type: MethodType;
 
@@ -722,39 +1030,3 @@ function getMethodsDetails(descriptor: TargetClassDescriptor): MethodDetails[] {
 
     return result;
 }
-
-function resolveSymbolicReferences(symbol: NativePointer): string {
-    const base = symbol;
-    let end = base;
-    let endValue = end.readU8();
-    let contextDescriptor: TargetTypeContextDescriptor | null = null;
-
-    while (endValue !== 0) {
-        if (endValue >= 0x01 && endValue <= 0x17) {
-            end = end.add(1);
-
-            if (endValue === 0x01) {
-                contextDescriptor = new TargetTypeContextDescriptor(
-                    RelativeDirectPointer.From(end).get()
-                );
-            } else if (endValue === 0x02) {
-                let p = RelativeDirectPointer.From(end).get().readPointer();
-                p = p.and(0x7ffffffffff); // TODO: strip PAC
-
-                contextDescriptor = new TargetTypeContextDescriptor(p);
-            }
-            break;
-        } else if (endValue >= 0x18 && endValue <= 0x1f) {
-            throw new Error("UNIMPLEMENTED 0x18 - 0x1F");
-        }
-
-        end = end.add(1);
-        endValue = end.readU8();
-    }
-
-    if (contextDescriptor !== null) {
-        return contextDescriptor.name;
-    }
-
-    return tryDemangleSymbol("_$s" + symbol.readCString());
-}
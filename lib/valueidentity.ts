@@ -0,0 +1,320 @@
+/**
+ * Value semantics for StructValue and EnumValue: equality and hashing by
+ * content rather than by address, and ValueMap and ValueSet keyed by them,
+ * for deduplicating values observed in hooks without shipping each one to
+ * the host.
+ *
+ * POD types are compared and hashed by their bytes, read in one go, which is
+ * their `==` except for floating-point fields (-0.0, NaN) and padding. Other
+ * types go through their Equatable and Hashable witnesses.
+ *
+ * TODO:
+ *  - Resolve the conformances of generic instantiations through the runtime
+ *  - Retain object keys, which are only compared by identity
+ */
+
+import { TargetMetadata, TargetValueMetadata } from "../abi/metadata.js";
+import { SwiftcallNativeFunction } from "./callingconvention.js";
+import { getProtocolConformancesFor } from "./macho.js";
+import { registerCacheSize } from "./stats.js";
+import { RuntimeInstance, ValueInstance } from "./types.js";
+
+/**
+ * How values of a type are compared and hashed, decided once per type from
+ * its value witness flags and conformances.
+ */
+export interface ValueIdentityPlan {
+    /** Null if the type is neither POD nor Equatable */
+    equals: ((a: NativePointer, b: NativePointer) => boolean) | null;
+    /**
+     * Hashes that are stable for the process' lifetime, equal for equal
+     * values, or null if the type is neither POD nor Hashable
+     */
+    hash: ((value: NativePointer) => string) | null;
+}
+
+/* Witness table slots, the conformance descriptor coming first */
+const EQUATABLE_EQUALS_SLOT = 1;
+/* After the Equatable base witness table */
+const HASHABLE_HASH_VALUE_SLOT = 2;
+
+const plans = new Map<string, ValueIdentityPlan>();
+
+registerCacheSize("valueIdentityPlans", () => plans.size);
+
+export function getValueIdentityPlan(
+    metadata: TargetValueMetadata
+): ValueIdentityPlan {
+    const key = metadata.handle.toString();
+
+    let plan = plans.get(key);
+    if (plan === undefined) {
+        plan = makeValueIdentityPlan(metadata);
+        plans.set(key, plan);
+    }
+
+    return plan;
+}
+
+function makeValueIdentityPlan(
+    metadata: TargetValueMetadata
+): ValueIdentityPlan {
+    const { isPOD, size } = metadata.getCopyPlan();
+
+    if (isPOD) {
+        return {
+            equals(a, b) {
+                return bytesEqual(a.readByteArray(size), b.readByteArray(size));
+            },
+            hash(value) {
+                return toHex(value.readByteArray(size));
+            },
+        };
+    }
+
+    let conformances;
+    try {
+        conformances = getProtocolConformancesFor(metadata.getFullTypeName());
+    } catch (e) {
+        return { equals: null, hash: null };
+    }
+
+    return {
+        equals: makeEqualsWitnessCall(
+            metadata,
+            conformances.Equatable?.witnessTable
+        ),
+        hash: makeHashValueWitnessCall(
+            metadata,
+            conformances.Hashable?.witnessTable
+        ),
+    };
+}
+
+/**
+ * `static func == (lhs: Self, rhs: Self) -> Bool`, Self being opaque to the
+ * witness: both values are passed indirectly, the metatype as self, and Self's
+ * metadata and witness table last.
+ */
+function makeEqualsWitnessCall(
+    metadata: TargetMetadata,
+    witnessTable: NativePointer
+): ValueIdentityPlan["equals"] {
+    if (witnessTable === undefined || witnessTable === null) {
+        return null;
+    }
+
+    const witness = witnessTable
+        .add(EQUATABLE_EQUALS_SLOT * Process.pointerSize)
+        .readPointer()
+        .strip();
+    const equals = new SwiftcallNativeFunction(
+        witness,
+        "uint8",
+        ["pointer", "pointer", "pointer", "pointer"],
+        metadata.handle
+    ).wrapper;
+
+    return (a, b) => equals(a, b, metadata.handle, witnessTable) !== 0;
+}
+
+/**
+ * `var hashValue: Int { get }`, with self passed indirectly, through a slot
+ * as it differs from one call to the next.
+ */
+function makeHashValueWitnessCall(
+    metadata: TargetMetadata,
+    witnessTable: NativePointer
+): ValueIdentityPlan["hash"] {
+    if (witnessTable === undefined || witnessTable === null) {
+        return null;
+    }
+
+    const witness = witnessTable
+        .add(HASHABLE_HASH_VALUE_SLOT * Process.pointerSize)
+        .readPointer()
+        .strip();
+    const slot = Memory.alloc(Process.pointerSize);
+    const hashValue = new SwiftcallNativeFunction(
+        witness,
+        "int64",
+        ["pointer", "pointer"],
+        { slot }
+    ).wrapper;
+
+    return (value) => {
+        slot.writePointer(value);
+        return hashValue(metadata.handle, witnessTable).toString();
+    };
+}
+
+function bytesEqual(a: ArrayBuffer, b: ArrayBuffer): boolean {
+    const x = new Uint8Array(a);
+    const y = new Uint8Array(b);
+
+    for (let i = 0; i !== x.length; i++) {
+        if (x[i] !== y[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+function toHex(buffer: ArrayBuffer): string {
+    const bytes = new Uint8Array(buffer);
+    let result = "";
+
+    for (let i = 0; i !== bytes.length; i++) {
+        result += (bytes[i] < 0x10 ? "0" : "") + bytes[i].toString(16);
+    }
+
+    return result;
+}
+
+/**
+ * A map keyed by Swift values, compared with equals() and bucketed by hash(),
+ * i.e. by content for values and by identity for objects. Value keys are
+ * copied on insertion, so that those adopted from a hook's arguments outlive
+ * the call.
+ */
+export class ValueMap<V> {
+    #buckets = new Map<string, [RuntimeInstance, V][]>();
+    #size = 0;
+
+    get size(): number {
+        return this.#size;
+    }
+
+    has(key: RuntimeInstance): boolean {
+        return this.findEntry(key) !== undefined;
+    }
+
+    get(key: RuntimeInstance): V | undefined {
+        return this.findEntry(key)?.[1];
+    }
+
+    set(key: RuntimeInstance, value: V): this {
+        const hash = hashKeyOf(key);
+        let bucket = this.#buckets.get(hash);
+        if (bucket === undefined) {
+            bucket = [];
+            this.#buckets.set(hash, bucket);
+        }
+
+        const entry = bucket.find(([k]) => k.equals(key));
+        if (entry !== undefined) {
+            entry[1] = value;
+            return this;
+        }
+
+        const copy = key.$metadata.isClassObject()
+            ? key
+            : ValueInstance.fromCopy(
+                  key.handle,
+                  key.$metadata as TargetValueMetadata
+              );
+        bucket.push([copy, value]);
+        this.#size++;
+        return this;
+    }
+
+    delete(key: RuntimeInstance): boolean {
+        const hash = hashKeyOf(key);
+        const bucket = this.#buckets.get(hash);
+        if (bucket === undefined) {
+            return false;
+        }
+
+        const index = bucket.findIndex(([k]) => k.equals(key));
+        if (index === -1) {
+            return false;
+        }
+
+        bucket.splice(index, 1);
+        if (bucket.length === 0) {
+            this.#buckets.delete(hash);
+        }
+        this.#size--;
+        return true;
+    }
+
+    clear() {
+        this.#buckets.clear();
+        this.#size = 0;
+    }
+
+    *entries(): IterableIterator<[RuntimeInstance, V]> {
+        for (const bucket of this.#buckets.values()) {
+            for (const [key, value] of bucket) {
+                yield [key, value];
+            }
+        }
+    }
+
+    *keys(): IterableIterator<RuntimeInstance> {
+        for (const [key] of this.entries()) {
+            yield key;
+        }
+    }
+
+    *values(): IterableIterator<V> {
+        for (const [, value] of this.entries()) {
+            yield value;
+        }
+    }
+
+    [Symbol.iterator](): IterableIterator<[RuntimeInstance, V]> {
+        return this.entries();
+    }
+
+    private findEntry(key: RuntimeInstance): [RuntimeInstance, V] | undefined {
+        const bucket = this.#buckets.get(hashKeyOf(key));
+        return bucket?.find(([k]) => k.equals(key));
+    }
+}
+
+export class ValueSet {
+    #map = new ValueMap<true>();
+
+    get size(): number {
+        return this.#map.size;
+    }
+
+    /**
+     * @returns whether the value wasn't in the set yet, as deduplicating
+     * hooks usually want to know
+     */
+    add(value: RuntimeInstance): boolean {
+        if (this.#map.has(value)) {
+            return false;
+        }
+
+        this.#map.set(value, true);
+        return true;
+    }
+
+    has(value: RuntimeInstance): boolean {
+        return this.#map.has(value);
+    }
+
+    delete(value: RuntimeInstance): boolean {
+        return this.#map.delete(value);
+    }
+
+    clear() {
+        this.#map.clear();
+    }
+
+    values(): IterableIterator<RuntimeInstance> {
+        return this.#map.keys();
+    }
+
+    [Symbol.iterator](): IterableIterator<RuntimeInstance> {
+        return this.values();
+    }
+}
+
+function hashKeyOf(key: RuntimeInstance): string {
+    return key.$metadata.handle.toString() + ":" + key.hash();
+}
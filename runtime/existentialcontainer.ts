@@ -6,6 +6,7 @@ import {
     TargetValueMetadata,
 } from "../abi/metadata.js";
 import { HeapObject } from "./heapobject.js";
+import { allocValueMemory } from "../lib/stats.js";
 
 export class TargetOpaqueExistentialContainer {
     static readonly INITIAL_SIZE = 4 * Process.pointerSize;
@@ -27,7 +28,7 @@ export class TargetOpaqueExistentialContainer {
         const size =
             TargetOpaqueExistentialContainer.INITIAL_SIZE +
             numWitnessTables * Process.pointerSize;
-        const buf = Memory.alloc(size);
+        const buf = allocValueMemory(size);
         return new TargetOpaqueExistentialContainer(buf, numWitnessTables);
     }
 
@@ -121,7 +122,7 @@ export class ClassExistentialContainer {
         const size =
             ClassExistentialContainer.INITIAL_SIZE +
             numWitnessTables * Process.pointerSize;
-        const buf = Memory.alloc(size);
+        const buf = allocValueMemory(size);
         return new ClassExistentialContainer(buf, numWitnessTables);
     }
 
@@ -16,6 +16,7 @@
 TESTLIST_BEGIN (basics)
     TESTENTRY (modules_can_be_enumerated)
     TESTENTRY (types_can_be_enumerated)
+    TESTENTRY (elf_sections_can_be_found)
     TESTENTRY (swiftcall_with_context)
     TESTENTRY (swiftcall_with_indirect_argument)
     TESTENTRY (swiftcall_with_indirect_result)
@@ -26,10 +27,16 @@ TESTLIST_BEGIN (basics)
     TESTENTRY (class_instance_can_be_initialized)
     TESTENTRY (class_instance_methods_can_be_called)
     TESTENTRY (class_instance_properties_can_be_gotten_and_set)
+    TESTENTRY (class_instance_stored_properties_can_be_read_and_written)
+    TESTENTRY (class_instance_stored_references_are_handled_safely)
     TESTENTRY (class_instance_can_be_passed_to_and_returned_from_function)
     TESTENTRY (swiftcall_multipayload_enum_can_be_passed_to_function)
     TESTENTRY (swiftcall_multipayload_enum_can_be_returned_from_function)
     TESTENTRY (opaque_existential_inline_can_be_passed_to_function)
+    TESTENTRY (opaque_existential_witness_tables_are_resolved_once)
+    TESTENTRY (pod_values_are_copied_without_value_witnesses)
+    TESTENTRY (value_arrays_are_copied_in_one_go)
+    TESTENTRY (value_arrays_of_non_pod_types_retain_and_release)
     TESTENTRY (opaque_existential_inline_can_be_returned_from_function)
     TESTENTRY (opaque_existential_outofline_can_be_passed_to_function)
     TESTENTRY (opaque_existential_outofline_can_be_returned_from_function)
@@ -45,15 +52,30 @@ TESTLIST_BEGIN (basics)
     TESTENTRY (singlepayload_enum_data_case_can_be_made_from_raw)
     TESTENTRY (singlepayload_enum_data_case_can_be_made_ad_hoc)
     TESTENTRY (singlepayload_enum_equals_works)
+    TESTENTRY (values_can_be_deduplicated_by_content)
+    TESTENTRY (struct_values_can_be_made_from_fields)
     TESTENTRY (multipayload_enum_empty_case_can_be_made_from_raw)
     TESTENTRY (multipayload_enum_empty_case_can_be_gotten)
     TESTENTRY (multipayload_enum_data_case_can_be_made_from_raw)
     TESTENTRY (multipayload_enum_data_case_can_be_made_ad_hoc)
     TESTENTRY (multipayload_enum_equals_works)
+    TESTENTRY (enum_cases_are_reflected_once)
     TESTENTRY (protocol_num_requirements_can_be_gotten)
     TESTENTRY (protocol_conformance_can_be_gotten)
+    TESTENTRY (field_type_names_with_symbolic_references_can_be_resolved)
+    TESTENTRY (generic_types_can_be_resolved_by_name)
+    TESTENTRY (registry_can_be_exported_in_chunks)
+    TESTENTRY (swift_index_is_checked_on_load)
+    TESTENTRY (stats_can_be_gotten)
+    TESTENTRY (initialization_is_deferred_until_first_use)
+    TESTENTRY (calls_can_be_profiled)
+    TESTENTRY (allocations_can_be_profiled)
+    TESTENTRY (tasks_can_be_traced)
+    TESTENTRY (hot_functions_can_be_sampled)
+    TESTENTRY (class_instances_can_be_chosen)
     TESTENTRY (interceptor_can_parse_struct_value_arguments)
     TESTENTRY (interceptor_can_parse_enum_value_arguments)
+    TESTENTRY (interceptor_can_parse_optional_arguments)
     TESTENTRY (interceptor_can_parse_class_instance_arguments)
     TESTENTRY (interceptor_can_parse_stack_arguments)
     TESTENTRY (interceptor_can_parse_opaque_existential_container_arguments)
@@ -62,6 +84,10 @@ TESTLIST_BEGIN (basics)
     TESTENTRY (interceptor_can_parse_indirect_return_value)
     TESTENTRY (interceptor_can_parse_opaque_existential_container_return_value)
     TESTENTRY (interceptor_can_parse_class_existential_container_return_value)
+    TESTENTRY (interceptor_can_replace_function_and_call_original)
+    TESTENTRY (interceptor_can_sample_calls_natively)
+    TESTENTRY (interceptor_can_filter_calls_natively)
+    TESTENTRY (interceptor_can_limit_calls_natively)
 TESTLIST_END ()
 
 TESTCASE (modules_can_be_enumerated)
@@ -106,6 +132,58 @@ TESTCASE (types_can_be_enumerated)
   EXPECT_SEND_MESSAGE_WITH ("true");
 }
 
+TESTCASE (elf_sections_can_be_found)
+{
+  /* Against fake modules, as the test runner's images are Mach-O ones */
+  COMPILE_AND_LOAD_SCRIPT(
+    "var { ElfSectionDiscoveryBackend } = LocalSwiftInternals;"
+    "var backend = new ElfSectionDiscoveryBackend('libswiftCore.so');"
+    "var withHeaders = {"
+        "path: '/usr/lib/libA.so',"
+        "enumerateSections: () => ["
+            "{ name: '.text', address: ptr(0x1000), size: 0x100 },"
+            "{ name: 'swift5_type_metadata', address: ptr(0x2000), size: 0x40 }"
+        "]"
+    "};"
+    "var types = backend.findSection(withHeaders, 'types');"
+    "send(types.vmAddress.equals(ptr(0x2000)) && types.size === 0x40);"
+    "send(backend.findSection(withHeaders, 'protocols').vmAddress.isNull());"
+    /* An image without section headers, holding just its program headers */
+    "var image = Memory.alloc(Process.pageSize);"
+    "image.add(0x20).writeU64(0x40);"
+    "image.add(0x36).writeU16(0x38);"
+    "image.add(0x38).writeU16(2);"
+    "var load = image.add(0x40);"
+    "load.writeU32(1);"
+    "load.add(0x28).writeU64(Process.pageSize);"
+    "var note = image.add(0x78);"
+    "note.writeU32(4);"
+    "note.add(0x10).writeU64(0x100);"
+    "note.add(0x28).writeU64(0x1c);"
+    "note.add(0x30).writeU64(4);"
+    "image.add(0x100).writeU32(7);"
+    "image.add(0x104).writeU32(8);"
+    "image.add(0x10c).writeUtf8String('swift6');"
+    "image.add(0x114).writePointer(image.add(0x200));"
+    "image.add(0x200).writeU64(4);"
+    "image.add(0x220).writePointer(image.add(0x300));"
+    "image.add(0x228).writeU64(0x10);"
+    "var stripped = {"
+        "path: '/usr/lib/libB.so',"
+        "base: image,"
+        "size: Process.pageSize,"
+        "enumerateSections: () => { throw new Error('No section headers'); }"
+    "};"
+    "var protocols = backend.findSection(stripped, 'protocols');"
+    "send(protocols.vmAddress.equals(image.add(0x300)) && protocols.size === 0x10);"
+    "send(backend.findSection(stripped, 'types').size === 0);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 TESTCASE (swiftcall_with_context)
 {
   COMPILE_AND_LOAD_SCRIPT(
@@ -276,6 +354,59 @@ TESTCASE (class_instance_properties_can_be_gotten_and_set)
   EXPECT_SEND_MESSAGE_WITH ("true");
 }
 
+TESTCASE (class_instance_stored_properties_can_be_read_and_written)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var SimpleClass = Swift.classes.SimpleClass;"
+    "var instance = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "send(instance.$stored.x.toNumber() == 2 && instance.$stored.y.toNumber() == 3);"
+    "instance.$stored.x = 9;"
+    "send(instance.x.handle.readU64() == 9);"
+    "send(instance.$stored);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("{\"x\":\"9\",\"y\":\"3\"}");
+}
+
+TESTCASE (class_instance_stored_references_are_handled_safely)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var object = Swift.classes.SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var holder = Swift.classes.ReferenceHolder.__allocating_init$object_(object);"
+    "var stored = holder.$stored;"
+    "send(stored.object.handle.equals(object.handle));"
+    /* Weak and unowned storage is only exposed by address */
+    "send(stored.weakObject instanceof NativePointer && "
+        "!stored.weakObject.equals(object.handle));"
+    "send(stored.unownedObject instanceof NativePointer);"
+    "try {"
+      "stored.weakObject = object;"
+    "} catch (e) {"
+      "send(e.message.startsWith(\"Can't assign to weakObject\"));"
+    "}"
+    "try {"
+      "stored.object = null;"
+    "} catch (e) {"
+      "send(e.message);"
+    "}"
+    "send(stored.object.handle.equals(object.handle));"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("\"Can't assign to object: expected an instance "
+      "of dummy.SimpleClass, not null\"");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 TESTCASE (class_instance_can_be_passed_to_and_returned_from_function)
 {
   COMPILE_AND_LOAD_SCRIPT(
@@ -359,6 +490,101 @@ TESTCASE (opaque_existential_inline_can_be_passed_to_function)
   EXPECT_SEND_MESSAGE_WITH ("true");
 }
 
+TESTCASE (opaque_existential_witness_tables_are_resolved_once)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var symbols = dummy.enumerateSymbols();"
+    "symbols = symbols.filter(s => s.name == '$s5dummy27takeInlineExistentialStructySbAA0D0_pF');"
+    "var target = symbols[0].address;"
+    "var Existential = Swift.protocols.Existential;"
+    "var Bool = Swift.structs.Bool;"
+    "var takeInlineExistentialStruct = Swift.NativeFunction(target, Bool, [Existential]);"
+    "var InlineExistentialStruct = Swift.structs.InlineExistentialStruct;"
+    "var inline = new Swift.Struct(InlineExistentialStruct, { raw: [0xCAFE, 0xBABE] });"
+    "var before = Swift.stats().existentials.cache;"
+    "var results = [1, 2, 3].map(() => takeInlineExistentialStruct(inline).handle.readU8());"
+    "var after = Swift.stats().existentials.cache;"
+    "send(results.every(r => r == 1));"
+    "send(after.misses - before.misses == 1 && after.hits - before.hits == 2);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (pod_values_are_copied_without_value_witnesses)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var symbols = dummy.enumerateSymbols();"
+    "symbols = symbols.filter(s => s.name == '$s5dummy27takeInlineExistentialStructySbAA0D0_pF');"
+    "var target = symbols[0].address;"
+    "var Existential = Swift.protocols.Existential;"
+    "var Bool = Swift.structs.Bool;"
+    "var takeInlineExistentialStruct = Swift.NativeFunction(target, Bool, [Existential]);"
+    "var InlineExistentialStruct = Swift.structs.InlineExistentialStruct;"
+    "var inline = new Swift.Struct(InlineExistentialStruct, { raw: [0xCAFE, 0xBABE] });"
+    "var before = Swift.stats();"
+    "send(takeInlineExistentialStruct(inline).handle.readU8() == 1);"
+    "var after = Swift.stats();"
+    "send(after.values.podCopies > before.values.podCopies);"
+    "send(after.values.witnessCopies == before.values.witnessCopies);"
+    "send(after.nativeFunctions.valueWitnesses == before.nativeFunctions.valueWitnesses);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (value_arrays_are_copied_in_one_go)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var { Int } = Swift.structs;"
+    "var src = Memory.alloc(3 * 8);"
+    "[1, 2, 3].forEach((v, i) => src.add(i * 8).writeU64(v));"
+    "var before = Swift.stats();"
+    "var array = Swift.ValueArray.fromCopy(src, Int, 3);"
+    "var after = Swift.stats();"
+    "send(after.memory.allocations - before.memory.allocations == 1);"
+    "send(after.values.podCopies - before.values.podCopies == 1);"
+    "send(array.length == 3 && array.get(1).handle.readU64() == 2);"
+    "send(array.toArray().map(v => v.handle.readU64().toNumber()).join());"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("\"1,2,3\"");
+}
+
+TESTCASE (value_arrays_of_non_pod_types_retain_and_release)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var { Int, ClassHolder } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var object = Swift.classes.SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var retainCount = new NativeFunction("
+        "Module.getExportByName(null, 'swift_retainCount'), 'int', ['pointer']);"
+    "var src = Memory.alloc(2 * 8);"
+    "src.writePointer(object.handle);"
+    "src.add(8).writePointer(object.handle);"
+    "var count = retainCount(object.handle);"
+    "var before = Swift.stats();"
+    "var array = Swift.ValueArray.fromCopy(src, ClassHolder, 2);"
+    "var after = Swift.stats();"
+    "send(after.values.witnessCopies - before.values.witnessCopies == 1);"
+    "send(retainCount(object.handle) - count == 2);"
+    "send(array.get(1).handle.readPointer().equals(object.handle));"
+    "array.dispose();"
+    "send(retainCount(object.handle) == count);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 TESTCASE (opaque_existential_inline_can_be_returned_from_function)
 {
   COMPILE_AND_LOAD_SCRIPT(
@@ -621,10 +847,62 @@ TESTCASE (singlepayload_enum_equals_works)
     "var b = SinglePayloadEnumWithExtraInhabitants.b;"
     "send(a.equals(b))"
   );
-  EXPECT_SEND_MESSAGE_WITH ("false");
+  EXPECT_SEND_MESSAGE_WITH ("true");
   EXPECT_SEND_MESSAGE_WITH ("false");
 }
 
+TESTCASE (values_can_be_deduplicated_by_content)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var { Int, String, LoadableStruct } = Swift.structs;"
+    "var symbols = dummy.enumerateSymbols().filter(s => s.name === '$s5dummy18makeLoadableStruct1a1b1c1dAA0cD0VSi_S3itF');"
+    "var makeLoadableStruct = Swift.NativeFunction(symbols[0].address, LoadableStruct, [Int, Int, Int, Int]);"
+    "symbols = dummy.enumerateSymbols().filter(s => s.name == '$s5dummy10makeStringSSyF');"
+    "var makeString = Swift.NativeFunction(symbols[0].address, String, []);"
+    "var i1 = new Swift.Struct(Int, { raw: [1] });"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var a = makeLoadableStruct(i1, i1, i1, i1);"
+    "var b = makeLoadableStruct(i1, i1, i1, i1);"
+    "var c = makeLoadableStruct(i1, i1, i1, i2);"
+    "send(!a.handle.equals(b.handle) && a.equals(b) && !a.equals(c));"
+    "send(a.hash() === b.hash());"
+    "var set = new Swift.ValueSet();"
+    "send([a, b, c].map(v => set.add(v)).join());"
+    "var counts = new Swift.ValueMap();"
+    "for (var i = 0; i !== 3; i++) {"
+        "var s = makeString();"
+        "counts.set(s, (counts.get(s) || 0) + 1);"
+    "}"
+    "send(counts.size === 1 && counts.get(makeString()) === 3);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("\"true,false,true\"");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (struct_values_can_be_made_from_fields)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var symbols = dummy.enumerateSymbols().filter(s => s.name == '$s5dummy13takeBigStructySbAA0cD0VF');"
+    "var { Bool, BigStruct } = Swift.structs;"
+    "var takeBigStruct = Swift.NativeFunction(symbols[0].address, Bool, [BigStruct]);"
+    "var big = BigStruct.make({ a: 1, b: int64(2), c: uint64(3), d: 4, e: 5 });"
+    "send(takeBigStruct(big).handle.readU8() === 1);"
+    "send(big.handle.add(32).readS64() == 5);"
+    "try {"
+        "BigStruct.make({ a: 1, b: 2, c: 3, d: 4 });"
+    "} catch (e) {"
+        "send(e.message);"
+    "}"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("\"Missing field e of dummy.BigStruct\"");
+}
+
 TESTCASE (multipayload_enum_empty_case_can_be_made_from_raw)
 {
   COMPILE_AND_LOAD_SCRIPT(
@@ -695,6 +973,29 @@ TESTCASE (multipayload_enum_equals_works)
   EXPECT_SEND_MESSAGE_WITH ("false");
 }
 
+TESTCASE (enum_cases_are_reflected_once)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var Int = Swift.structs.Int;"
+    "var i1 = new Swift.Struct(Int, { raw: [0xCAFE] });"
+    "var MultiPayloadEnum = Swift.enums.MultiPayloadEnum;"
+    "var a1 = MultiPayloadEnum.a(i1);"
+    "var before = Swift.stats();"
+    "var a2 = new Swift.Enum(MultiPayloadEnum, { handle: a1.handle });"
+    "var after = Swift.stats();"
+    "send(a2.$tag === a1.$tag && a2.$payload.handle.readU64() == 0xCAFE);"
+    "send(after.symbolicReferences.cache.misses == before.symbolicReferences.cache.misses);"
+    "send(after.demangling.calls == before.demangling.calls);"
+    "send(after.nativeFunctions.valueWitnesses == before.nativeFunctions.valueWitnesses);"
+    "send(after.cacheEntries.enumCaseTables == 1);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 TESTCASE (protocol_num_requirements_can_be_gotten)
 {
   COMPILE_AND_LOAD_SCRIPT(
@@ -721,6 +1022,179 @@ TESTCASE (protocol_conformance_can_be_gotten)
   EXPECT_SEND_MESSAGE_WITH ("true");
 }
 
+TESTCASE (field_type_names_with_symbolic_references_can_be_resolved)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var StructWithLocalFields = Swift.structs.StructWithLocalFields;"
+    "var fields = StructWithLocalFields.$fields;"
+    "send(fields[0].typeName);"
+    "send(fields[1].typeName);"
+    "send(fields[2].typeName);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("\"dummy.LoadableStruct\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"Swift.Optional<dummy.LoadableStruct>\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"dummy.SimpleClass\"");
+}
+
+TESTCASE (stats_can_be_gotten)
+{
+  COMPILE_AND_LOAD_SCRIPT(
+    "var { Int } = Swift.structs;"
+    "var i1 = new Swift.Struct(Int, { raw: [1] });"
+    "var stats = Swift.stats();"
+    "send(stats.indexing.typeDescriptors > 100);"
+    "send(stats.memory.bytes >= 8);"
+    "send(stats.cacheEntries.typeData > 100);"
+    "send(typeof stats.demangling.cache.hitRatio === 'number');"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (initialization_is_deferred_until_first_use)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "send(Swift.stats().initialization.length === 0);"
+    "send(Swift.available);"
+    "send(Swift.stats().initialization.length === 0);"
+    "Swift.classes;"
+    "var steps = Swift.stats().initialization.map(s => s.step);"
+    "send(['api', 'moduleMap', 'indexing', 'registry'].every(s => steps.includes(s)));"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (calls_can_be_profiled)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var symbols = dummy.enumerateSymbols();"
+    "symbols = symbols.filter(s => s.name == '$s5dummy17getLoadableStructAA0cD0VyF');"
+    "var target = symbols[0].address;"
+    "var { LoadableStruct } = Swift.structs;"
+    "var getLoadableStruct = Swift.NativeFunction(target, LoadableStruct, []);"
+    "Swift.profiler.start();"
+    "Swift.Interceptor.attach(target, {"
+        "onLeave: function(retval) {}"
+    "});"
+    "for (var i = 0; i !== 10; i++) getLoadableStruct();"
+    "Swift.profiler.stop();"
+    "var report = Swift.profiler.report();"
+    "send(report.functions[0].calls === 10);"
+    "send(report.hooks[0].calls === 10);"
+    "send(report.hooks[0].p99Us >= report.hooks[0].p50Us);"
+    "send(report.operations.some(o => o.name === 'untypedMetadataFor'));"
+    "send(Swift.profiler.table().indexOf('Native functions') === 0);"
+    "send(new DataView(Swift.profiler.snapshot()).getUint32(8, true) > 2);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (allocations_can_be_profiled)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var { SimpleClass } = Swift.classes;"
+    "Swift.allocationProfiler.start({ backtraceSampling: 1 });"
+    "for (var i = 0; i !== 10; i++) "
+        "SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "Swift.allocationProfiler.stop();"
+    "var report = Swift.allocationProfiler.report();"
+    "var simple = report.types.filter(t => t.type === 'dummy.SimpleClass')[0];"
+    "send(simple.allocations >= 10);"
+    "send(simple.metadata.equals(SimpleClass.$metadataPointer));"
+    "send(simple.backtraces.length === simple.allocations);"
+    "Swift.allocationProfiler.reset();"
+    "send(Swift.allocationProfiler.report().types.length === 0);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (tasks_can_be_traced)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var symbols = dummy.enumerateSymbols();"
+    "symbols = symbols.filter(s => s.name == '$s5dummy17spawnCountingTaskyyF');"
+    "var spawnCountingTask = Swift.NativeFunction(symbols[0].address, 'void', []);"
+    "Swift.taskTracer.start();"
+    "spawnCountingTask();"
+    "setTimeout(() => {"
+        "Swift.taskTracer.stop();"
+        "var report = Swift.taskTracer.report();"
+        "var spawned = report.functions.filter(f => f.tasks !== 0);"
+        "send(spawned.length >= 1 && spawned[0].name !== '<unknown>');"
+        "send(spawned.some(f => f.queueing.count >= 1));"
+        "send(report.actors.some(a => a.name === '<generic>'));"
+        "send(Swift.taskTracer.drain().length === 0);"
+    "}, 200);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (hot_functions_can_be_sampled)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var symbols = dummy.enumerateSymbols().filter(s => "
+        "s.name.startsWith('$s5dummy15makeSimpleClass') && s.name.endsWith('F'));"
+    "var makeSimpleClass = new NativeFunction(symbols[0].address, 'pointer', "
+        "['int64', 'int64'], { traps: 'all' });"
+    "Swift.sampler.start({ threads: [Process.getCurrentThreadId()], "
+        "stackSampling: 1 });"
+    "for (var i = 0; i !== 100; i++) makeSimpleClass(1, 2);"
+    "Swift.sampler.stop();"
+    "var report = Swift.sampler.report();"
+    "send(report.functions.some(f => "
+        "f.name.indexOf('makeSimpleClass') !== -1 && f.blocks >= 100));"
+    "send(report.types.some(t => "
+        "t.name === 'dummy.SimpleClass' && t.kind === 'class'));"
+    "send(report.stacks.some(s => /^.+ \\d+$/.test(s)));"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (class_instances_can_be_chosen)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var { SimpleClass } = Swift.classes;"
+    "var instance = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var found = false;"
+    "Swift.choose(SimpleClass, {"
+      "onMatch: function(instances) {"
+        "found = found || instances.some(i => i.handle.equals(instance.handle));"
+      "},"
+      "onComplete: function() {"
+        "send(found);"
+      "}"
+    "}, { batchSize: 1 });"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 TESTCASE (interceptor_can_parse_struct_value_arguments)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -759,6 +1233,25 @@ TESTCASE (interceptor_can_parse_enum_value_arguments)
   EXPECT_SEND_MESSAGE_WITH ("true");
 }
 
+TESTCASE (interceptor_can_parse_optional_arguments)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var takeOptionalInt = dummy.enumerateSymbols().filter(s => s.name == '$s5dummy15takeOptionalIntyS2iSgF')[0].address;"
+    "var passOptionalInt = dummy.enumerateSymbols().filter(s => s.name == '$s5dummy15passOptionalIntSiyF')[0].address;"
+    "Swift.Interceptor.attach(takeOptionalInt, {"
+      "onEnter: function(args) {"
+          "var payload = args[0].$payload;"
+          "send(payload.$metadata.getFullTypeName());"
+          "send(payload.handle.readS64() === 0xcafe);"
+      "}"
+    "});"
+    "new NativeFunction(passOptionalInt, 'int64', [])();"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("\"Swift.Int\"");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 TESTCASE (interceptor_can_parse_class_instance_arguments)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -1056,3 +1549,255 @@ TESTCASE (interceptor_can_parse_class_existential_container_return_value)
   EXPECT_SEND_MESSAGE_WITH ("true");
   EXPECT_SEND_MESSAGE_WITH ("true");
 }
+
+TESTCASE (interceptor_can_replace_function_and_call_original)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var i4 = new Swift.Struct(Int, { raw: [4] });"
+    "var SimpleClass = Swift.classes.SimpleClass;"
+    "var instance = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var replacement = Swift.Interceptor.replace(instance.multiply$with_.address, function (z) {"
+        "send(this.context.equals(instance.handle));"
+        "var doubled = new Swift.Struct(Int, { raw: [z.handle.readU64().toNumber() * 2] });"
+        "return this.original(doubled);"
+    "});"
+    "send(instance.multiply$with_(i4).handle.readU64() == 48);"
+    "replacement.revert();"
+    "send(instance.multiply$with_(i4).handle.readU64() == 24);"
+    "var scale = Process.getModuleByName('dummy.o').enumerateSymbols()"
+        ".filter(s => s.name.startsWith('$s5dummy5scale_2by'))[0].address;"
+    "try {"
+        "Swift.Interceptor.replace(scale, function (x, factor) {"
+            "return x;"
+        "});"
+    "} catch (e) {"
+        "send(e.message.indexOf('Swift.Double') !== -1);"
+    "}"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (interceptor_can_sample_calls_natively)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var SimpleClass = Swift.classes.SimpleClass;"
+    "var instance = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var entered = 0;"
+    "var results = [];"
+    "var listener = Swift.Interceptor.attach(instance.multiply.address, {"
+        "onEnter: function(args) {"
+            "entered++;"
+        "},"
+        "onLeave: function(retval) {"
+            "results.push(retval.handle.readU64().toNumber());"
+        "}"
+    "}, { sampling: 5 });"
+    "for (var i = 0; i !== 10; i++) {"
+        "instance.multiply();"
+    "}"
+    "var stats = listener.stats();"
+    "send(entered === 2);"
+    "send(results.every(r => r === 6));"
+    "send(stats.calls === 10 && stats.entered === 2);"
+    "send(stats.skipped.sampling === 8);"
+    "listener.detach();"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (interceptor_can_limit_calls_natively)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var SimpleClass = Swift.classes.SimpleClass;"
+    "var instance = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var entered = 0;"
+    "var callbacks = { onEnter: function(args) { entered++; } };"
+    "var listener = Swift.Interceptor.attach(instance.multiply.address,"
+        "callbacks, { threadBudget: 2 });"
+    "for (var i = 0; i !== 5; i++) {"
+        "instance.multiply();"
+    "}"
+    "var stats = listener.stats();"
+    "send(entered === 2 && stats.skipped.threadBudget === 3);"
+    "listener.resetThreadBudgets();"
+    "for (var i = 0; i !== 3; i++) {"
+        "instance.multiply();"
+    "}"
+    "stats = listener.stats();"
+    "send(entered === 4 && stats.skipped.threadBudget === 4);"
+    "listener.detach();"
+    "entered = 0;"
+    "listener = Swift.Interceptor.attach(instance.multiply.address,"
+        "callbacks, { rateLimit: { burst: 3 } });"
+    "for (var i = 0; i !== 5; i++) {"
+        "instance.multiply();"
+    "}"
+    "stats = listener.stats();"
+    "send(entered === 3 && stats.skipped.rateLimit === 2);"
+    "listener.detach();"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (interceptor_can_filter_calls_natively)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var { Int } = Swift.structs;"
+    "var i2 = new Swift.Struct(Int, { raw: [2] });"
+    "var i3 = new Swift.Struct(Int, { raw: [3] });"
+    "var i4 = new Swift.Struct(Int, { raw: [4] });"
+    "var i20 = new Swift.Struct(Int, { raw: [20] });"
+    "var SimpleClass = Swift.classes.SimpleClass;"
+    "var instance = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var other = SimpleClass.__allocating_init$first_second_(i2, i3);"
+    "var seen = [];"
+    "var listener = Swift.Interceptor.attach(instance.multiply$with_.address, {"
+        "onEnter: function(args) {"
+            "seen.push(args[0].handle.readU64().toNumber());"
+        "}"
+    "}, { where: ["
+        "{ arg: 0, compare: '>', value: 10 },"
+        "{ arg: 'self', equals: instance },"
+        "{ arg: 'self', subclassOf: SimpleClass }"
+    "] });"
+    "instance.multiply$with_(i4);"
+    "instance.multiply$with_(i20);"
+    "other.multiply$with_(i20);"
+    "var stats = listener.stats();"
+    "send(seen.length === 1 && seen[0] === 20);"
+    "send(stats.calls === 3 && stats.skipped.predicates === 2);"
+    "listener.detach();"
+    "var dummy = Process.getModuleByName('dummy.o');"
+    "var target = dummy.enumerateSymbols().filter(s => "
+        "s.name === '$s5dummy20takeMultiPayloadEnum4kaseSiAA0cdE0O_tF')[0]"
+        ".address;"
+    "var MultiPayloadEnum = Swift.enums.MultiPayloadEnum;"
+    "var takeMultiPayloadEnum = Swift.NativeFunction(target, Int,"
+        "[MultiPayloadEnum]);"
+    "var tags = [];"
+    "listener = Swift.Interceptor.attach(target, {"
+        "onEnter: function(args) {"
+            "tags.push(args[0].$tag);"
+        "}"
+    "}, { where: [{ arg: 0, case: 'd' }] });"
+    "var truthy = new Swift.Struct(Swift.structs.Bool, { raw: [1] });"
+    "takeMultiPayloadEnum(MultiPayloadEnum.a(i4));"
+    "takeMultiPayloadEnum(MultiPayloadEnum.d(truthy));"
+    "takeMultiPayloadEnum(MultiPayloadEnum.e);"
+    "stats = listener.stats();"
+    "send(tags.length === 1 && tags[0] === 3);"
+    "send(stats.calls === 3 && stats.skipped.predicates === 2);"
+    "listener.detach();"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+TESTCASE (generic_types_can_be_resolved_by_name)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var optionalInt = Swift.metadataFor('Swift.Optional<Swift.Int>');"
+    "send(optionalInt.equals(Swift.metadataFor('SiSg')));"
+    "send(optionalInt.equals(Swift.metadataFor('Swift.Int?')));"
+    "var lookups = Swift.stats().metadata.runtimeLookups;"
+    "var loadables = Swift.metadataFor('[Swift.String : dummy.LoadableStruct?]');"
+    "send(!loadables.isNull());"
+    "Swift.metadataFor('[Swift.String : dummy.LoadableStruct?]');"
+    "send(Swift.stats().metadata.runtimeLookups === lookups + 1);"
+    "for (var i = 0; i !== 2; i++) {"
+        "try {"
+            "Swift.metadataFor('Bogus');"
+        "} catch (e) {"
+            "send(e.message);"
+        "}"
+    "}"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("\"Type not found: Bogus\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"Type not found: Bogus\"");
+}
+
+TESTCASE (registry_can_be_exported_in_chunks)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+    "var options = { id: 'dump', chunkSize: 1, window: 1 };"
+    "Swift.exportRegistry(options).then(r => {"
+        "send([r.records, r.chunks, r.cursor, r.complete].join());"
+        "return Swift.exportRegistry({ ...options, cursor: r.cursor });"
+    "}).then(r => {"
+        "send([r.records, r.chunks, r.cursor, r.complete].join());"
+        "return Swift.exportRegistry({ ...options, window: 2, cursor: r.cursor });"
+    "}).then(r => send([r.records, r.chunks, r.cursor, r.complete].join()));"
+  );
+  EXPECT_SEND_MESSAGE_WITH_PREFIX ("{\"type\":\"swift-export:chunk\","
+      "\"id\":\"dump\",\"run\":1,\"seq\":0,\"cursor\":1,\"records\":\"{");
+  POST_MESSAGE ("{\"type\":\"swift-export:ack:dump\",\"run\":1,\"seq\":0,"
+      "\"stop\":true}");
+  EXPECT_SEND_MESSAGE_WITH ("\"1,1,1,false\"");
+  EXPECT_SEND_MESSAGE_WITH_PREFIX ("{\"type\":\"swift-export:chunk\","
+      "\"id\":\"dump\",\"run\":2,\"seq\":0,\"cursor\":2,\"records\":\"{");
+  /* A late ack of the first run, which would otherwise let this one go on */
+  POST_MESSAGE ("{\"type\":\"swift-export:ack:dump\",\"run\":1,\"seq\":0}");
+  POST_MESSAGE ("{\"type\":\"swift-export:ack:dump\",\"run\":2,\"seq\":0,"
+      "\"stop\":true}");
+  EXPECT_SEND_MESSAGE_WITH ("\"1,1,2,false\"");
+  EXPECT_SEND_MESSAGE_WITH_PREFIX ("{\"type\":\"swift-export:chunk\","
+      "\"id\":\"dump\",\"run\":3,\"seq\":0,\"cursor\":3,\"records\":\"{");
+  EXPECT_SEND_MESSAGE_WITH_PREFIX ("{\"type\":\"swift-export:chunk\","
+      "\"id\":\"dump\",\"run\":3,\"seq\":1,\"cursor\":4,\"records\":\"{");
+  /* Stopped with the second chunk in flight, which is to be sent again */
+  POST_MESSAGE ("{\"type\":\"swift-export:ack:dump\",\"run\":3,\"seq\":0,"
+      "\"stop\":true}");
+  EXPECT_SEND_MESSAGE_WITH ("\"2,2,3,false\"");
+}
+
+TESTCASE (swift_index_is_checked_on_load)
+{
+  /* Shaped like index-fixture.json, for an image that isn't loaded */
+  COMPILE_AND_LOAD_SCRIPT (
+    "var index = { format: 'frida-swift-index', version: 1, images: [{"
+        "uuid: '5f1d0c3a9e7b4d2c8a6f0e1b2c3d4e5f',"
+        "name: 'libFixture.dylib',"
+        "arch: 'arm64',"
+        "types: [[1072, 17, 'Fixture.Point'], [1240, 17, null]],"
+        "protocols: [[1280, 'Fixture.Shape']],"
+        "conformances: [[1312, 'Fixture.Point'], [1344, null]]"
+    "}] };"
+    "for (var bad of [{ ...index, version: 2 }, { ...index, format: 'x' }]) {"
+        "try {"
+            "Swift.loadIndex(bad);"
+        "} catch (e) {"
+            "send(e.message);"
+        "}"
+    "}"
+    "Swift.loadIndex(JSON.stringify(index));"
+    "send(Object.keys(Swift.modules.dummy.classes).length > 4);"
+    "send(Swift.modules.Fixture === undefined);"
+  );
+  EXPECT_SEND_MESSAGE_WITH ("\"Unsupported Swift index version: 2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"Not a Swift index\"");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2021 Abdelrahman Eid <hot3eed@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+/**
+ * Throughput benchmarks, only registered when the runner is passed --bench.
+ * Each bench() call in a script reports one result, which the runner writes
+ * out as JSON, see --bench-output.
+ */
+
+#define SUITE "/Bench"
+#include "fixture.c"
+
+#define BENCH_TIMEOUT_MSEC 60000
+
+/*
+ * Samples are batches of iterations timed with the monotonic clock, so that
+ * the cost of reading the clock stays out of the per-op figures. Percentiles
+ * are of the per-op time within each batch.
+ */
+#define BENCH_HARNESS \
+    "var clockGettimeNsecNp = new NativeFunction(" \
+        "Process.getModuleByName('libsystem_c.dylib')" \
+            ".getExportByName('clock_gettime_nsec_np')," \
+        "'uint64', ['int']);" \
+    "function now() { return clockGettimeNsecNp(8).toNumber(); }" \
+    "function option(options, name, fallback) {" \
+        "return (options !== undefined && options[name] !== undefined) ? options[name] : fallback;" \
+    "}" \
+    "function bench(name, fn, options) {" \
+        "var warmup = option(options, 'warmup', 100);" \
+        "var samples = option(options, 'samples', 50);" \
+        "var batch = option(options, 'batch', 20);" \
+        "for (var i = 0; i !== warmup; i++) fn();" \
+        "var perOp = [];" \
+        "var total = 0;" \
+        "for (var s = 0; s !== samples; s++) {" \
+            "var start = now();" \
+            "for (var i = 0; i !== batch; i++) fn();" \
+            "var elapsed = now() - start;" \
+            "total += elapsed;" \
+            "perOp.push(elapsed / batch);" \
+        "}" \
+        "perOp.sort((a, b) => a - b);" \
+        "var percentile = p => perOp[Math.min(perOp.length - 1, Math.floor(p / 100 * perOp.length))];" \
+        "var iterations = samples * batch;" \
+        "send({" \
+            "name: name," \
+            "iterations: iterations," \
+            "opsPerSec: iterations / (total / 1e9)," \
+            "meanNs: total / iterations," \
+            "p50Ns: percentile(50)," \
+            "p90Ns: percentile(90)," \
+            "p99Ns: percentile(99)," \
+            "minNs: perOp[0]," \
+            "maxNs: perOp[perOp.length - 1]" \
+        "});" \
+    "}" \
+    "var Internals = LocalSwiftInternals;" \
+    "var dummy = Process.getModuleByName('dummy.o');" \
+    "function dummyFunction(name) {" \
+        "return dummy.enumerateSymbols().filter(s => s.name === name)[0].address;" \
+    "}"
+
+/*
+ * Registry build cost is measured cold, in a fresh script, both before and
+ * after loading each fixture, so that the fixture's share can be told apart
+ * from that of the modules already loaded.
+ */
+#define SCALING_HARNESS \
+    "var kernel = Process.getModuleByName('libsystem_kernel.dylib');" \
+    "var taskInfo = new NativeFunction(kernel.getExportByName('task_info')," \
+        "'int', ['uint', 'int', 'pointer', 'pointer']);" \
+    "var machTaskSelf = kernel.getExportByName('mach_task_self_').readU32();" \
+    "var TASK_VM_INFO = 22;" \
+    "var OFFSETOF_PHYS_FOOTPRINT = 144;" \
+    "var taskVmInfo = Memory.alloc(1024);" \
+    "var taskVmInfoCount = Memory.alloc(4);" \
+    "function footprint() {" \
+        "taskVmInfoCount.writeU32(1024 / 4);" \
+        "taskInfo(machTaskSelf, TASK_VM_INFO, taskVmInfo, taskVmInfoCount);" \
+        "return taskVmInfo.add(OFFSETOF_PHYS_FOOTPRINT).readU64().toNumber();" \
+    "}" \
+    "function measureRegistryBuild() {" \
+        "var footprintBefore = footprint();" \
+        "var start = now();" \
+        "Internals.Registry.shared();" \
+        "var registryBuildMs = (now() - start) / 1e6;" \
+        "var indexing = Swift.stats().indexing;" \
+        "return {" \
+            "registryBuildMs: registryBuildMs," \
+            "indexingMs: indexing.timeMs," \
+            "footprintBytes: footprint() - footprintBefore," \
+            "typeDescriptors: indexing.typeDescriptors," \
+            "protocolDescriptors: indexing.protocolDescriptors," \
+            "conformances: indexing.conformances" \
+        "};" \
+    "}" \
+    "function scalingResult(fixture, baseline, measured) {" \
+        "var result = { name: 'registry scaling ' + fixture, fixture: fixture, parameters: {} };" \
+        "for (var part of fixture.split('_').slice(1))" \
+            "result.parameters[part[0]] = parseInt(part.substring(1));" \
+        "for (var key of Object.keys(measured))" \
+            "result[key] = measured[key] - baseline[key];" \
+        "result.typeConstructionMs = result.registryBuildMs - result.indexingMs;" \
+        "return result;" \
+    "}"
+
+#define COMPILE_AND_LOAD_BENCH(SOURCE, ...) \
+    PUSH_TIMEOUT (BENCH_TIMEOUT_MSEC); \
+    COMPILE_AND_LOAD_SCRIPT (BENCH_HARNESS SOURCE, ## __VA_ARGS__)
+#define EXPECT_BENCH_RESULTS(COUNT) \
+    test_fixture_expect_bench_results (fixture, COUNT)
+
+extern JsonArray * bench_results;
+extern gchar * scaling_fixtures_dir;
+
+static GPtrArray * list_scaling_fixtures (void);
+static gchar * test_fixture_pop_send_payload (TestFixture * fixture);
+static void test_fixture_expect_bench_results (TestFixture * fixture,
+    guint count);
+
+TESTLIST_BEGIN (bench)
+    TESTENTRY (bench_registry_construction)
+    TESTENTRY (bench_untyped_metadata_lookup)
+    TESTENTRY (bench_swiftcall_direct)
+    TESTENTRY (bench_swiftcall_indirect)
+    TESTENTRY (bench_swiftcall_stack_arguments)
+    TESTENTRY (bench_interceptor_overhead)
+    TESTENTRY (bench_enum_tag_decoding)
+    TESTENTRY (bench_existential_boxing)
+    TESTENTRY (bench_registry_scaling)
+TESTLIST_END ()
+
+TESTCASE (bench_registry_construction)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "bench('Registry.shared() cold', () => Internals.Registry.shared(),"
+        "{ warmup: 0, samples: 1, batch: 1 });"
+    "bench('Registry construction', () => new Internals.Registry(),"
+        "{ warmup: 1, samples: 10, batch: 1 });"
+  );
+  EXPECT_BENCH_RESULTS (2);
+}
+
+TESTCASE (bench_untyped_metadata_lookup)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "Swift.structs;"
+    "bench('untypedMetadataFor', () => Internals.untypedMetadataFor('Swift.Int'),"
+        "{ batch: 1000 });"
+  );
+  EXPECT_BENCH_RESULTS (1);
+}
+
+TESTCASE (bench_swiftcall_direct)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "var { LoadableStruct } = Swift.structs;"
+    "var getLoadableStruct = Swift.NativeFunction("
+        "dummyFunction('$s5dummy17getLoadableStructAA0cD0VyF'),"
+        "LoadableStruct, []);"
+    "bench('swiftcall direct result', () => getLoadableStruct());"
+  );
+  EXPECT_BENCH_RESULTS (1);
+}
+
+TESTCASE (bench_swiftcall_indirect)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "var { BigStruct, Bool } = Swift.structs;"
+    "var returnBigStruct = Swift.NativeFunction("
+        "dummyFunction('$s5dummy15returnBigStructAA0cD0VyF'), BigStruct, []);"
+    "var takeBigStruct = Swift.NativeFunction("
+        "dummyFunction('$s5dummy13takeBigStructySbAA0cD0VF'), Bool, [BigStruct]);"
+    "var big = returnBigStruct();"
+    "bench('swiftcall indirect result', () => returnBigStruct());"
+    "bench('swiftcall indirect argument', () => takeBigStruct(big));"
+  );
+  EXPECT_BENCH_RESULTS (2);
+}
+
+TESTCASE (bench_swiftcall_stack_arguments)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "var { Int, BigStruct, LoadableStruct } = Swift.structs;"
+    "var makeBigStructWithManyArguments = Swift.NativeFunction("
+        "dummyFunction('$s5dummy30makeBigStructWithManyArguments4with3and1a1b1c1d1eAA0cD0VAA08LoadableD0V_AMS5itF'),"
+        "BigStruct, [LoadableStruct, LoadableStruct, Int, Int, Int, Int, Int]);"
+    "var makeLoadableStruct = Swift.NativeFunction("
+        "dummyFunction('$s5dummy18makeLoadableStruct1a1b1c1dAA0cD0VSi_S3itF'),"
+        "LoadableStruct, [Int, Int, Int, Int]);"
+    "var i1 = new Swift.Struct(Int, { raw: [1] });"
+    "var loadable = makeLoadableStruct(i1, i1, i1, i1);"
+    "bench('swiftcall stack arguments', () =>"
+        "makeBigStructWithManyArguments(loadable, loadable, i1, i1, i1, i1, i1));"
+  );
+  EXPECT_BENCH_RESULTS (1);
+}
+
+TESTCASE (bench_interceptor_overhead)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "var { Int, LoadableStruct } = Swift.structs;"
+    "var makeLoadableStruct = Swift.NativeFunction("
+        "dummyFunction('$s5dummy18makeLoadableStruct1a1b1c1dAA0cD0VSi_S3itF'),"
+        "LoadableStruct, [Int, Int, Int, Int]);"
+    "var i1 = new Swift.Struct(Int, { raw: [1] });"
+    "bench('interceptor baseline', () => makeLoadableStruct(i1, i1, i1, i1));"
+    "var listener = Swift.Interceptor.attach(makeLoadableStruct.address, {"
+        "onEnter(args) {},"
+        "onLeave(retval) {}"
+    "});"
+    "bench('interceptor attached', () => makeLoadableStruct(i1, i1, i1, i1));"
+    "listener.detach();"
+  );
+  EXPECT_BENCH_RESULTS (2);
+}
+
+TESTCASE (bench_enum_tag_decoding)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "var { Int } = Swift.structs;"
+    "var { MultiPayloadEnum } = Swift.enums;"
+    "var makeMultiPayloadEnumCase = Swift.NativeFunction("
+        "dummyFunction('$s5dummy24makeMultiPayloadEnumCase4withAA0cdE0OSi_tF'),"
+        "MultiPayloadEnum, [Int]);"
+    "var b = makeMultiPayloadEnumCase(new Swift.Struct(Int, { raw: [1] }));"
+    "bench('enum tag decoding', () =>"
+        "new Swift.Enum(MultiPayloadEnum, { handle: b.handle }).$tag);"
+  );
+  EXPECT_BENCH_RESULTS (1);
+}
+
+TESTCASE (bench_existential_boxing)
+{
+  COMPILE_AND_LOAD_BENCH (
+    "var { Existential } = Swift.protocols;"
+    "var { InlineExistentialStruct, OutOfLineExistentialStruct } = Swift.structs;"
+    "var passThroughExistential = Swift.NativeFunction("
+        "dummyFunction('$s5dummy22passThroughExistentialyAA0D0_pAaC_pF'),"
+        "Existential, [Existential]);"
+    "var inline = new Swift.Struct(InlineExistentialStruct, { raw: [0xCAFE, 0xBABE] });"
+    "var outOfLine = new Swift.Struct(OutOfLineExistentialStruct, { raw: [0xDEAD, 0xBEEF] });"
+    "bench('existential boxing inline', () => passThroughExistential(inline));"
+    "bench('existential boxing out-of-line', () => passThroughExistential(outOfLine));"
+  );
+  EXPECT_BENCH_RESULTS (2);
+}
+
+TESTCASE (bench_registry_scaling)
+{
+  GPtrArray * fixtures;
+  guint i;
+
+  fixtures = list_scaling_fixtures ();
+  if (fixtures->len == 0)
+  {
+    g_test_skip ("No scaling fixtures, build them with make bench-scaling-macos");
+    goto beach;
+  }
+
+  for (i = 0; i != fixtures->len; i++)
+  {
+    const gchar * path = g_ptr_array_index (fixtures, i);
+    gchar * file_name, * module_name, * baseline;
+
+    file_name = g_path_get_basename (path);
+    module_name = g_strndup (file_name + strlen ("lib"),
+        strlen (file_name) - strlen ("lib") - strlen (".dylib"));
+
+    COMPILE_AND_LOAD_BENCH (SCALING_HARNESS
+      "var baseline = measureRegistryBuild();"
+      "Module.load('%s');"
+      "send(baseline);",
+      path);
+    baseline = test_fixture_pop_send_payload (fixture);
+
+    COMPILE_AND_LOAD_BENCH (SCALING_HARNESS
+      "send(scalingResult('%s', %s, measureRegistryBuild()));",
+      module_name, baseline);
+    EXPECT_BENCH_RESULTS (1);
+
+    g_free (baseline);
+    g_free (module_name);
+    g_free (file_name);
+  }
+
+beach:
+  g_ptr_array_unref (fixtures);
+}
+
+/* Sorted, so that each sweep runs from its smallest fixture up */
+static GPtrArray *
+list_scaling_fixtures (void)
+{
+  GPtrArray * fixtures;
+  GDir * dir;
+  const gchar * name;
+
+  fixtures = g_ptr_array_new_with_free_func (g_free);
+
+  dir = g_dir_open (scaling_fixtures_dir, 0, NULL);
+  if (dir == NULL)
+    return fixtures;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+  {
+    if (g_str_has_prefix (name, "libScale_") &&
+        g_str_has_suffix (name, ".dylib"))
+    {
+      g_ptr_array_add (fixtures,
+          g_build_filename (scaling_fixtures_dir, name, NULL));
+    }
+  }
+
+  g_dir_close (dir);
+
+  g_ptr_array_sort (fixtures, (GCompareFunc) g_strcmp0);
+
+  return fixtures;
+}
+
+static gchar *
+test_fixture_pop_send_payload (TestFixture * fixture)
+{
+  TestMessageItem * item;
+  JsonNode * message;
+  gchar * payload;
+
+  item = test_fixture_pop_message (fixture);
+
+  message = json_from_string (item->message, NULL);
+  g_assert (message != NULL);
+  payload = json_to_string (json_object_get_member (
+      json_node_get_object (message), "payload"), FALSE);
+
+  json_node_unref (message);
+  test_message_item_free (item);
+
+  return payload;
+}
+
+static void
+test_fixture_expect_bench_results (TestFixture * fixture,
+                                   guint count)
+{
+  const gchar * backend_name;
+  guint i;
+
+  backend_name =
+      strcmp (g_type_name (G_TYPE_FROM_INSTANCE (fixture->backend)),
+          "GumQuickScriptBackend") == 0 ? "QJS" : "V8";
+
+  for (i = 0; i != count; i++)
+  {
+    TestMessageItem * item;
+    JsonNode * message;
+    JsonObject * payload;
+
+    item = test_fixture_pop_message (fixture);
+
+    message = json_from_string (item->message, NULL);
+    g_assert (message != NULL);
+    g_assert_cmpstr (json_object_get_string_member (
+        json_node_get_object (message), "type"), ==, "send");
+
+    payload = json_object_get_object_member (json_node_get_object (message),
+        "payload");
+    g_assert (json_object_has_member (payload, "name"));
+    json_object_set_string_member (payload, "backend", backend_name);
+
+    if (json_object_has_member (payload, "opsPerSec"))
+    {
+      g_print ("\n  %-4s %-32s %14.1f ops/s  p50 %10.1f ns  p99 %10.1f ns",
+          backend_name,
+          json_object_get_string_member (payload, "name"),
+          json_object_get_double_member (payload, "opsPerSec"),
+          json_object_get_double_member (payload, "p50Ns"),
+          json_object_get_double_member (payload, "p99Ns"));
+    }
+    else
+    {
+      g_print ("\n  %-4s %-48s %10.1f ms  %8.1f MiB",
+          backend_name,
+          json_object_get_string_member (payload, "name"),
+          json_object_get_double_member (payload, "registryBuildMs"),
+          json_object_get_double_member (payload, "footprintBytes") /
+              (1024.0 * 1024.0));
+    }
+
+    if (bench_results != NULL)
+      json_array_add_object_element (bench_results, json_object_ref (payload));
+
+    json_node_unref (message);
+    test_message_item_free (item);
+  }
+}
@@ -1,2 +1,14 @@
 import LocalSwift from 'frida-swift-bridge';
+import { Registry } from 'frida-swift-bridge/dist/lib/registry.js';
+import { untypedMetadataFor } from 'frida-swift-bridge/dist/lib/macho.js';
+import { ElfSectionDiscoveryBackend } from 'frida-swift-bridge/dist/lib/sections.js';
 globalThis.LocalSwift = LocalSwift;
+/*
+ * Used by the bench suite to measure internals that have no public API, and
+ * by tests of code paths the host platform doesn't take
+ */
+globalThis.LocalSwiftInternals = {
+  Registry,
+  untypedMetadataFor,
+  ElfSectionDiscoveryBackend,
+};
@@ -99,6 +99,42 @@ func makeLoadableStruct(a: Int, b: Int, c: Int, d: Int) -> LoadableStruct {
     return s
 }
 
+@inline(never)
+func takeOptionalInt(_ x: Int?) -> Int {
+    return x ?? 0
+}
+
+func passOptionalInt() -> Int {
+    return takeOptionalInt(0xCAFE)
+}
+
+@inline(never)
+func scale(_ x: Double, by factor: Int) -> Double {
+    return x * Double(factor)
+}
+
+struct StructWithLocalFields {
+    let loadable: LoadableStruct
+    let maybeLoadable: LoadableStruct?
+    let simple: SimpleClass
+}
+
+struct ClassHolder {
+    let object: SimpleClass
+}
+
+class ReferenceHolder {
+    var object: SimpleClass
+    weak var weakObject: SimpleClass?
+    unowned let unownedObject: SimpleClass
+
+    init(object: SimpleClass) {
+        self.object = object
+        self.weakObject = object
+        self.unownedObject = object
+    }
+}
+
 enum EmptyEnum { }
 
 enum CStyle {
@@ -283,3 +319,21 @@ func passCompositeClassBoundExistentialThrough(
 func change(number: inout Int) {
     number += 1337
 }
+
+@available(macOS 10.15, *)
+actor Counter {
+    var value = 0
+
+    func increment() -> Int {
+        value += 1
+        return value
+    }
+}
+
+@available(macOS 10.15, *)
+func spawnCountingTask() {
+    Task.detached {
+        let counter = Counter()
+        _ = await counter.increment()
+    }
+}
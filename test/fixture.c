@@ -79,6 +79,7 @@ struct _TestFixture
   GMainContext * context;
   GQueue messages;
   GQueue timeouts;
+  gboolean testcase_done;
 };
 
 struct _TestMessageItem
@@ -101,10 +102,13 @@ static void test_fixture_expect_error_message_with (TestFixture * fixture,
     gint line_number, const gchar * description);
 static void test_fixture_expect_log_message_with (TestFixture * fixture,
     const gchar * level, const gchar * payload_template, ...);
+static gboolean test_fixture_backend_is_qjs (TestFixture * fixture);
 static void test_fixture_push_timeout (TestFixture * fixture, guint timeout);
 static void test_fixture_pop_timeout (TestFixture * fixture);
 
 extern gchar * frida_swift_bundle;
+extern GBytes * frida_swift_bytecode;
+extern TestScriptLoadTimes frida_swift_load_times[2];
 extern guint num_tests_run;
 
 static void
@@ -174,6 +178,13 @@ test_fixture_store_message (const gchar * message,
   if (test_fixture_try_handle_log_message (message))
     return;
 
+  if (strcmp (message, "{\"type\":\"send\",\"payload\":\""
+      TEST_TESTCASE_DONE_PAYLOAD "\"}") == 0)
+  {
+    self->testcase_done = TRUE;
+    return;
+  }
+
   item = g_slice_new (TestMessageItem);
   item->message = g_strdup (message);
 
@@ -262,7 +273,11 @@ test_fixture_compile_and_load_script (TestFixture * fixture,
                                       ...)
 {
   va_list args;
-  gchar * raw_source, * source;
+  gchar * raw_source;
+  gboolean from_bytecode;
+  GTimer * timer;
+  gdouble create_time;
+  TestScriptLoadTimes * load_times;
   GError * err = NULL;
 
   if (fixture->script != NULL)
@@ -276,28 +291,95 @@ test_fixture_compile_and_load_script (TestFixture * fixture,
   raw_source = g_strdup_vprintf (source_template, args);
   va_end (args);
 
-  source = g_strconcat (
-      frida_swift_bundle,
-      "\n;\n",
-      "(function testcase(Swift) {\n",
-      raw_source, "\n",
-      "})(LocalSwift);",
-      NULL);
+  /* V8 can't load QJS bytecode and has no bytecode of its own */
+  from_bytecode =
+      frida_swift_bytecode != NULL && test_fixture_backend_is_qjs (fixture);
 
-  fixture->script = gum_script_backend_create_sync (fixture->backend,
-      "testcase", source, NULL, NULL, &err);
+  timer = g_timer_new ();
+
+  if (from_bytecode)
+  {
+    fixture->script = gum_script_backend_create_from_bytes_sync (
+        fixture->backend, frida_swift_bytecode, NULL, NULL, &err);
+  }
+  else
+  {
+    gchar * source;
+
+    source = g_strconcat (
+        frida_swift_bundle,
+        "\n;\n",
+        "(function testcase(Swift) {\n",
+        raw_source, "\n",
+        "})(LocalSwift);",
+        NULL);
+
+    fixture->script = gum_script_backend_create_sync (fixture->backend,
+        "testcase", source, NULL, NULL, &err);
+
+    g_free (source);
+  }
   if (err != NULL)
     g_printerr ("%s\n", err->message);
   g_assert (fixture->script != NULL);
   g_assert (err == NULL);
 
-  g_free (source);
-  g_free (raw_source);
+  create_time = g_timer_elapsed (timer, NULL);
 
   gum_script_set_message_handler (fixture->script,
       test_fixture_store_message, fixture, NULL);
 
+  g_timer_reset (timer);
   gum_script_load_sync (fixture->script, NULL);
+
+  /*
+   * The precompiled bridge receives the testcase through its loader stub,
+   * whereas from source it has already run as part of the load: wait for it
+   * so that both load times include the testcase.
+   */
+  if (from_bytecode)
+  {
+    JsonBuilder * builder;
+    JsonNode * root;
+    gchar * message;
+
+    builder = json_builder_new ();
+    json_builder_begin_object (builder);
+    json_builder_set_member_name (builder, "type");
+    json_builder_add_string_value (builder, "testcase");
+    json_builder_set_member_name (builder, "source");
+    json_builder_add_string_value (builder, raw_source);
+    json_builder_end_object (builder);
+
+    root = json_builder_get_root (builder);
+    message = json_to_string (root, FALSE);
+    fixture->testcase_done = FALSE;
+    gum_script_post (fixture->script, message, NULL);
+
+    while (!fixture->testcase_done)
+      g_main_context_iteration (fixture->context, TRUE);
+
+    g_free (message);
+    json_node_unref (root);
+    g_object_unref (builder);
+  }
+
+  load_times = &frida_swift_load_times[test_fixture_backend_is_qjs (fixture)
+      ? 0 : 1];
+  load_times->num_scripts++;
+  load_times->create_time += create_time;
+  load_times->load_time += g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  g_free (raw_source);
+}
+
+static gboolean
+test_fixture_backend_is_qjs (TestFixture * fixture)
+{
+  return strcmp (g_type_name (G_TYPE_FROM_INSTANCE (fixture->backend)),
+      "GumQuickScriptBackend") == 0;
 }
 
 static TestMessageItem *
@@ -42,6 +42,21 @@
 #define TESTGROUP_END()                                                     \
     group = "";
 
+/*
+ * Sent by the bytecode loader stub once the testcase has run, so that load
+ * times cover the testcase with and without bytecode alike.
+ */
+#define TEST_TESTCASE_DONE_PAYLOAD "frida-swift:testcase-done"
+
+typedef struct _TestScriptLoadTimes TestScriptLoadTimes;
+
+struct _TestScriptLoadTimes
+{
+  guint num_scripts;
+  gdouble create_time;
+  gdouble load_time;
+};
+
 #define TEST_RUN_LIST(NAME) TEST_RUN_LIST_WITH_DATA (NAME, NULL)
 #define TEST_RUN_LIST_WITH_DATA(NAME, FIXTURE_DATA)                         \
   G_STMT_START                                                              \
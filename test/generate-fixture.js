@@ -0,0 +1,166 @@
+#!/usr/bin/env node
+/**
+ * Emits the Swift source of a synthetic module for the scaling benchmarks,
+ * parameterized by its name so that the Makefile can build any point of a
+ * sweep with a single pattern rule, e.g.
+ *
+ *   Scale_t1000_f8_m4_p16_c8_d2
+ *
+ * t: number of types, split evenly between classes, structs and enums
+ * f: number of stored properties per type (cases for enums)
+ * m: number of methods per type
+ * p: number of protocols
+ * c: number of conforming types per protocol
+ * d: depth of class hierarchies
+ *
+ * Usage: generate-fixture.js <module name>
+ */
+
+const PARAMETER_NAMES = {
+    t: "types",
+    f: "fields",
+    m: "methods",
+    p: "protocols",
+    c: "conformances",
+    d: "depth",
+};
+
+const FIELD_TYPES = ["Int", "String", "Double", "Int?", "[Int]", "Bool"];
+
+function parseModuleName(name) {
+    const params = {
+        types: 0,
+        fields: 0,
+        methods: 0,
+        protocols: 0,
+        conformances: 0,
+        depth: 1,
+    };
+
+    for (const part of name.split("_").slice(1)) {
+        const key = PARAMETER_NAMES[part[0]];
+        const value = parseInt(part.substring(1), 10);
+
+        if (key === undefined || isNaN(value)) {
+            throw new Error(`Invalid fixture name component: ${part}`);
+        }
+
+        params[key] = value;
+    }
+
+    params.depth = Math.max(params.depth, 1);
+
+    return params;
+}
+
+function generate(params) {
+    const { types, fields, methods, protocols, conformances, depth } = params;
+    const lines = [];
+    const emit = (line = "") => lines.push(line);
+
+    for (let p = 0; p !== protocols; p++) {
+        emit(`public protocol Proto${p} {`);
+        emit(`    func requirement${p}() -> Int`);
+        emit("}");
+        emit();
+    }
+
+    /* Types the protocols can be conformed to without redundancy */
+    const conformable = [];
+
+    for (let i = 0; i !== types; i++) {
+        switch (i % 3) {
+            case 0: {
+                const position = Math.floor(i / 3) % depth;
+                const superclass = position === 0 ? "" : `: Type${i - 3}`;
+                const override = position === 0 ? "" : "override ";
+
+                emit(`open class Type${i}${superclass} {`);
+                for (let f = 0; f !== fields; f++) {
+                    const type = FIELD_TYPES[f % FIELD_TYPES.length];
+                    emit(`    public var field${i}_${f}: ${type}`);
+                }
+                emit(`    public ${override}init() {`);
+                for (let f = 0; f !== fields; f++) {
+                    emit(`        field${i}_${f} = ${defaultValueOf(f)}`);
+                }
+                if (position !== 0) {
+                    emit("        super.init()");
+                }
+                emit("    }");
+                emitMethods(emit, i, methods);
+                emit("}");
+
+                if (position === 0) {
+                    conformable.push(i);
+                }
+                break;
+            }
+            case 1:
+                emit(`public struct Type${i} {`);
+                for (let f = 0; f !== fields; f++) {
+                    const type = FIELD_TYPES[f % FIELD_TYPES.length];
+                    emit(`    public var field${i}_${f}: ${type} = ${defaultValueOf(f)}`);
+                }
+                emitMethods(emit, i, methods);
+                emit("}");
+                conformable.push(i);
+                break;
+            case 2:
+                emit(`public enum Type${i} {`);
+                for (let f = 0; f !== Math.max(fields, 1); f++) {
+                    const payload =
+                        f % 2 === 0 ? "" : `(${FIELD_TYPES[f % FIELD_TYPES.length]})`;
+                    emit(`    case case${f}${payload}`);
+                }
+                emitMethods(emit, i, methods);
+                emit("}");
+                conformable.push(i);
+                break;
+        }
+        emit();
+    }
+
+    const perProtocol = Math.min(conformances, conformable.length);
+    for (let p = 0; p !== protocols; p++) {
+        for (let k = 0; k !== perProtocol; k++) {
+            const type = conformable[(p * perProtocol + k) % conformable.length];
+            emit(`extension Type${type}: Proto${p} {`);
+            emit(`    public func requirement${p}() -> Int { return ${p} }`);
+            emit("}");
+        }
+    }
+
+    return lines.join("\n") + "\n";
+}
+
+function emitMethods(emit, type, count) {
+    for (let m = 0; m !== count; m++) {
+        emit(`    public func method${type}_${m}(_ x: Int) -> Int { return x &+ ${m} }`);
+    }
+}
+
+function defaultValueOf(field) {
+    switch (FIELD_TYPES[field % FIELD_TYPES.length]) {
+        case "Int":
+            return `${field}`;
+        case "String":
+            return `"${field}"`;
+        case "Double":
+            return `${field}.5`;
+        case "Int?":
+            return "nil";
+        case "[Int]":
+            return "[]";
+        case "Bool":
+            return "false";
+    }
+}
+
+const name = process.argv[2];
+if (name === undefined) {
+    console.error("Usage: generate-fixture.js <module name>");
+    process.exit(1);
+}
+
+process.stdout.write(generate(parseModuleName(name)));
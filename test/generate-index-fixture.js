@@ -0,0 +1,210 @@
+#!/usr/bin/env node
+/**
+ * Writes a synthetic arm64 Mach-O dylib holding just enough Swift metadata
+ * for tools/swift-index.ts to index, so that the index format consumed by
+ * Swift.loadIndex() can be checked against index-fixture.json without a
+ * Swift toolchain. Only the descriptor fields the indexer reads are filled
+ * in.
+ *
+ * Module "Fixture":
+ *  - struct Point, class Thing and enum Direction
+ *  - generic struct Box, which isn't indexed
+ *  - struct Orphan, whose parent is imported and thus has no name offline
+ *  - protocol Shape, conformed to by Point and Box, and by a type referenced
+ *    indirectly
+ *
+ * Usage: generate-index-fixture.js <output>
+ */
+
+import { writeFileSync } from "fs";
+
+const MH_MAGIC_64 = 0xfeedfacf;
+const MH_DYLIB = 0x6;
+const CPU_TYPE_ARM64 = 0x0100000c;
+const LC_SEGMENT_64 = 0x19;
+const LC_UUID = 0x1b;
+const LC_ID_DYLIB = 0x0d;
+const VM_PROT_READ_EXECUTE = 0x5;
+
+const SIZEOF_MACH_HEADER_64 = 0x20;
+const SIZEOF_SEGMENT_COMMAND_64 = 0x48;
+const SIZEOF_SECTION_64 = 0x50;
+
+const KIND_MODULE = 0;
+const KIND_PROTOCOL = 3;
+const KIND_CLASS = 16;
+const KIND_STRUCT = 17;
+const KIND_ENUM = 18;
+const IS_UNIQUE = 0x40;
+const IS_GENERIC = 0x80;
+
+/* TypeReferenceKind, in bits 3-5 of conformance flags */
+const DIRECT_TYPE_DESCRIPTOR = 0;
+const INDIRECT_TYPE_DESCRIPTOR = 1;
+
+const UUID = "5f1d0c3a9e7b4d2c8a6f0e1b2c3d4e5f";
+const INSTALL_NAME = "@rpath/libFixture.dylib";
+
+const DATA_START = 0x400;
+const IMAGE_SIZE = 0x1000;
+
+const SECTIONS = ["__const", "__swift5_types", "__swift5_protos", "__swift5_proto"];
+
+class Image {
+    constructor() {
+        this.buffer = Buffer.alloc(IMAGE_SIZE);
+        this.cursor = DATA_START;
+    }
+
+    align(alignment) {
+        this.cursor = Math.ceil(this.cursor / alignment) * alignment;
+    }
+
+    allocate(size) {
+        this.align(4);
+        const address = this.cursor;
+        this.cursor += size;
+        return address;
+    }
+
+    writeU32(address, value) {
+        this.buffer.writeUInt32LE(value >>> 0, address);
+    }
+
+    writeRelative(address, target) {
+        this.buffer.writeInt32LE(target - address, address);
+    }
+
+    string(value) {
+        const address = this.cursor;
+        this.buffer.write(value + "\0", address, "utf8");
+        this.cursor += Buffer.byteLength(value) + 1;
+        return address;
+    }
+
+    /* flags, parent, name, then room for the rest of a type descriptor */
+    descriptor(flags, parent, name) {
+        const nameAddress = this.string(name);
+        const address = this.allocate(0x20);
+
+        this.writeU32(address, flags);
+        if (parent !== null) {
+            this.writeRelative(address + 0x4, parent);
+        }
+        this.writeRelative(address + 0x8, nameAddress);
+
+        return address;
+    }
+
+    conformance(protocol, typeRefKind, typeRef) {
+        const address = this.allocate(0x10);
+
+        this.writeRelative(address, protocol);
+        this.writeRelative(address + 0x4, typeRef);
+        this.writeU32(address + 0xc, typeRefKind << 3);
+
+        return address;
+    }
+
+    /* A section of relative pointers to `targets` */
+    recordSection(targets) {
+        const start = this.allocate(targets.length * 4);
+        targets.forEach((t, i) => this.writeRelative(start + i * 4, t));
+        return { start, size: targets.length * 4 };
+    }
+}
+
+function generate() {
+    const image = new Image();
+
+    const constStart = image.cursor;
+    const module = image.descriptor(KIND_MODULE | IS_UNIQUE, null, "Fixture");
+    const point = image.descriptor(KIND_STRUCT | IS_UNIQUE, module, "Point");
+    const box = image.descriptor(
+        KIND_STRUCT | IS_UNIQUE | IS_GENERIC,
+        module,
+        "Box"
+    );
+    const thing = image.descriptor(KIND_CLASS | IS_UNIQUE, module, "Thing");
+    const direction = image.descriptor(KIND_ENUM | IS_UNIQUE, module, "Direction");
+
+    /* The parent is reached through a GOT-like slot, bound by dyld */
+    const slot = image.allocate(8);
+    const orphan = image.descriptor(KIND_STRUCT | IS_UNIQUE, null, "Orphan");
+    image.writeRelative(orphan + 0x4, slot + 1);
+
+    const shape = image.descriptor(KIND_PROTOCOL | IS_UNIQUE, module, "Shape");
+
+    const conformances = [
+        image.conformance(shape, DIRECT_TYPE_DESCRIPTOR, point),
+        image.conformance(shape, DIRECT_TYPE_DESCRIPTOR, box),
+        image.conformance(shape, INDIRECT_TYPE_DESCRIPTOR, slot),
+    ];
+    const constEnd = image.cursor;
+
+    const sections = [
+        { start: constStart, size: constEnd - constStart },
+        image.recordSection([point, box, thing, direction, orphan]),
+        image.recordSection([shape]),
+        image.recordSection(conformances),
+    ];
+
+    writeLoadCommands(image.buffer, sections);
+
+    return image.buffer;
+}
+
+function writeLoadCommands(buffer, sections) {
+    const segmentSize = SIZEOF_SEGMENT_COMMAND_64 + SECTIONS.length * SIZEOF_SECTION_64;
+    const uuidSize = 0x18;
+    const dylibSize = Math.ceil((0x18 + INSTALL_NAME.length + 1) / 8) * 8;
+
+    buffer.writeUInt32LE(MH_MAGIC_64, 0x0);
+    buffer.writeUInt32LE(CPU_TYPE_ARM64, 0x4);
+    buffer.writeUInt32LE(MH_DYLIB, 0xc);
+    buffer.writeUInt32LE(3, 0x10);
+    buffer.writeUInt32LE(segmentSize + uuidSize + dylibSize, 0x14);
+
+    let offset = SIZEOF_MACH_HEADER_64;
+
+    buffer.writeUInt32LE(LC_SEGMENT_64, offset);
+    buffer.writeUInt32LE(segmentSize, offset + 0x4);
+    buffer.write("__TEXT", offset + 0x8, "latin1");
+    /* vmaddr and fileoff are both 0, so addresses are file offsets */
+    buffer.writeBigUInt64LE(BigInt(IMAGE_SIZE), offset + 0x20);
+    buffer.writeBigUInt64LE(BigInt(IMAGE_SIZE), offset + 0x30);
+    buffer.writeUInt32LE(VM_PROT_READ_EXECUTE, offset + 0x38);
+    buffer.writeUInt32LE(VM_PROT_READ_EXECUTE, offset + 0x3c);
+    buffer.writeUInt32LE(SECTIONS.length, offset + 0x40);
+
+    SECTIONS.forEach((name, i) => {
+        const section = offset + SIZEOF_SEGMENT_COMMAND_64 + i * SIZEOF_SECTION_64;
+        const { start, size } = sections[i];
+
+        buffer.write(name, section, "latin1");
+        buffer.write("__TEXT", section + 0x10, "latin1");
+        buffer.writeBigUInt64LE(BigInt(start), section + 0x20);
+        buffer.writeBigUInt64LE(BigInt(size), section + 0x28);
+        buffer.writeUInt32LE(start, section + 0x30);
+        buffer.writeUInt32LE(2, section + 0x34);
+    });
+    offset += segmentSize;
+
+    buffer.writeUInt32LE(LC_UUID, offset);
+    buffer.writeUInt32LE(uuidSize, offset + 0x4);
+    Buffer.from(UUID, "hex").copy(buffer, offset + 0x8);
+    offset += uuidSize;
+
+    buffer.writeUInt32LE(LC_ID_DYLIB, offset);
+    buffer.writeUInt32LE(dylibSize, offset + 0x4);
+    buffer.writeUInt32LE(0x18, offset + 0x8);
+    buffer.write(INSTALL_NAME, offset + 0x18, "utf8");
+}
+
+const output = process.argv[2];
+if (output === undefined) {
+    console.error("Usage: generate-index-fixture.js <output>");
+    process.exit(1);
+}
+
+writeFileSync(output, generate());
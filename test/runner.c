@@ -7,15 +7,45 @@
   if (v8_backend != NULL)                                           \
     TEST_RUN_LIST_WITH_DATA (name, v8_backend)
 
+/*
+ * Appended to the bridge before compiling it, so that the precompiled script
+ * can be handed each testcase's source at runtime.
+ */
+#define BYTECODE_LOADER \
+    "recv('testcase', function (message) {\n" \
+    "  try {\n" \
+    "    (new Function('Swift', message.source))(LocalSwift);\n" \
+    "  } finally {\n" \
+    "    send('" TEST_TESTCASE_DONE_PAYLOAD "');\n" \
+    "  }\n" \
+    "});\n"
+
+static void parse_runner_options (gint * argc, gchar *** argv);
 static gchar * load_bundle (void);
+static GBytes * compile_bundle (GumScriptBackend * backend);
+static GBytes * load_bytecode (const gchar * path);
+static void print_load_times (const gchar * backend_name,
+    const TestScriptLoadTimes * load_times);
+static void write_bench_results (const gchar * path);
 
 static gchar * detect_runner_location (void);
 static gboolean store_path_of_test_runner (const GumModuleDetails * details,
     gpointer user_data);
 
 gchar * frida_swift_bundle = NULL;
+GBytes * frida_swift_bytecode = NULL;
+TestScriptLoadTimes frida_swift_load_times[2] = { { 0, }, };
 guint num_tests_run = 0;
 
+static gchar * compile_bytecode_path = NULL;
+static gchar * bytecode_path = NULL;
+static gboolean report_load_time = FALSE;
+
+static gboolean run_benchmarks = FALSE;
+static gchar * bench_output_path = NULL;
+JsonArray * bench_results = NULL;
+gchar * scaling_fixtures_dir = NULL;
+
 int
 main (int argc, char * argv[])
 {
@@ -25,10 +55,34 @@ main (int argc, char * argv[])
   gdouble t;
 
   gum_init_embedded ();
+  parse_runner_options (&argc, &argv);
   g_test_init (&argc, &argv, NULL);
 
   frida_swift_bundle = load_bundle ();
 
+  if (compile_bytecode_path != NULL)
+  {
+    GBytes * bytecode;
+    GError * error = NULL;
+
+    bytecode = compile_bundle (gum_script_backend_obtain_qjs ());
+    if (!g_file_set_contents (compile_bytecode_path,
+        g_bytes_get_data (bytecode, NULL), g_bytes_get_size (bytecode),
+        &error))
+    {
+      g_printerr ("Unable to write bytecode: %s\n", error->message);
+      exit (1);
+    }
+
+    g_bytes_unref (bytecode);
+    g_free (compile_bytecode_path);
+
+    return 0;
+  }
+
+  if (bytecode_path != NULL)
+    frida_swift_bytecode = load_bytecode (bytecode_path);
+
   exceptor = gum_exceptor_obtain ();
 
 #ifdef HAVE_V8
@@ -37,6 +91,20 @@ main (int argc, char * argv[])
 
   RUN_SUITE (basics);
 
+  if (run_benchmarks)
+  {
+    gchar * runner_location, * runner_dir;
+
+    runner_location = detect_runner_location ();
+    runner_dir = g_path_get_dirname (runner_location);
+    scaling_fixtures_dir = g_build_filename (runner_dir, "fixtures", NULL);
+    g_free (runner_dir);
+    g_free (runner_location);
+
+    bench_results = json_array_new ();
+    RUN_SUITE (bench);
+  }
+
   {
     GTimer * timer = g_timer_new ();
 
@@ -51,11 +119,171 @@ main (int argc, char * argv[])
       (num_tests_run != 1) ? "s" : "",
       t);
 
+  if (report_load_time)
+  {
+    g_print ("\nScript create and load times%s:\n",
+        (frida_swift_bytecode != NULL) ? " (QJS from bytecode)" : "");
+    print_load_times ("QJS", &frida_swift_load_times[0]);
+    print_load_times ("V8", &frida_swift_load_times[1]);
+  }
+
+  if (bench_results != NULL)
+  {
+    if (bench_output_path != NULL)
+      write_bench_results (bench_output_path);
+    json_array_unref (bench_results);
+  }
+  g_free (bench_output_path);
+  g_free (scaling_fixtures_dir);
+  g_clear_pointer (&frida_swift_bytecode, g_bytes_unref);
+  g_free (bytecode_path);
+
   g_clear_object (&exceptor);
 
   return result;
 }
 
+/*
+ * Strips our own options before GLib gets to see them:
+ *   --bench                   also run the bench suite
+ *   --bench-output=PATH       write its results to PATH as JSON, implies --bench
+ *   --compile-bytecode=PATH   precompile the bridge for QJS to PATH and exit
+ *   --bytecode=PATH           load the bridge from bytecode on QJS
+ *   --report-load-time        print how long scripts took to create and load,
+ *                             up to their testcase having run
+ */
+static void
+parse_runner_options (gint * argc,
+                      gchar *** argv)
+{
+  gint i, j;
+
+  for (i = 1, j = 1; i != *argc; i++)
+  {
+    const gchar * arg = (*argv)[i];
+
+    if (strcmp (arg, "--bench") == 0)
+    {
+      run_benchmarks = TRUE;
+    }
+    else if (g_str_has_prefix (arg, "--bench-output="))
+    {
+      run_benchmarks = TRUE;
+      g_free (bench_output_path);
+      bench_output_path = g_strdup (arg + strlen ("--bench-output="));
+    }
+    else if (g_str_has_prefix (arg, "--compile-bytecode="))
+    {
+      g_free (compile_bytecode_path);
+      compile_bytecode_path =
+          g_strdup (arg + strlen ("--compile-bytecode="));
+    }
+    else if (g_str_has_prefix (arg, "--bytecode="))
+    {
+      g_free (bytecode_path);
+      bytecode_path = g_strdup (arg + strlen ("--bytecode="));
+    }
+    else if (strcmp (arg, "--report-load-time") == 0)
+    {
+      report_load_time = TRUE;
+    }
+    else
+    {
+      (*argv)[j++] = (*argv)[i];
+    }
+  }
+
+  (*argv)[j] = NULL;
+  *argc = j;
+}
+
+static void
+write_bench_results (const gchar * path)
+{
+  JsonObject * root;
+  JsonNode * node;
+  JsonGenerator * generator;
+  GError * error = NULL;
+
+  root = json_object_new ();
+  json_object_set_array_member (root, "results",
+      json_array_ref (bench_results));
+
+  node = json_node_new (JSON_NODE_OBJECT);
+  json_node_take_object (node, root);
+
+  generator = json_generator_new ();
+  json_generator_set_root (generator, node);
+  json_generator_set_pretty (generator, TRUE);
+
+  if (!json_generator_to_file (generator, path, &error))
+  {
+    g_printerr ("Unable to write bench results: %s\n", error->message);
+    g_error_free (error);
+  }
+
+  g_object_unref (generator);
+  json_node_unref (node);
+}
+
+static GBytes *
+compile_bundle (GumScriptBackend * backend)
+{
+  GBytes * bytecode;
+  gchar * source;
+  GTimer * timer;
+  GError * error = NULL;
+
+  source = g_strconcat (frida_swift_bundle, "\n;\n", BYTECODE_LOADER, NULL);
+
+  timer = g_timer_new ();
+  bytecode = gum_script_backend_compile_sync (backend, "frida-swift-bridge",
+      source, NULL, &error);
+  if (error != NULL)
+  {
+    g_printerr ("Unable to compile bundle: %s\n", error->message);
+    exit (1);
+  }
+
+  g_print ("Compiled bundle to %" G_GSIZE_FORMAT " bytes in %.3f seconds\n",
+      g_bytes_get_size (bytecode), g_timer_elapsed (timer, NULL));
+
+  g_timer_destroy (timer);
+  g_free (source);
+
+  return bytecode;
+}
+
+static GBytes *
+load_bytecode (const gchar * path)
+{
+  gchar * contents;
+  gsize length;
+  GError * error = NULL;
+
+  if (!g_file_get_contents (path, &contents, &length, &error))
+  {
+    g_printerr ("Unable to load bytecode: %s\n", error->message);
+    exit (1);
+  }
+
+  return g_bytes_new_take (contents, length);
+}
+
+static void
+print_load_times (const gchar * backend_name,
+                  const TestScriptLoadTimes * load_times)
+{
+  if (load_times->num_scripts == 0)
+    return;
+
+  g_print ("  %-4s %u scripts, create %.2f ms and load %.2f ms on average\n",
+      backend_name,
+      load_times->num_scripts,
+      load_times->create_time * 1000.0 / load_times->num_scripts,
+      load_times->load_time * 1000.0 / load_times->num_scripts);
+}
+
 static gchar *
 load_bundle (void)
 {
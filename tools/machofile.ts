@@ -0,0 +1,313 @@
+/**
+ * Minimal, dependency-free Mach-O reader for host-side tooling. Only what's
+ * needed to walk the Swift metadata sections is implemented.
+ *
+ * TODO:
+ *  - Support 32-bit images
+ *  - Follow chained fixups to name imported symbols
+ */
+
+import { closeSync, fstatSync, openSync, readSync } from "fs";
+
+const FAT_MAGIC = 0xcafebabe;
+const FAT_MAGIC_64 = 0xcafebabf;
+const MH_MAGIC_64 = 0xfeedfacf;
+
+const LC_SEGMENT_64 = 0x19;
+const LC_UUID = 0x1b;
+const LC_ID_DYLIB = 0x0d;
+
+const CPU_TYPE_X86_64 = 0x01000007;
+const CPU_TYPE_ARM64 = 0x0100000c;
+
+const PAGE_SIZE = 0x10000;
+const MAX_CACHED_PAGES = 256;
+
+export interface MachOSection {
+    segmentName: string;
+    sectionName: string;
+    vmAddress: bigint;
+    size: number;
+}
+
+interface MachOSegment {
+    name: string;
+    vmAddress: bigint;
+    vmSize: bigint;
+    fileOffset: number;
+    fileSize: number;
+}
+
+/**
+ * Reads a file on demand in fixed-size pages, so that indexing a large
+ * framework only touches the parts of it we actually walk.
+ */
+class PagedFileReader {
+    #fd: number;
+    #size: number;
+    #pages = new Map<number, Buffer>();
+
+    constructor(path: string) {
+        this.#fd = openSync(path, "r");
+        this.#size = fstatSync(this.#fd).size;
+    }
+
+    get size(): number {
+        return this.#size;
+    }
+
+    close(): void {
+        closeSync(this.#fd);
+        this.#pages.clear();
+    }
+
+    read(offset: number, length: number): Buffer {
+        const first = Math.floor(offset / PAGE_SIZE);
+        const last = Math.floor((offset + length - 1) / PAGE_SIZE);
+
+        if (first === last) {
+            const start = offset - first * PAGE_SIZE;
+            return this.getPage(first).subarray(start, start + length);
+        }
+
+        const result = Buffer.alloc(length);
+        readSync(this.#fd, result, 0, length, offset);
+        return result;
+    }
+
+    private getPage(index: number): Buffer {
+        let page = this.#pages.get(index);
+
+        if (page === undefined) {
+            if (this.#pages.size >= MAX_CACHED_PAGES) {
+                const oldest = this.#pages.keys().next().value;
+                this.#pages.delete(oldest);
+            }
+
+            page = Buffer.alloc(PAGE_SIZE);
+            const n = readSync(this.#fd, page, 0, PAGE_SIZE, index * PAGE_SIZE);
+            page = page.subarray(0, n);
+            this.#pages.set(index, page);
+        }
+
+        return page;
+    }
+}
+
+export class MachOFile {
+    readonly images: MachOImage[] = [];
+
+    #reader: PagedFileReader;
+
+    constructor(readonly path: string) {
+        this.#reader = new PagedFileReader(path);
+        const magic = this.#reader.read(0, 4).readUInt32BE(0);
+
+        if (magic === FAT_MAGIC || magic === FAT_MAGIC_64) {
+            const is64 = magic === FAT_MAGIC_64;
+            const numArchs = this.#reader.read(4, 4).readUInt32BE(0);
+            const archSize = is64 ? 32 : 20;
+
+            for (let i = 0; i !== numArchs; i++) {
+                const arch = this.#reader.read(8 + i * archSize, archSize);
+                const offset = is64
+                    ? Number(arch.readBigUInt64BE(8))
+                    : arch.readUInt32BE(8);
+                this.images.push(new MachOImage(this.#reader, offset));
+            }
+        } else {
+            this.images.push(new MachOImage(this.#reader, 0));
+        }
+    }
+
+    close(): void {
+        this.#reader.close();
+    }
+}
+
+export class MachOImage {
+    readonly arch: string;
+    readonly segments: MachOSegment[] = [];
+    readonly sections: MachOSection[] = [];
+    uuid: string = null;
+    installName: string = null;
+
+    #textVmAddress: bigint;
+
+    constructor(private reader: PagedFileReader, readonly sliceOffset: number) {
+        const header = reader.read(sliceOffset, 32);
+
+        if (header.readUInt32LE(0) !== MH_MAGIC_64) {
+            throw new Error("Not a 64-bit Mach-O image");
+        }
+
+        const cpuType = header.readUInt32LE(4);
+        this.arch =
+            cpuType === CPU_TYPE_ARM64
+                ? "arm64"
+                : cpuType === CPU_TYPE_X86_64
+                ? "x64"
+                : `cpu-${cpuType.toString(16)}`;
+
+        const numCommands = header.readUInt32LE(16);
+        const sizeOfCommands = header.readUInt32LE(20);
+        const commands = reader.read(sliceOffset + 32, sizeOfCommands);
+
+        for (let i = 0, offset = 0; i !== numCommands; i++) {
+            const cmd = commands.readUInt32LE(offset);
+            const cmdSize = commands.readUInt32LE(offset + 4);
+
+            switch (cmd) {
+                case LC_SEGMENT_64:
+                    this.parseSegment(commands, offset);
+                    break;
+                case LC_UUID:
+                    this.uuid = commands
+                        .subarray(offset + 8, offset + 24)
+                        .toString("hex");
+                    break;
+                case LC_ID_DYLIB: {
+                    const nameOffset = commands.readUInt32LE(offset + 8);
+                    const raw = commands.subarray(
+                        offset + nameOffset,
+                        offset + cmdSize
+                    );
+                    this.installName = raw
+                        .subarray(0, raw.indexOf(0))
+                        .toString("utf8");
+                    break;
+                }
+            }
+
+            offset += cmdSize;
+        }
+
+        const text = this.segments.find((s) => s.name === "__TEXT");
+        if (text === undefined) {
+            throw new Error("Image has no __TEXT segment");
+        }
+        this.#textVmAddress = text.vmAddress;
+    }
+
+    findSection(
+        sectionName: string,
+        segmentName = "__TEXT"
+    ): MachOSection | undefined {
+        return this.sections.find(
+            (s) =>
+                s.sectionName === sectionName && s.segmentName === segmentName
+        );
+    }
+
+    /** Offset of `address` from the image's Mach-O header. */
+    offsetOf(address: bigint): number {
+        return Number(address - this.#textVmAddress);
+    }
+
+    readU8(address: bigint): number {
+        return this.read(address, 1).readUInt8(0);
+    }
+
+    readU32(address: bigint): number {
+        return this.read(address, 4).readUInt32LE(0);
+    }
+
+    readS32(address: bigint): number {
+        return this.read(address, 4).readInt32LE(0);
+    }
+
+    readCString(address: bigint): string {
+        const chunks: Buffer[] = [];
+
+        for (;;) {
+            const chunk = this.read(address, 64, true);
+            const end = chunk.indexOf(0);
+
+            if (end !== -1) {
+                chunks.push(chunk.subarray(0, end));
+                break;
+            }
+
+            chunks.push(chunk);
+            address += BigInt(chunk.length);
+        }
+
+        return Buffer.concat(chunks).toString("utf8");
+    }
+
+    /** @returns null for a null relative pointer */
+    readRelativeDirectPointer(address: bigint): bigint | null {
+        const offset = this.readS32(address);
+        return offset === 0 ? null : address + BigInt(offset);
+    }
+
+    /**
+     * Indirect pointers point to a slot that is only filled in by dyld, which
+     * we can't resolve offline.
+     * @returns null for a null or indirect relative pointer
+     */
+    readRelativeIndirectablePointer(address: bigint): bigint | null {
+        const offset = this.readS32(address);
+
+        if (offset === 0 || (offset & 1) !== 0) {
+            return null;
+        }
+
+        return address + BigInt(offset);
+    }
+
+    private read(address: bigint, length: number, partial = false): Buffer {
+        for (const segment of this.segments) {
+            const start = segment.vmAddress;
+
+            if (address < start || address >= start + BigInt(segment.fileSize)) {
+                continue;
+            }
+
+            const delta = Number(address - start);
+            const available = segment.fileSize - delta;
+
+            if (available < length) {
+                if (!partial) {
+                    break;
+                }
+                length = available;
+            }
+
+            return this.reader.read(
+                this.sliceOffset + segment.fileOffset + delta,
+                length
+            );
+        }
+
+        throw new Error(`Address 0x${address.toString(16)} is not mapped`);
+    }
+
+    private parseSegment(commands: Buffer, offset: number): void {
+        const segment: MachOSegment = {
+            name: readFixedString(commands, offset + 8),
+            vmAddress: commands.readBigUInt64LE(offset + 24),
+            vmSize: commands.readBigUInt64LE(offset + 32),
+            fileOffset: Number(commands.readBigUInt64LE(offset + 40)),
+            fileSize: Number(commands.readBigUInt64LE(offset + 48)),
+        };
+        this.segments.push(segment);
+
+        const numSections = commands.readUInt32LE(offset + 64);
+        for (let i = 0; i !== numSections; i++) {
+            const section = offset + 72 + i * 80;
+            this.sections.push({
+                sectionName: readFixedString(commands, section),
+                segmentName: readFixedString(commands, section + 16),
+                vmAddress: commands.readBigUInt64LE(section + 32),
+                size: Number(commands.readBigUInt64LE(section + 40)),
+            });
+        }
+    }
+}
+
+function readFixedString(buffer: Buffer, offset: number): string {
+    const raw = buffer.subarray(offset, offset + 16);
+    const end = raw.indexOf(0);
+    return raw.subarray(0, end === -1 ? 16 : end).toString("latin1");
+}
@@ -0,0 +1,228 @@
+#!/usr/bin/env node
+/**
+ * Host-side Swift metadata indexer. Walks the Swift sections of Mach-O files
+ * on disk, without needing a live process or libmacho, and emits the index the
+ * agent would otherwise build by scanning, see Swift.loadIndex().
+ *
+ * Usage: swift-index [--arch <arch>] [-o <output>] <binary>...
+ */
+
+import { basename } from "path";
+import { writeFileSync } from "fs";
+import { MachOFile, MachOImage } from "./machofile.js";
+import {
+    SWIFT_INDEX_FORMAT,
+    SWIFT_INDEX_VERSION,
+    SwiftImageIndex,
+    SwiftIndex,
+    SwiftIndexConformanceRecord,
+    SwiftIndexTypeRecord,
+} from "../lib/swiftindex.js";
+
+/* Mirrors ContextDescriptorKind in abi/metadatavalues.ts */
+const enum ContextDescriptorKind {
+    Module = 0,
+    Protocol = 3,
+    Class = 16,
+    Struct = 17,
+    Enum = 18,
+}
+
+const enum TypeReferenceKind {
+    DirectTypeDescriptor = 0x00,
+}
+
+const CONTEXT_DESCRIPTOR_IS_GENERIC = 0x80;
+const OFFSETOF_PARENT = 0x4;
+const OFFSETOF_NAME = 0x8;
+const OFFSETOF_CONFORMANCE_TYPE_REF = 0x4;
+const OFFSETOF_CONFORMANCE_FLAGS = 0xc;
+
+const RELATIVE_POINTER_SIZE = 4;
+const MAX_CONTEXT_DEPTH = 64;
+
+function indexImage(image: MachOImage, name: string): SwiftImageIndex {
+    const types: SwiftIndexTypeRecord[] = [];
+    const typeNames = new Map<bigint, string | null>();
+
+    for (const descriptor of enumerateSectionRecords(image, "__swift5_types")) {
+        const flags = image.readU32(descriptor);
+        const kind = flags & 0x1f;
+
+        if (
+            (flags & CONTEXT_DESCRIPTOR_IS_GENERIC) !== 0 ||
+            (kind !== ContextDescriptorKind.Class &&
+                kind !== ContextDescriptorKind.Struct &&
+                kind !== ContextDescriptorKind.Enum)
+        ) {
+            continue;
+        }
+
+        const fullTypeName = getFullName(image, descriptor);
+        typeNames.set(descriptor, fullTypeName);
+        types.push([image.offsetOf(descriptor), kind, fullTypeName]);
+    }
+
+    const protocols = enumerateSectionRecords(image, "__swift5_protos").map(
+        (descriptor): [number, string | null] => [
+            image.offsetOf(descriptor),
+            getFullName(image, descriptor),
+        ]
+    );
+
+    const conformances: SwiftIndexConformanceRecord[] = [];
+    for (const descriptor of enumerateSectionRecords(image, "__swift5_proto")) {
+        const flags = image.readU32(descriptor + BigInt(OFFSETOF_CONFORMANCE_FLAGS));
+        const typeRefKind = (flags >> 3) & 0x7;
+        let typeName: string | null = null;
+
+        if (typeRefKind === TypeReferenceKind.DirectTypeDescriptor) {
+            const typeDescriptor = image.readRelativeDirectPointer(
+                descriptor + BigInt(OFFSETOF_CONFORMANCE_TYPE_REF)
+            );
+            typeName = typeNames.get(typeDescriptor) ?? null;
+
+            /* Generic or otherwise unindexed types are skipped in-process too */
+            if (typeName === null && typeDescriptor !== null) {
+                const typeFlags = image.readU32(typeDescriptor);
+                if (
+                    (typeFlags & CONTEXT_DESCRIPTOR_IS_GENERIC) !== 0 ||
+                    (typeFlags & 0x1f) === ContextDescriptorKind.Protocol
+                ) {
+                    continue;
+                }
+            }
+        }
+
+        conformances.push([image.offsetOf(descriptor), typeName]);
+    }
+
+    return {
+        uuid: image.uuid,
+        name,
+        arch: image.arch,
+        types,
+        protocols,
+        conformances,
+    };
+}
+
+function enumerateSectionRecords(
+    image: MachOImage,
+    sectionName: string
+): bigint[] {
+    const section = image.findSection(sectionName);
+    const result: bigint[] = [];
+
+    if (section === undefined) {
+        return result;
+    }
+
+    for (let i = 0; i < section.size; i += RELATIVE_POINTER_SIZE) {
+        const record = section.vmAddress + BigInt(i);
+        const descriptor = image.readRelativeDirectPointer(record);
+
+        if (descriptor !== null) {
+            result.push(descriptor);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Computes "<module>.<name>" the same way getFullTypeName() does in-process.
+ * @returns null if the module context can't be reached offline
+ */
+function getFullName(image: MachOImage, descriptor: bigint): string | null {
+    const name = readName(image, descriptor);
+    let context = descriptor;
+
+    for (let depth = 0; depth !== MAX_CONTEXT_DEPTH; depth++) {
+        context = image.readRelativeIndirectablePointer(
+            context + BigInt(OFFSETOF_PARENT)
+        );
+
+        if (context === null) {
+            return null;
+        }
+
+        if ((image.readU32(context) & 0x1f) === ContextDescriptorKind.Module) {
+            return `${readName(image, context)}.${name}`;
+        }
+    }
+
+    return null;
+}
+
+function readName(image: MachOImage, descriptor: bigint): string {
+    const pointer = image.readRelativeDirectPointer(
+        descriptor + BigInt(OFFSETOF_NAME)
+    );
+    return image.readCString(pointer);
+}
+
+function main(argv: string[]): number {
+    const paths: string[] = [];
+    let arch: string = null;
+    let output: string = null;
+
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+
+        if (arg === "--arch") {
+            arch = argv[++i];
+        } else if (arg === "-o" || arg === "--output") {
+            output = argv[++i];
+        } else {
+            paths.push(arg);
+        }
+    }
+
+    if (paths.length === 0) {
+        console.error(
+            "Usage: swift-index [--arch <arch>] [-o <output>] <binary>..."
+        );
+        return 1;
+    }
+
+    const index: SwiftIndex = {
+        format: SWIFT_INDEX_FORMAT,
+        version: SWIFT_INDEX_VERSION,
+        images: [],
+    };
+
+    for (const path of paths) {
+        const file = new MachOFile(path);
+
+        try {
+            for (const image of file.images) {
+                if (arch !== null && image.arch !== arch) {
+                    continue;
+                }
+
+                if (image.uuid === null) {
+                    console.warn(`${path} (${image.arch}) has no UUID, skipping`);
+                    continue;
+                }
+
+                const name = basename(image.installName ?? path);
+                index.images.push(indexImage(image, name));
+            }
+        } finally {
+            file.close();
+        }
+    }
+
+    const json = JSON.stringify(index);
+
+    if (output === null) {
+        process.stdout.write(json + "\n");
+    } else {
+        writeFileSync(output, json);
+    }
+
+    return 0;
+}
+
+process.exitCode = main(process.argv.slice(2));